@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
@@ -35,47 +37,29 @@ public:
     }
 
     const Interval& axis_interval(int n) const {
-        if (n == 1) {
-            return y;
-        }
-        if (n == 2) {
-            return z;
-        }
-        return x;
+        return this->*axes[n];
     }
 
     bool hit(const Ray& r, Interval ray_t) const {
-        const Point3& ray_orig = r.origin();
-        const Vec3& ray_dir = r.direction();
+        // Branchless slab test. The ray's direction signs pick each slab's near and far planes
+        // up front, so every axis is a multiply-subtract per plane followed by min/max. The ray
+        // keeps its inverse direction finite, so no plane distance is ever NaN.
+        const Vec3& inv_dir = r.inverse_direction();
+        const Vec3& orig_inv_dir = r.origin_times_inverse();
 
         for (int axis = 0; axis < 3; axis++) {
-            const Interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
-
-            auto t0 = (ax.min - ray_orig[axis]) * adinv;
-            auto t1 = (ax.max - ray_orig[axis]) * adinv;
-
-            if (t0 < t1) {
-                if (t0 > ray_t.min) {
-                    ray_t.min = t0;
-                }
-                if (t1 < ray_t.max) {
-                    ray_t.max = t1;
-                }
-            } else {
-                if (t1 > ray_t.min) {
-                    ray_t.min = t1;
-                }
-                if (t0 < ray_t.max) {
-                    ray_t.max = t0;
-                }
-            }
-
-            if (ray_t.max <= ray_t.min) {
-                return false;
-            }
+            const Interval& ax = this->*axes[axis];
+            bool negative = r.is_negative(axis);
+            double near_plane = negative ? ax.max : ax.min;
+            double far_plane = negative ? ax.min : ax.max;
+
+            double t_near = (near_plane * inv_dir[axis]) - orig_inv_dir[axis];
+            double t_far = (far_plane * inv_dir[axis]) - orig_inv_dir[axis];
+
+            ray_t.min = std::max(ray_t.min, t_near);
+            ray_t.max = std::min(ray_t.max, t_far);
         }
-        return true;
+        return ray_t.min < ray_t.max;
     }
 
     int longest_axis() const {
@@ -91,6 +75,8 @@ public:
     static const AABB universe;
 
 private:
+    static constexpr Interval AABB::* axes[3] = {&AABB::x, &AABB::y, &AABB::z};
+
     void pad_to_minimums() {
         // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
         double delta = 0.0001;
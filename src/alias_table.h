@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "sampler.h"
+
+class AliasTable {
+public:
+    // Samples indices in proportion to a set of non-negative weights in constant time, whatever
+    // the weights (Walker's alias method, built with Vose's algorithm). Every bin holds the
+    // probability of keeping its own index and the index to pick otherwise.
+    AliasTable() {}
+
+    AliasTable(const std::vector<double>& weights) : bins(weights.size()) {
+        double total = 0;
+        for (double weight : weights) {
+            total += weight;
+        }
+        if (total <= 0) {
+            bins.clear();
+            return;
+        }
+
+        // Scale the weights so that they average one, then repeatedly top up an under-full bin
+        // from an over-full one.
+        std::vector<size_t> under;
+        std::vector<size_t> over;
+        std::vector<double> scaled(weights.size());
+        for (size_t i = 0; i < weights.size(); i++) {
+            bins[i].pmf = weights[i] / total;
+            scaled[i] = bins[i].pmf * weights.size();
+            (scaled[i] < 1 ? under : over).push_back(i);
+        }
+
+        while (!under.empty() && !over.empty()) {
+            size_t small = under.back();
+            under.pop_back();
+            size_t large = over.back();
+            over.pop_back();
+
+            bins[small].keep = scaled[small];
+            bins[small].alias = large;
+            scaled[large] -= 1 - scaled[small];
+            (scaled[large] < 1 ? under : over).push_back(large);
+        }
+
+        // Whatever is left is full, up to rounding.
+        for (size_t i : under) {
+            bins[i].keep = 1;
+        }
+        for (size_t i : over) {
+            bins[i].keep = 1;
+        }
+    }
+
+    bool empty() const { return bins.empty(); }
+    size_t size() const { return bins.size(); }
+    double pmf(size_t index) const { return bins[index].pmf; }
+
+    size_t sample(double u, double* u_remapped = nullptr) const {
+        // Picks an index with the uniform sample u. If u_remapped is given, it is set to a fresh
+        // uniform sample made from what is left of u's precision.
+        double scaled = u * bins.size();
+        size_t offset = std::min(size_t(scaled), bins.size() - 1);
+        double up = std::min(scaled - offset, one_minus_epsilon);
+
+        const Bin& bin = bins[offset];
+        if (up < bin.keep) {
+            if (u_remapped != nullptr) {
+                *u_remapped = std::min(up / bin.keep, one_minus_epsilon);
+            }
+            return offset;
+        }
+        if (u_remapped != nullptr) {
+            *u_remapped = std::min((up - bin.keep) / (1 - bin.keep), one_minus_epsilon);
+        }
+        return bin.alias;
+    }
+
+private:
+    struct Bin {
+        double keep = 0; // Probability of keeping this bin's index
+        size_t alias = 0; // Index picked otherwise
+        double pmf = 0; // Probability of picking this bin's index overall
+    };
+
+    std::vector<Bin> bins;
+};
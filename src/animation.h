@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "aabb.h"
+#include "camera.h"
+#include "dynamic_bvh.h"
+#include "hittable.h"
+#include "keyframed_transform.h"
+
+class Animation {
+public:
+    int first_frame = 0; // First frame rendered by render()
+    int last_frame = 0; // Last frame rendered by render(), inclusive
+    bool incremental = false; // Whether frames after the first only re-render the tiles that moving objects cover
+
+    // A scene whose keyframed objects move from frame to frame. The objects all live in one
+    // DynamicBvh that is refit, rather than rebuilt, as they move, and nothing else in the scene is
+    // touched between frames.
+    Animation(std::shared_ptr<DynamicBvh> bvh) : bvh(bvh) {}
+
+    void add(std::shared_ptr<KeyframedTransform> object) {
+        // Registers an object of the hierarchy as animated.
+        objects.push_back(object);
+    }
+
+    RefitStats set_frame(int frame, std::vector<AABB>* changed = nullptr) {
+        // Moves every animated object to where it is at `frame` and refits the hierarchy. The
+        // bounds of the objects that moved, before and after, are added to changed if given.
+        std::vector<const Hittable*> moved;
+        for (const std::shared_ptr<KeyframedTransform>& object : objects) {
+            AABB before = object->bounding_box();
+            if (object->set_frame(frame)) {
+                moved.push_back(object.get());
+                if (changed != nullptr) {
+                    changed->push_back(before);
+                    changed->push_back(object->bounding_box());
+                }
+            }
+        }
+        return bvh->refit(moved);
+    }
+
+    bool render(Camera cam, const Hittable& world) {
+        // Renders frames first_frame to last_frame of the world (which must contain the hierarchy),
+        // numbering the camera's output files (and checkpoints) by frame: image.ppm becomes
+        // image.0000.ppm, image.0001.ppm, ...
+        //
+        // Incrementally, the first frame is rendered in full and kept, and each later one only
+        // re-renders the tiles of it that the objects that moved covered before or after moving
+        // (see Camera::render_changes()), so it takes time in proportion to the area that changed.
+        // The shadows and reflections they cast outside those tiles aren't updated.
+        //
+        // When resuming, the frames that have checkpoints resume from them and the frames that
+        // don't (not reached yet when the animation was stopped) are rendered from the start.
+        // Returns false, at the first frame whose checkpoint can't be resumed, if one can't.
+        std::string image_filename = cam.image_filename;
+        std::string checkpoint_filename = cam.checkpoint_filename;
+        bool resume = cam.resume;
+        std::unique_ptr<Framebuffer> previous;
+
+        for (int frame = first_frame; frame <= last_frame; frame++) {
+            auto setup_start = std::chrono::steady_clock::now();
+            std::vector<AABB> changed;
+            RefitStats stats = set_frame(frame, &changed);
+            double setup_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - setup_start).count();
+            spdlog::info("Frame {}: {} objects moved, {} nodes refit, {} subtrees ({} nodes) rebuilt in {:.3f} ms",
+                         frame, stats.moved, stats.refit_nodes, stats.rebuilds, stats.rebuilt_nodes, setup_ms);
+
+            cam.image_filename = frame_filename(image_filename, frame);
+            if (!checkpoint_filename.empty()) {
+                cam.checkpoint_filename = frame_filename(checkpoint_filename, frame);
+            }
+            cam.resume = resume && checkpoint_exists(cam.checkpoint_filename);
+            if (resume && !cam.resume) {
+                spdlog::info("Frame {}: no checkpoint at {}, rendering it from the start", frame, cam.checkpoint_filename);
+            }
+            if (!incremental) {
+                if (!cam.render(world)) {
+                    return false;
+                }
+            } else if (!previous) {
+                std::optional<Framebuffer> framebuffer = cam.render_to_framebuffer(world);
+                if (!framebuffer) {
+                    return false;
+                }
+                previous = std::make_unique<Framebuffer>(std::move(*framebuffer));
+                cam.write_image(*previous);
+            } else {
+                auto render_start = std::chrono::steady_clock::now();
+                size_t pixels = cam.render_changes(world, *previous, changed);
+                double render_ms =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count();
+                spdlog::info("Frame {}: re-rendered {} of {} pixels in {:.1f} ms", frame, pixels,
+                             size_t(previous->image_width()) * previous->image_height(), render_ms);
+                cam.write_image(*previous);
+            }
+        }
+        return true;
+    }
+
+private:
+    std::shared_ptr<DynamicBvh> bvh;
+    std::vector<std::shared_ptr<KeyframedTransform>> objects;
+
+    static std::string frame_filename(const std::string& filename, int frame) {
+        // Inserts the frame number before the extension.
+        size_t dot = filename.find_last_of('.');
+        if (dot == std::string::npos) {
+            return fmt::format("{}.{:04d}", filename, frame);
+        }
+        return fmt::format("{}.{:04d}{}", filename.substr(0, dot), frame, filename.substr(dot));
+    }
+};
@@ -7,6 +7,7 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "instrumentation.h"
 
 class BvhNode : public Hittable {
 public:
@@ -46,6 +47,7 @@ public:
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        count_bvh_node();
         if (!bbox.hit(r, ray_t)) {
             return false;
         }
@@ -56,13 +58,58 @@ public:
         return hit_left || hit_right;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        count_bvh_node();
+        if (!bbox.hit(r, ray_t)) {
+            return false;
+        }
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
     AABB bounding_box() const override { return bbox; }
 
+    bool describe_hierarchy(HierarchyDescription& description) const override {
+        description.type = "BvhNode";
+        describe(description);
+        return true;
+    }
+
 private:
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB bbox;
 
+    int describe(HierarchyDescription& description) const {
+        // A node whose children are both primitives is a leaf of one or two objects. Every node is
+        // an allocation of its own, with make_shared's two reference counts alongside.
+        int index = description.add_node(bbox);
+        description.bytes += sizeof(BvhNode) + (2 * sizeof(long));
+
+        const BvhNode* left_node = dynamic_cast<const BvhNode*>(left.get());
+        const BvhNode* right_node = dynamic_cast<const BvhNode*>(right.get());
+        if (left_node == nullptr && right_node == nullptr) {
+            description.nodes[index].objects.push_back(left);
+            if (right != left) {
+                description.nodes[index].objects.push_back(right);
+            }
+            return index;
+        }
+
+        auto describe_child = [&description](const std::shared_ptr<Hittable>& child, const BvhNode* child_node) {
+            if (child_node != nullptr) {
+                return child_node->describe(description);
+            }
+            int leaf = description.add_node(child->bounding_box());
+            description.nodes[leaf].objects.push_back(child);
+            return leaf;
+        };
+        int left_index = describe_child(left, left_node);
+        int right_index = describe_child(right, right_node);
+        description.nodes[index].left = left_index;
+        description.nodes[index].right = right_index;
+        return index;
+    }
+
     static bool box_compare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis_index) {
         Interval a_axis_interval = a->bounding_box().axis_interval(axis_index);
         Interval b_axis_interval = b->bounding_box().axis_interval(axis_index);
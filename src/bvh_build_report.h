@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "lambertian.h"
+#include "parallel_bvh.h"
+#include "rtweekend.h"
+#include "sphere.h"
+
+inline void bvh_build_report(size_t primitives) {
+    // Builds hierarchies over a cloud of primitives small spheres with BvhNode and with both of
+    // ParallelBvh's builders on 1, 2, 4, ... threads up to one per hardware thread, logging each
+    // build's time and speedup. Then traces the same random rays through each tree, logging its
+    // surface area heuristic cost and ray throughput, and checks they all find the same hits.
+    HittableList cloud;
+    auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    double extent = std::cbrt(double(primitives)) * 2;
+    for (size_t i = 0; i < primitives; i++) {
+        Point3 center(random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent));
+        cloud.add(std::make_shared<Sphere>(center, random_double(0.05, 0.5), material));
+    }
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    BvhNode reference(cloud);
+    spdlog::info("{} spheres; BvhNode builds in {:.3f}s on one thread", primitives, seconds_since(start));
+
+    int hardware_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < hardware_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(hardware_threads);
+
+    spdlog::info("{:>8} {:>12} {:>8} {:>12} {:>8}", "threads", "SAH seconds", "speedup", "LBVH seconds", "speedup");
+    double single_thread_seconds[2] = {0, 0};
+    std::unique_ptr<ParallelBvh> trees[2];
+    for (int threads : thread_counts) {
+        ThreadPool pool(threads);
+        double seconds[2];
+        for (int builder = 0; builder < 2; builder++) {
+            start = std::chrono::steady_clock::now();
+            trees[builder] = std::make_unique<ParallelBvh>(cloud, builder == 0 ? BvhBuilder::BinnedSah : BvhBuilder::Linear, pool);
+            seconds[builder] = seconds_since(start);
+            if (threads == 1) {
+                single_thread_seconds[builder] = seconds[builder];
+            }
+        }
+        spdlog::info("{:>8} {:>12.3f} {:>8.2f} {:>12.3f} {:>8.2f}", threads, seconds[0], single_thread_seconds[0] / seconds[0],
+                     seconds[1], single_thread_seconds[1] / seconds[1]);
+    }
+    if (hardware_threads == 1) {
+        spdlog::warn("This machine has a single hardware thread, so the builds can't scale here");
+    }
+
+    // Rays from all over the cloud, in random directions.
+    std::vector<Ray> rays;
+    for (int i = 0; i < 200000; i++) {
+        Point3 origin(random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent));
+        rays.emplace_back(origin, random_unit_vector());
+    }
+
+    const Hittable* worlds[3] = {&reference, trees[0].get(), trees[1].get()};
+    const char* names[3] = {"BvhNode", "binned SAH", "LBVH"};
+    std::vector<double> first_hits(rays.size());
+    spdlog::info("{:>10} {:>8} {:>10} {:>9} {:>10}", "tree", "nodes", "SAH cost", "Mrays/s", "identical");
+    for (int w = 0; w < 3; w++) {
+        bool identical = true;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rays.size(); i++) {
+            HitRecord rec;
+            double t = worlds[w]->hit(rays[i], Interval(0.001, infinity), rec) ? rec.t : infinity;
+            if (w == 0) {
+                first_hits[i] = t;
+            } else {
+                identical = identical && t == first_hits[i];
+            }
+        }
+        double seconds = seconds_since(start);
+        if (w == 0) {
+            spdlog::info("{:>10} {:>8} {:>10} {:>9.3f} {:>10}", names[w], "", "", rays.size() / seconds * 1e-6, "");
+        } else {
+            const ParallelBvh& tree = *trees[w - 1];
+            spdlog::info("{:>10} {:>8} {:>10.1f} {:>9.3f} {:>10}", names[w], tree.node_count(), tree.sah_cost(),
+                         rays.size() / seconds * 1e-6, identical ? "yes" : "NO");
+        }
+    }
+}
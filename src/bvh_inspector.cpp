@@ -0,0 +1,422 @@
+// Bounding volume hierarchy inspector.
+//
+// bvh_inspector [--scenes LIST] [--builder NAME] [--worst N] [--export DIR] [--export-depth N]
+//
+// Builds each scene and reports on the hierarchy its rays are traced through: how deep its leaves
+// are and how many objects they hold, its surface area heuristic (SAH) cost, how much sibling
+// nodes overlap, how much of each node is empty space and how much memory it takes. Then lists
+// the objects and nodes that cost the most, so that a scene that will render slowly can be
+// diagnosed, and fixed, before it is rendered.
+//
+// The SAH cost is the expected number of node visits and object tests for a ray that passes
+// through the scene's bounds, assuming rays in every direction from everywhere: each node is
+// weighted by its surface area over the root's. Siblings that overlap are both visited by any ray
+// through the overlap, so objects whose boxes reach into their siblings' (big planes, huge ground
+// spheres, long thin objects at an angle) are the usual culprits in slow scenes.
+//
+// Options:
+//     --scenes LIST       Comma separated scene numbers (default: all)
+//     --builder NAME      scene (default): inspect the scene's own hierarchy, or the BvhNode it
+//                         would get if it has none; median, sah or lbvh: build one over the
+//                         scene's objects with BvhNode or ParallelBvh's builders instead
+//     --worst N           How many of the worst objects and nodes to list (default 10)
+//     --export DIR        Write each node's box as a wireframe to DIR/scene<N>.bvh.obj, grouped by
+//                         depth, for viewing in any OBJ viewer
+//     --export-depth N    Only export nodes down to depth N (default: all)
+
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hierarchy_description.h"
+#include "hittable_list.h"
+#include "parallel_bvh.h"
+#include "scenes.h"
+
+struct InspectorSettings {
+    std::string builder = "scene";
+    int worst = 10;
+    std::string export_dir;
+    int export_depth = -1;
+};
+
+static double surface_area(const AABB& box) {
+    double dx = std::max(box.x.size(), 0.0);
+    double dy = std::max(box.y.size(), 0.0);
+    double dz = std::max(box.z.size(), 0.0);
+    return 2 * ((dx * dy) + (dx * dz) + (dy * dz));
+}
+
+static double volume(const AABB& box) {
+    return std::max(box.x.size(), 0.0) * std::max(box.y.size(), 0.0) * std::max(box.z.size(), 0.0);
+}
+
+static bool overlapping(const AABB& a, const AABB& b, AABB& overlap) {
+    // The box where a and b overlap, if they do. Built from intervals directly, since AABB's
+    // constructors pad thin boxes.
+    for (int axis = 0; axis < 3; axis++) {
+        const Interval& ia = a.axis_interval(axis);
+        const Interval& ib = b.axis_interval(axis);
+        Interval common(std::max(ia.min, ib.min), std::min(ia.max, ib.max));
+        if (common.min > common.max) {
+            return false;
+        }
+        (axis == 0 ? overlap.x : (axis == 1 ? overlap.y : overlap.z)) = common;
+    }
+    return true;
+}
+
+static std::string type_name(const Hittable& object) {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(typeid(object).name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : typeid(object).name();
+    std::free(demangled);
+    return name;
+}
+
+static void gather_primitives(const std::shared_ptr<Hittable>& object, std::vector<std::shared_ptr<Hittable>>& primitives) {
+    // The objects of a hierarchy are gathered from its leaves, so a rebuild covers what it covered.
+    HierarchyDescription nested;
+    if (!object->describe_hierarchy(nested)) {
+        primitives.push_back(object);
+        return;
+    }
+    for (const HierarchyDescription::Node& node : nested.nodes) {
+        for (const std::shared_ptr<Hittable>& leaf_object : node.objects) {
+            gather_primitives(leaf_object, primitives);
+        }
+    }
+}
+
+static bool describe_scene(const Scene& scene, const std::string& builder, HierarchyDescription& description) {
+    // The scene's own hierarchy if it is one and builder is "scene", otherwise one built over its
+    // objects.
+    const std::vector<std::shared_ptr<Hittable>>& top_level = scene.world.objects;
+    if (builder == "scene" && top_level.size() == 1 && top_level[0]->describe_hierarchy(description)) {
+        return true;
+    }
+    if (builder == "scene") {
+        spdlog::warn("The scene is a flat list of {} objects, traced without a hierarchy; inspecting the BvhNode it "
+                     "would get",
+                     top_level.size());
+    }
+
+    std::vector<std::shared_ptr<Hittable>> objects;
+    for (const std::shared_ptr<Hittable>& object : top_level) {
+        gather_primitives(object, objects);
+    }
+    HittableList primitives;
+    for (const std::shared_ptr<Hittable>& object : objects) {
+        primitives.add(object);
+    }
+
+    std::shared_ptr<Hittable> hierarchy;
+    if (builder == "sah") {
+        hierarchy = std::make_shared<ParallelBvh>(primitives, BvhBuilder::BinnedSah);
+    } else if (builder == "lbvh") {
+        hierarchy = std::make_shared<ParallelBvh>(primitives, BvhBuilder::Linear);
+    } else {
+        hierarchy = std::make_shared<BvhNode>(primitives);
+    }
+    return hierarchy->describe_hierarchy(description);
+}
+
+static void write_wireframes(const std::string& filename, const HierarchyDescription& description,
+                             const std::vector<int>& depths, int max_depth) {
+    // Each node's box as 8 vertices and 12 edges, in a group per depth.
+    std::ofstream file(filename);
+    if (!file) {
+        spdlog::error("Could not write '{}'", filename);
+        return;
+    }
+    int deepest = *std::max_element(depths.begin(), depths.end());
+    if (max_depth >= 0) {
+        deepest = std::min(deepest, max_depth);
+    }
+
+    static const int edges[12][2] = {{1, 2}, {2, 4}, {4, 3}, {3, 1}, {5, 6}, {6, 8},
+                                     {8, 7}, {7, 5}, {1, 5}, {2, 6}, {3, 7}, {4, 8}};
+    int vertices = 0;
+    for (int depth = 0; depth <= deepest; depth++) {
+        file << "g depth_" << depth << "\n";
+        for (size_t index = 0; index < description.nodes.size(); index++) {
+            if (depths[index] != depth) {
+                continue;
+            }
+            const AABB& box = description.nodes[index].bbox;
+            for (int corner = 0; corner < 8; corner++) {
+                file << "v " << ((corner & 4) ? box.x.max : box.x.min) << " " << ((corner & 2) ? box.y.max : box.y.min)
+                     << " " << ((corner & 1) ? box.z.max : box.z.min) << "\n";
+            }
+            for (const int* edge : edges) {
+                file << "l " << vertices + edge[0] << " " << vertices + edge[1] << "\n";
+            }
+            vertices += 8;
+        }
+    }
+    spdlog::info("Wrote the boxes of nodes down to depth {} to '{}'", deepest, filename);
+}
+
+static void inspect(int scene_id, const HierarchyDescription& description, const InspectorSettings& settings) {
+    const std::vector<HierarchyDescription::Node>& nodes = description.nodes;
+    if (nodes.empty()) {
+        spdlog::info("Empty hierarchy");
+        return;
+    }
+
+    // Depths and parents, walking down from the root; then subtree object counts, walking back up.
+    std::vector<int> depths(nodes.size(), 0);
+    std::vector<int> parents(nodes.size(), -1);
+    std::vector<int> order;
+    std::vector<int> stack = {0};
+    while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        order.push_back(index);
+        const HierarchyDescription::Node& node = nodes[index];
+        for (int child : {node.left, node.right}) {
+            if (child >= 0) {
+                depths[child] = depths[index] + 1;
+                parents[child] = index;
+                stack.push_back(child);
+            }
+        }
+    }
+    std::vector<size_t> subtree_objects(nodes.size(), 0);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        const HierarchyDescription::Node& node = nodes[*it];
+        subtree_objects[*it] = node.left >= 0 ? subtree_objects[node.left] + subtree_objects[node.right] : node.objects.size();
+    }
+
+    double root_area = surface_area(nodes[0].bbox);
+    size_t leaves = 0;
+    size_t references = 0;
+    double node_cost = 0;
+    double object_cost = 0;
+    double overlap_volume = 0;
+    double total_overlap = 0;
+    double total_empty = 0;
+    size_t interior = 0;
+    std::vector<size_t> leaf_depths;
+    std::vector<size_t> leaf_sizes;
+    for (size_t index = 0; index < nodes.size(); index++) {
+        const HierarchyDescription::Node& node = nodes[index];
+        double weight = root_area > 0 ? surface_area(node.bbox) / root_area : 1;
+        if (node.left < 0) {
+            leaves++;
+            references += node.objects.size();
+            object_cost += weight * double(node.objects.size());
+            leaf_depths.resize(std::max(leaf_depths.size(), size_t(depths[index]) + 1), 0);
+            leaf_depths[depths[index]]++;
+            leaf_sizes.resize(std::max(leaf_sizes.size(), node.objects.size() + 1), 0);
+            leaf_sizes[node.objects.size()]++;
+            continue;
+        }
+
+        // Interior nodes: the chance that a ray through the node has to visit both children, and
+        // how much of the node neither child covers. These are per node rather than weighted by
+        // area, since one huge object can make the root so big that every other node weighs
+        // nothing.
+        node_cost += weight;
+        interior++;
+        const AABB& left = nodes[node.left].bbox;
+        const AABB& right = nodes[node.right].bbox;
+        AABB overlap;
+        bool overlaps = overlapping(left, right, overlap);
+        double shared = overlaps ? volume(overlap) : 0;
+        double node_area = surface_area(node.bbox);
+        double node_volume = volume(node.bbox);
+        overlap_volume += shared;
+        total_overlap += overlaps && node_area > 0 ? surface_area(overlap) / node_area : 0;
+        if (node_volume > 0) {
+            total_empty += std::max(0.0, 1 - ((volume(left) + volume(right) - shared) / node_volume));
+        }
+    }
+
+    spdlog::info("Scene {}: {} with {} nodes, {} leaves and {} object references", scene_id, description.type,
+                 nodes.size(), leaves, references);
+    spdlog::info("  SAH cost {:.2f} ({:.2f} in node visits, {:.2f} in object tests)", node_cost + object_cost, node_cost,
+                 object_cost);
+    spdlog::info("  Memory {} bytes, {:.1f} per node", description.bytes, double(description.bytes) / double(nodes.size()));
+    spdlog::info("  Sibling overlap: rays through an interior node visit both children {:.1f}% of the time on "
+                 "average; overlap volume {:.3g} in all",
+                 interior > 0 ? 100 * total_overlap / double(interior) : 0.0, overlap_volume);
+    spdlog::info("  Empty space: {:.1f}% of an interior node's volume is in neither child on average",
+                 interior > 0 ? 100 * total_empty / double(interior) : 0.0);
+
+    auto bar = [](size_t count, size_t most) { return std::string(most > 0 ? (count * 40 + most - 1) / most : 0, '#'); };
+    size_t most_at_depth = *std::max_element(leaf_depths.begin(), leaf_depths.end());
+    spdlog::info("  Leaves by depth:");
+    for (size_t depth = 0; depth < leaf_depths.size(); depth++) {
+        if (leaf_depths[depth] > 0) {
+            spdlog::info("    {:>4} {:>8} {}", depth, leaf_depths[depth], bar(leaf_depths[depth], most_at_depth));
+        }
+    }
+    size_t most_of_size = *std::max_element(leaf_sizes.begin(), leaf_sizes.end());
+    spdlog::info("  Leaves by object count:");
+    for (size_t size = 0; size < leaf_sizes.size(); size++) {
+        if (leaf_sizes[size] > 0) {
+            spdlog::info("    {:>4} {:>8} {}", size, leaf_sizes[size], bar(leaf_sizes[size], most_of_size));
+        }
+    }
+
+    // The worst objects: those whose boxes stretch their ancestors' boxes far beyond the rest of
+    // their contents, so that rays enter those ancestors only to miss, and those whose boxes reach
+    // into their ancestors' siblings, which every ray through the overlap has to visit as well.
+    struct ObjectCost {
+        const Hittable* object;
+        int depth;
+        double inflation = 0; // Summed over its ancestors, the share of each one's area it alone adds
+        int straddled = 0; // Ancestors where the object's box overlaps the other child's
+        double overlap = 0; // Summed over those, the chance of a ray through the ancestor entering the overlap
+        double cost() const { return inflation + overlap; }
+    };
+    std::vector<ObjectCost> object_costs;
+    for (size_t index = 0; index < nodes.size(); index++) {
+        for (const std::shared_ptr<Hittable>& object : nodes[index].objects) {
+            ObjectCost entry{object.get(), depths[index]};
+            AABB object_box = object->bounding_box();
+            AABB without = AABB::empty; // The box each ancestor would have without this object
+            for (const std::shared_ptr<Hittable>& other : nodes[index].objects) {
+                if (other != object) {
+                    without = AABB(without, other->bounding_box());
+                }
+            }
+            for (int child = int(index), parent = parents[index]; parent >= 0; child = parent, parent = parents[parent]) {
+                int sibling = nodes[parent].left == child ? nodes[parent].right : nodes[parent].left;
+                double parent_area = surface_area(nodes[parent].bbox);
+                without = AABB(without, nodes[sibling].bbox);
+                if (parent_area > 0) {
+                    entry.inflation += std::max(0.0, 1 - (surface_area(without) / parent_area));
+                }
+                AABB overlap;
+                if (overlapping(object_box, nodes[sibling].bbox, overlap)) {
+                    entry.straddled++;
+                    entry.overlap += parent_area > 0 ? surface_area(overlap) / parent_area : 0;
+                }
+            }
+            object_costs.push_back(entry);
+        }
+    }
+    std::sort(object_costs.begin(), object_costs.end(),
+              [](const ObjectCost& a, const ObjectCost& b) { return a.cost() > b.cost(); });
+    spdlog::info("  Worst objects, by how much they inflate their ancestors plus how much they overlap their siblings:");
+    spdlog::info("    {:>6} {:<20} {:>28} {:>28} {:>6} {:>10} {:>10} {:>9}", "id", "type", "center", "size", "depth",
+                 "inflation", "straddles", "overlap");
+    for (size_t rank = 0; rank < object_costs.size() && int(rank) < settings.worst; rank++) {
+        const ObjectCost& entry = object_costs[rank];
+        if (entry.cost() <= 0) {
+            break;
+        }
+        AABB box = entry.object->bounding_box();
+        std::string center = fmt::format("({:.3g}, {:.3g}, {:.3g})", (box.x.min + box.x.max) / 2,
+                                         (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+        std::string size = fmt::format("({:.3g}, {:.3g}, {:.3g})", box.x.size(), box.y.size(), box.z.size());
+        spdlog::info("    {:>6} {:<20} {:>28} {:>28} {:>6} {:>10.3f} {:>10} {:>9.3f}", entry.object->id,
+                     type_name(*entry.object), center, size, entry.depth, entry.inflation, entry.straddled, entry.overlap);
+    }
+
+    // The worst nodes: those where rays most often have to visit both children, weighted by how
+    // many objects are under the node, since a miss high up the tree wastes a bigger subtree.
+    struct NodeCost {
+        int index;
+        double both; // Chance of a ray through the node visiting both children
+        double cost;
+    };
+    std::vector<NodeCost> node_costs;
+    for (size_t index = 0; index < nodes.size(); index++) {
+        const HierarchyDescription::Node& node = nodes[index];
+        AABB overlap;
+        double node_area = surface_area(node.bbox);
+        if (node.left >= 0 && node_area > 0 && overlapping(nodes[node.left].bbox, nodes[node.right].bbox, overlap)) {
+            double both = surface_area(overlap) / node_area;
+            node_costs.push_back(NodeCost{int(index), both, both * double(subtree_objects[index])});
+        }
+    }
+    std::sort(node_costs.begin(), node_costs.end(), [](const NodeCost& a, const NodeCost& b) { return a.cost > b.cost; });
+    spdlog::info("  Worst nodes, by how often both children are visited times the objects below:");
+    spdlog::info("    {:>6} {:>6} {:>8} {:>7} {:>36}", "node", "depth", "objects", "both", "bounds");
+    for (size_t rank = 0; rank < node_costs.size() && int(rank) < settings.worst; rank++) {
+        const NodeCost& entry = node_costs[rank];
+        const AABB& box = nodes[entry.index].bbox;
+        std::string bounds = fmt::format("({:.3g}, {:.3g}, {:.3g})-({:.3g}, {:.3g}, {:.3g})", box.x.min, box.y.min,
+                                         box.z.min, box.x.max, box.y.max, box.z.max);
+        spdlog::info("    {:>6} {:>6} {:>8} {:>6.1f}% {:>36}", entry.index, depths[entry.index],
+                     subtree_objects[entry.index], 100 * entry.both, bounds);
+    }
+
+    if (!settings.export_dir.empty()) {
+        write_wireframes(fmt::format("{}/scene{}.bvh.obj", settings.export_dir, scene_id), description, depths,
+                         settings.export_depth);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> scene_ids;
+    InspectorSettings settings;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+
+        if (option == "--scenes" && has_value) {
+            std::stringstream list(argv[++arg]);
+            std::string id;
+            while (std::getline(list, id, ',')) {
+                scene_ids.push_back(std::atoi(id.c_str()));
+            }
+        } else if (option == "--builder" && has_value) {
+            settings.builder = argv[++arg];
+            if (settings.builder != "scene" && settings.builder != "median" && settings.builder != "sah"
+                && settings.builder != "lbvh") {
+                spdlog::error("Unknown builder '{}', expected scene, median, sah or lbvh", settings.builder);
+                return 1;
+            }
+        } else if (option == "--worst" && has_value) {
+            settings.worst = std::atoi(argv[++arg]);
+        } else if (option == "--export" && has_value) {
+            settings.export_dir = argv[++arg];
+        } else if (option == "--export-depth" && has_value) {
+            settings.export_depth = std::atoi(argv[++arg]);
+        } else {
+            spdlog::error("Unknown or incomplete argument '{}'", option);
+            return 1;
+        }
+    }
+
+    if (scene_ids.empty()) {
+        for (int id = 1; id <= scene_count; id++) {
+            scene_ids.push_back(id);
+        }
+    }
+
+    for (int scene_id : scene_ids) {
+        Scene scene;
+        if (!build_scene(scene_id, scene)) {
+            spdlog::error("Unknown scene {}", scene_id);
+            return 1;
+        }
+
+        HierarchyDescription description;
+        if (!describe_scene(scene, settings.builder, description)) {
+            spdlog::error("Scene {} has nothing to inspect", scene_id);
+            return 1;
+        }
+        inspect(scene_id, description, settings);
+    }
+
+    return 0;
+}
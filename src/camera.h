@@ -1,27 +1,53 @@
 #pragma once
 
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "environment_light.h"
+#include "framebuffer.h"
 #include "hitrecord.h"
 #include "hittable.h"
+#include "image_writer.h"
+#include "instrumentation.h"
 #include "interval.h"
+#include "light_sampler.h"
 #include "material.h"
+#include "material_dispatch.h"
+#include "numa.h"
+#include "preview_publisher.h"
 #include "ray.h"
+#include "ray_sorter.h"
+#include "resource_cache.h"
+#include "sampler.h"
 #include "vec3.h"
 
 class Camera {
 public:
+    int scene_id = 0; // The scene (as numbered by build_scene) the camera looks at, to tell renders apart
     double aspect_ratio = 1.0; // Ratio of image width over height
     int image_width = 100; // Rendered image width in pixel count
     int samples_per_pixel = 10; // Count of random samples for each pixel
     int max_depth = 10; // Maximum number of ray bounces into scene
     Color background; // Scene background color
+    std::shared_ptr<EnvironmentLight> environment; // Light from all around, seen in place of the background, if any
 
     double vfov = 90; // Vertical view angle (field of view)
     Point3 lookfrom = Point3(0, 0, 0); // Point the camera is looking from (camera location)
@@ -32,36 +58,373 @@ public:
     double focus_distance = 10; // Distance from camera lookfrom point to plane of perfect focus
 
     std::string image_filename = "image.ppm";  // Filename of the output image.
+    unsigned aovs = AOV_NONE; // AovFlags to record alongside the beauty pass, written as PFMs
 
-    void render(const Hittable& world) {
+    int threads = 0; // Render threads, or 0 for one per hardware thread
+    int samples_per_pass = 16; // Samples added to every pixel by each progressive pass
+    SamplerType sampler_type = SamplerType::Independent; // Where each sample's random values come from
+    std::uint64_t seed = 0; // Every sample's random sequence derives from this, its pixel and its index
+    std::shared_ptr<LightSampler> lights; // Emitters to send shadow rays to from diffuse surfaces, if any
+    bool sample_environment = true; // Whether diffuse surfaces send shadow rays to the environment too
+    bool filtered_environment = false; // Whether light reflected between diffuse surfaces sees a low resolution environment
+
+    std::string checkpoint_filename; // Where to periodically save the render's progress, if anywhere
+    double checkpoint_interval = 600; // Minimum seconds between checkpoints
+    bool resume = false; // Continue from checkpoint_filename, e.g. after preemption or to add samples
+
+    std::string preview_target; // "-" to stream preview images to stdout, or a framebuffer file to map, if anywhere
+    double preview_interval = 1; // Minimum seconds between previews
+
+    int batch_size = 0; // Pixel samples traced together a bounce at a time, or 0 to trace each on its own
+    bool sort_rays = true; // Whether batches sort each bounce's rays by origin and direction before tracing them
+    bool pin_threads = false; // Whether to pin each render thread to its own core, grouped by NUMA node
+    size_t framebuffer_budget = 0; // Bytes the framebuffer may take, past which render() renders in bands, or 0 for no limit
+    PixelRect crop_window; // Pixels of the full frame render() renders and writes, or empty for all of them
+
+    bool render(const Hittable& world) {
+        // The image is written as the last pass finishes each scanline. Returns false, having
+        // rendered and written nothing, if a requested resume can't be honored or the crop
+        // window lies outside the frame.
+        if (!window_in_frame()) {
+            return false;
+        }
+        PixelRect window = image_window();
+        if (framebuffer_budget > 0
+            && Framebuffer::row_bytes(window.width(), aovs) * size_t(window.height()) > framebuffer_budget) {
+            if (!render_in_bands(world)) {
+                return false;
+            }
+            spdlog::info("Done");
+            return true;
+        }
+        std::optional<Framebuffer> framebuffer = initial_framebuffer();
+        if (!framebuffer) {
+            return false;
+        }
+        ImageWriter image_writer(image_filename, window.width(), window.height(), window.y0, window.x0);
+        render_passes(world, *framebuffer, &image_writer);
+        image_writer.finish();
+
+        if (aovs != AOV_NONE) {
+            framebuffer->write_pfms(image_stem());
+        }
+
+        spdlog::info("Done");
+        return true;
+    }
+
+    std::optional<Framebuffer> render_to_framebuffer(const Hittable& world, ImageWriter* image_writer = nullptr) {
+        // Renders the image, checkpointing along the way if asked to, and returns the accumulated
+        // samples, or nothing if a requested resume can't be honored or the crop window lies
+        // outside the frame. Scanlines are handed to
+        // image_writer, if given, as soon as they are final. With a crop window, only its pixels
+        // are rendered, and the framebuffer holds just those.
+        std::optional<Framebuffer> framebuffer = initial_framebuffer();
+        if (framebuffer) {
+            render_passes(world, *framebuffer, image_writer);
+        }
+        return framebuffer;
+    }
+
+    std::optional<Framebuffer> initial_framebuffer() {
+        // The framebuffer a render starts from: empty, or holding a checkpoint's samples if asked
+        // to resume. Returns nothing if the checkpoint can't be resumed, so that the render stops
+        // instead of starting over and overwriting the samples the checkpoint holds.
         initialize();
+        if (!window_in_frame()) {
+            return std::nullopt;
+        }
 
-        // Going to output directly to a file so a logger can be used.
-        std::ofstream image_file;
-        image_file.open(image_filename);
+        // The AOVs come from the same camera rays as the beauty pass. When none are requested the
+        // framebuffer allocates nothing for them and ray_color is never handed a sample to fill in.
+        PixelRect window = image_window();
+        Framebuffer framebuffer(window.width(), window.height(), aovs, window.y0, window.x0);
+        if (!resume) {
+            return framebuffer;
+        }
+        if (!read_checkpoint(checkpoint_filename, framebuffer, checkpoint_key())) {
+            spdlog::error("Not rendering, so that checkpoint '{}' is left as it is", checkpoint_filename);
+            return std::nullopt;
+        }
+        spdlog::info("Resuming from {} at {} samples per pixel", checkpoint_filename, framebuffer.min_sample_count());
+        return framebuffer;
+    }
 
-        image_file << "P3\n" << image_width << " " << image_height << "\n255\n";
+    void render_passes(const Hittable& world, Framebuffer& framebuffer, ImageWriter* image_writer) const {
+        // Brings the framebuffer from initial_framebuffer() up to samples_per_pixel in passes.
+        PixelRect window = framebuffer.window();
 
-        for (int j = 0; j < image_height; j++) {
-            for (int i = 0; i < image_width; i++) {
-                spdlog::info("Scanlines Remaining: {}, Pixels Remaining: {}", image_height - j, image_width - i);
-                Color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    Ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+        // Previews are published from the scanlines the render threads finish, so the first pass
+        // takes a single sample per pixel to show the whole image as soon as possible.
+        std::unique_ptr<PreviewPublisher> preview;
+        if (!preview_target.empty()) {
+            preview = std::make_unique<PreviewPublisher>(preview_target, window.width(), window.height(), preview_interval,
+                                                         window.y0, window.x0);
+            if (framebuffer.min_sample_count() > 0) {
+                preview->update(framebuffer);
+            }
+        }
+
+        // Render in progressive passes over the whole image, so there is a complete (if noisy)
+        // image to checkpoint between passes.
+        CheckpointWriter checkpoint_writer;
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        int pass_target = int(framebuffer.min_sample_count());
+
+        while (pass_target < samples_per_pixel) {
+            int pass_samples = (preview && pass_target == 0) ? 1 : std::max(samples_per_pass, 1);
+            pass_target = std::min(pass_target + pass_samples, samples_per_pixel);
+            render_pass(world, framebuffer, pass_target, preview.get(), pass_target == samples_per_pixel ? image_writer : nullptr);
+            spdlog::info("Samples per pixel: {}/{}", pass_target, samples_per_pixel);
+
+            auto now = std::chrono::steady_clock::now();
+            bool checkpoint_due = std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval;
+            if (!checkpoint_filename.empty() && checkpoint_due && pass_target < samples_per_pixel && !checkpoint_writer.busy()) {
+                checkpoint_writer.write_async(checkpoint_filename, framebuffer, checkpoint_key());
+                last_checkpoint = now;
+            }
+        }
+
+        // A final checkpoint lets a finished render be resumed with more samples later.
+        checkpoint_writer.wait();
+        if (!checkpoint_filename.empty()) {
+            write_checkpoint(checkpoint_filename, framebuffer, checkpoint_key());
+        }
+        if (preview) {
+            preview->finish();
+        }
+        if (image_writer != nullptr) {
+            // Nothing was left to render if a finished render was resumed.
+            image_writer->add_missing_rows(framebuffer);
+        }
+    }
+
+    std::optional<Framebuffer> start_render() {
+        // Sets the camera up for renderers that drive the passes themselves through render_rows()
+        // (see render_job.h) and returns an empty framebuffer for the image. Checkpoints and
+        // previews are left to such renderers. The framebuffer covers the crop window, if any;
+        // there is none if the crop window lies outside the frame.
+        initialize();
+        if (!window_in_frame()) {
+            return std::nullopt;
+        }
+        PixelRect window = image_window();
+        return Framebuffer(window.width(), window.height(), aovs, window.y0, window.x0);
+    }
+
+    std::uint64_t render_hash() const {
+        // A hash of what decides the image besides its sample count and crop window: the scene,
+        // the full frame's size and framing, the seed, the sampler and how lights are sampled.
+        // Renders whose samples get mixed, by resuming them or by distributed workers, have to
+        // agree on it. Scenes are told apart by their number, so it can't tell a scene edited
+        // in between from the original.
+        LightSampling light_sampling = lights ? lights->sampling_strategy() : LightSampling::None;
+        return ContentHash()
+            .add(std::string("camera"))
+            .add_value(scene_id)
+            .add_value(image_width)
+            .add_value(height())
+            .add_value(max_depth)
+            .add_value(background)
+            .add_value(vfov)
+            .add_value(lookfrom)
+            .add_value(lookat)
+            .add_value(vup)
+            .add_value(defocus_angle)
+            .add_value(focus_distance)
+            .add_value(seed)
+            .add_value(sampler_type)
+            .add_value(light_sampling)
+            .add_value(environment != nullptr)
+            .add_value(sample_environment)
+            .add_value(filtered_environment)
+            .value();
+    }
+
+    void render_rows(const Hittable& world, Framebuffer& framebuffer, int y0, int y1, int target_samples) const {
+        // Brings scanlines [y0, y1) up to target_samples samples on the calling thread. Calls for
+        // different scanlines can run at the same time, and the pixels come out identical to a
+        // full render's.
+        std::unique_ptr<Sampler> sampler = make_sampler(sampler_type, samples_per_pixel, seed);
+        PathBatch batch;
+        if (sort_rays) {
+            batch.sorter = RaySorter(world.bounding_box());
+        }
+        for (int j = y0; j < y1; j++) {
+            render_row(j, target_samples, world, *sampler, framebuffer, batch);
+        }
+    }
+
+    PixelRect screen_bounds(const AABB& box) const {
+        // The pixels whose rays may pass through box, from anywhere on the lens, with a pixel to
+        // spare for the jitter of samples within their pixels. A box reaching behind the lens
+        // covers the whole image. Needs initialize() (or a render) first.
+        PixelRect image{0, 0, image_width, image_height};
+        Point3 upper_left = pixel_zero_loc - (0.5 * (pixel_delta_u + pixel_delta_v));
+        std::vector<Vec3> lens_corners{Vec3(0, 0, 0)};
+        if (defocus_angle > 0) {
+            // The lens disk lies within the square around it, whose corners bound where its
+            // points project to.
+            for (double a : {-1.0, 1.0}) {
+                for (double b : {-1.0, 1.0}) {
+                    lens_corners.push_back((a * defocus_disk_u) + (b * defocus_disk_v));
                 }
-                write_color(image_file, pixel_samples_scale * pixel_color);
             }
         }
 
-        image_file.close();
+        double x_min = infinity;
+        double x_max = -infinity;
+        double y_min = infinity;
+        double y_max = -infinity;
+        for (int corner = 0; corner < 8; corner++) {
+            Point3 p(box.x.min, box.y.min, box.z.min);
+            for (int axis = 0; axis < 3; axis++) {
+                if (corner & (1 << axis)) {
+                    p[axis] = box.axis_interval(axis).max;
+                }
+            }
+            for (const Vec3& lens : lens_corners) {
+                // Where the ray from this point of the lens through p crosses the viewport.
+                Point3 origin = center + lens;
+                Vec3 to_p = p - origin;
+                double depth = -dot(to_p, w);
+                if (!(depth > 1e-8) || !std::isfinite(depth)) {
+                    return image;
+                }
+                Vec3 on_viewport = origin + (to_p * (focus_distance / depth)) - upper_left;
+                double x = dot(on_viewport, pixel_delta_u) / pixel_delta_u.length_squared();
+                double y = dot(on_viewport, pixel_delta_v) / pixel_delta_v.length_squared();
+                x_min = std::min(x_min, x);
+                x_max = std::max(x_max, x);
+                y_min = std::min(y_min, y);
+                y_max = std::max(y_max, y);
+            }
+        }
 
-        spdlog::info("Done");
+        auto to_pixel = [](double coordinate, int limit) {
+            return int(std::floor(std::clamp(coordinate, -2.0, double(limit) + 2)));
+        };
+        return PixelRect{to_pixel(x_min, image_width) - 1, to_pixel(y_min, image_height) - 1,
+                         to_pixel(x_max, image_width) + 2, to_pixel(y_max, image_height) + 2}
+            .intersect(image);
+    }
+
+    size_t render_changes(const Hittable& world, Framebuffer& framebuffer, const std::vector<AABB>& changed,
+                          int tile_size = 16) {
+        // Brings a finished render of the world up to date after some of its objects changed,
+        // given their bounds before and after: every tile of the framebuffer that any of those
+        // bounds covers on screen is rendered again and replaces the old one. What the changes
+        // do to the light reaching other tiles (shadows, reflections, light bounced off them)
+        // is not updated. Returns how many pixels were rendered.
+        initialize();
+        PixelRect window = framebuffer.window();
+        int columns = (window.width() + tile_size - 1) / tile_size;
+        int rows = (window.height() + tile_size - 1) / tile_size;
+        std::vector<bool> dirty(size_t(columns) * rows, false);
+        for (const AABB& box : changed) {
+            PixelRect covered = screen_bounds(box).intersect(window);
+            if (covered.empty()) {
+                continue;
+            }
+            for (int row = (covered.y0 - window.y0) / tile_size; row <= (covered.y1 - 1 - window.y0) / tile_size; row++) {
+                for (int column = (covered.x0 - window.x0) / tile_size;
+                     column <= (covered.x1 - 1 - window.x0) / tile_size; column++) {
+                    dirty[(size_t(row) * columns) + column] = true;
+                }
+            }
+        }
+
+        std::vector<PixelRect> tiles;
+        size_t pixels = 0;
+        for (int row = 0; row < rows; row++) {
+            for (int column = 0; column < columns; column++) {
+                if (dirty[(size_t(row) * columns) + column]) {
+                    int x0 = window.x0 + (column * tile_size);
+                    int y0 = window.y0 + (row * tile_size);
+                    tiles.push_back(PixelRect{x0, y0, x0 + tile_size, y0 + tile_size}.intersect(window));
+                    pixels += size_t(tiles.back().width()) * tiles.back().height();
+                }
+            }
+        }
+
+        // Tiles don't overlap, so each thread can patch its own into the framebuffer unlocked.
+        std::atomic<size_t> next_tile{0};
+        run_render_threads([&](int) {
+            std::unique_ptr<Sampler> sampler = make_sampler(sampler_type, samples_per_pixel, seed);
+            PathBatch batch;
+            if (sort_rays) {
+                batch.sorter = RaySorter(world.bounding_box());
+            }
+            for (size_t t = next_tile++; t < tiles.size(); t = next_tile++) {
+                const PixelRect& tile = tiles[t];
+                Framebuffer patch(tile.width(), tile.height(), framebuffer.requested(), tile.y0, tile.x0);
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    render_row(j, samples_per_pixel, world, *sampler, patch, batch);
+                }
+                framebuffer.copy_from(patch);
+            }
+        });
+        return pixels;
+    }
+
+    void render_tile(const Hittable& world, int x0, int y0, int x1, int y1, std::vector<Color>& pixels) {
+        // Renders the pixels in [x0, x1) x [y0, y1), storing their final colors row by row. Used
+        // to split one image across several renderers; AOVs are not recorded. Pixels come out
+        // identical to the same pixels of a full render.
+        initialize();
+
+        std::unique_ptr<Sampler> sampler = make_sampler(sampler_type, samples_per_pixel, seed);
+        pixels.clear();
+        pixels.reserve(size_t(x1 - x0) * (y1 - y0));
+
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                Color pixel_color(0, 0, 0);
+                sample_pixel(i, j, 0, samples_per_pixel, world, *sampler, pixel_color, nullptr);
+                pixels.push_back(pixel_color / samples_per_pixel);
+            }
+        }
+    }
+
+    void write_image(const Framebuffer& framebuffer) const {
+        // Writes the average of each pixel's samples to image_filename, and any AOVs next to it.
+        ImageWriter image_writer(image_filename, framebuffer.image_width(), framebuffer.image_height(),
+                                 framebuffer.first_row(), framebuffer.first_column());
+        image_writer.add_missing_rows(framebuffer);
+        image_writer.finish();
+        if (framebuffer.requested() != AOV_NONE) {
+            framebuffer.write_pfms(image_stem());
+        }
+    }
+
+    void write_image(const std::vector<Color>& pixels) const {
+        // Writes the final colors of every pixel, top scanline first, to image_filename.
+        ImageWriter image_writer(image_filename, image_width, height());
+        for (int j = 0; j < height(); j++) {
+            image_writer.add_row(j, &pixels[size_t(j) * image_width]);
+        }
+        image_writer.finish();
+    }
+
+    bool window_in_frame() const {
+        // Whether there are any pixels to render. Logs an error if not, which only happens when
+        // the crop window lies outside the full frame.
+        if (!crop_window.empty() && image_window().empty()) {
+            spdlog::error("The crop window {},{},{},{} lies outside the {}x{} frame", crop_window.x0, crop_window.y0,
+                          crop_window.x1, crop_window.y1, image_width, height());
+            return false;
+        }
+        return true;
+    }
+
+    int height() const {
+        // The rendered image height implied by image_width and aspect_ratio.
+        int h = int(image_width / aspect_ratio);
+        return (h < 1) ? 1 : h;
     }
 
 private:
     int image_height; // Rendered image height
-    double pixel_samples_scale; // Color scale factor for a sum pf pixel samples
     Point3 center; // Camera center
     Point3 pixel_zero_loc; // Location on pixel 0, 0
     Vec3 pixel_delta_u; // Offset to pixel to the right
@@ -73,10 +436,7 @@ private:
     Vec3 defocus_disk_v; // Defocus disk vertical radius
 
     void initialize() {
-        image_height = int(image_width / aspect_ratio);
-        image_height = (image_height < 1) ? 1 : image_height;
-
-        pixel_samples_scale = 1.0 / samples_per_pixel;
+        image_height = height();
 
         center = lookfrom;
 
@@ -109,53 +469,605 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    Vec3 sample_square() const {
-        // Returns the vector to a random point in the [-0.5, -0.5] - [+0.5, +0.5] unit square
-        return Vec3(random_double() - 0.5, random_double() - 0.5, 0);
-    }
-
-    Ray get_ray(int i, int j) const {
-        // Construct a camera ray originating from the defocus disk and directed at a randomly sampled
-        // point around the pixel location i, j
+    Ray get_ray(int i, int j, Sampler& sampler) const {
+        // Construct a camera ray originating from the defocus disk and directed at a sampled point
+        // around the pixel location i, j. The pixel offset, lens position and time are always
+        // taken, in that order, so the sampler's dimensions line up for every camera.
 
-        Vec3 offset = sample_square();
-        Point3 pixel_sample = pixel_zero_loc + ((i + offset[0]) * pixel_delta_u) + ((j + offset[1]) * pixel_delta_v);
+        Point2 offset = sampler.get_2d();
+        Point3 pixel_sample = pixel_zero_loc + ((i + offset.x - 0.5) * pixel_delta_u) + ((j + offset.y - 0.5) * pixel_delta_v);
 
-        Point3 ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        Point2 lens = sampler.get_2d();
+        Point3 ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens);
         Vec3 ray_direction = pixel_sample - ray_origin;
-        double ray_time = random_double();
+        double ray_time = sampler.get_1d();
 
         return Ray(ray_origin, ray_direction, ray_time);
     }
 
-    Point3 defocus_disk_sample() const {
-        // Returns a random point in the camera defocus disk
-        Vec3 p = random_in_unit_disk();
+    Point3 defocus_disk_sample(Point2 lens) const {
+        // Returns a point in the camera defocus disk
+        Vec3 p = sample_unit_disk(lens);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    Color ray_color(const Ray& r, int depth, const Hittable& world) const {
+    PixelRect image_window() const {
+        // The part of the full frame to render: the crop window, if there is one.
+        PixelRect image{0, 0, image_width, height()};
+        return crop_window.empty() ? image : crop_window.intersect(image);
+    }
+
+    CheckpointKey checkpoint_key() const {
+        LightSampling light_sampling = lights ? lights->sampling_strategy() : LightSampling::None;
+        PixelRect window = image_window();
+        return CheckpointKey{seed, render_hash(), std::uint32_t(sampler_type), std::uint32_t(light_sampling),
+                             window.x0, window.y0, samples_per_pixel, image_width, height()};
+    }
+
+    template <typename Function>
+    void run_render_threads(Function render_thread) const {
+        // Calls render_thread(thread) on every render thread and waits for them. Unpinned, the
+        // calling thread is one of them; pinned, each is a new thread pinned to its own core, so
+        // the calling thread's affinity is left alone.
+        int thread_count = threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+        auto run = [&](int thread) {
+            if (pin_threads) {
+                const NumaTopology& topology = NumaTopology::system();
+                if (!pin_thread({topology.thread_cpu(thread, thread_count)})) {
+                    spdlog::warn("Could not pin render thread {}", thread);
+                }
+            }
+            render_thread(thread);
+        };
+
+        std::vector<std::thread> workers;
+        for (int t = pin_threads ? 0 : 1; t < thread_count; t++) {
+            workers.emplace_back(run, t);
+        }
+        if (!pin_threads) {
+            run(0);
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    bool render_in_bands(const Hittable& world) {
+        // Renders the image a band of scanlines at a time, with no more than two bands' worth of
+        // framebuffer (together within framebuffer_budget) held at once, and streams each
+        // scanline to the image and AOV files as soon as it is done. Threads claim scanlines in
+        // order, moving on to the next band while the last of the previous one is finished, and
+        // wait only if that would take a third band. Each scanline is rendered to its full sample
+        // count in one go, so there are no passes, checkpoints or previews, and nothing to resume.
+        // Returns false, having rendered nothing, if asked to resume.
+        initialize();
+        if (resume) {
+            spdlog::error("Renders in bands can't be resumed; raise --framebuffer-mb to resume from '{}'",
+                          checkpoint_filename);
+            return false;
+        }
+        if (!checkpoint_filename.empty() || !preview_target.empty()) {
+            spdlog::warn("Checkpoints and previews are not available when rendering in bands");
+        }
+
+        PixelRect window = image_window();
+        size_t row_bytes = Framebuffer::row_bytes(window.width(), aovs);
+        int band_rows = int(std::min(size_t(window.height()), std::max(size_t(1), framebuffer_budget / (2 * row_bytes))));
+        if (size_t(band_rows) * 2 * row_bytes > framebuffer_budget) {
+            spdlog::warn("Two scanlines take {:.1f} MB, more than the framebuffer budget", 2.0 * row_bytes / (1 << 20));
+        }
+        int bands = (window.height() + band_rows - 1) / band_rows;
+        spdlog::info("Rendering in {} bands of {} scanlines ({:.1f} MB each)", bands, band_rows,
+                     double(band_rows) * row_bytes / (1 << 20));
+
+        ImageWriter image_writer(image_filename, window.width(), window.height(), window.y0, window.x0);
+        std::vector<std::pair<const AovInfo*, std::unique_ptr<PfmRowWriter>>> aov_writers;
+        for (const AovInfo& info : aov_table) {
+            if (aovs & info.flag) {
+                std::string filename = image_stem() + "." + info.name + ".pfm";
+                aov_writers.emplace_back(&info, std::make_unique<PfmRowWriter>(filename, window.width(), window.height(),
+                                                                              info.components));
+            }
+        }
+
+        // Band b lives in slot b % 2, once the band before it there is done and gone.
+        struct BandSlot {
+            int band = -1;
+            int rows_left = 0;
+            std::unique_ptr<Framebuffer> framebuffer;
+        };
+        BandSlot slots[2];
+        std::mutex mutex; // Guards slots
+        std::condition_variable band_done;
+        std::atomic<int> next_row{window.y0};
+
+        run_render_threads([&](int) {
+            std::unique_ptr<Sampler> sampler = make_sampler(sampler_type, samples_per_pixel, seed);
+            PathBatch batch;
+            if (sort_rays) {
+                batch.sorter = RaySorter(world.bounding_box());
+            }
+            std::vector<float> aov_row;
+            for (int j = next_row++; j < window.y1; j = next_row++) {
+                int band = (j - window.y0) / band_rows;
+                BandSlot& slot = slots[band % 2];
+                Framebuffer* framebuffer;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    band_done.wait(lock, [&] { return slot.band == band || slot.rows_left == 0; });
+                    if (slot.band != band) {
+                        int first_row = window.y0 + band * band_rows;
+                        int rows = std::min(band_rows, window.y1 - first_row);
+                        slot.band = band;
+                        slot.rows_left = rows;
+                        slot.framebuffer = std::make_unique<Framebuffer>(window.width(), rows, aovs, first_row, window.x0);
+                    }
+                    framebuffer = slot.framebuffer.get();
+                }
+
+                render_row(j, samples_per_pixel, world, *sampler, *framebuffer, batch);
+                image_writer.add_row(j, *framebuffer);
+                for (auto& [info, writer] : aov_writers) {
+                    aov_row.resize(size_t(window.width()) * info->components);
+                    framebuffer->resolve_row(*info, j, aov_row.data());
+                    writer->write_row(j - window.y0, aov_row.data());
+                }
+                spdlog::debug("Scanlines Remaining: {}", image_height - j - 1);
+
+                // The band is freed before the lock is let go, so the next band to use the slot
+                // can't be allocated while this one still takes up memory.
+                bool finished;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished = --slot.rows_left == 0;
+                    if (finished) {
+                        slot.framebuffer.reset();
+                    }
+                }
+                if (finished) {
+                    band_done.notify_all();
+                }
+            }
+        });
+
+        image_writer.finish();
+        for (auto& [info, writer] : aov_writers) {
+            if (writer->finish()) {
+                std::string filename = image_stem() + "." + info->name + ".pfm";
+                spdlog::info("Wrote AOV '{}' to {}", info->name, filename);
+                if (info->flag & AOV_COSTS) {
+                    write_heatmap(filename, image_stem() + "." + info->name + ".heatmap.ppm");
+                }
+            }
+        }
+        return true;
+    }
+
+    void render_pass(const Hittable& world, Framebuffer& framebuffer, int target_samples, PreviewPublisher* preview,
+                     ImageWriter* image_writer) const {
+        // Brings every pixel up to target_samples samples. Threads claim whole scanlines, and each
+        // pixel belongs to exactly one thread, so the framebuffer needs no locking. Finished
+        // scanlines are handed to the preview and the image writer, if there are any.
+        std::atomic<int> next_row{framebuffer.first_row()};
+        int end_row = framebuffer.first_row() + framebuffer.image_height();
+
+        run_render_threads([&](int) {
+            std::unique_ptr<Sampler> sampler = make_sampler(sampler_type, samples_per_pixel, seed);
+            PathBatch batch;
+            if (sort_rays) {
+                batch.sorter = RaySorter(world.bounding_box());
+            }
+            for (int j = next_row++; j < end_row; j = next_row++) {
+                render_row(j, target_samples, world, *sampler, framebuffer, batch);
+                if (preview != nullptr) {
+                    preview->update_row(j, framebuffer);
+                }
+                if (image_writer != nullptr) {
+                    image_writer->add_row(j, framebuffer);
+                }
+                spdlog::debug("Scanlines Remaining: {}", image_height - j - 1);
+            }
+        });
+    }
+
+    void sample_pixel(int i, int j, int first_sample, int end_sample, const Hittable& world, Sampler& sampler,
+                      Color& color_sum, Framebuffer* framebuffer) const {
+        // Adds samples [first_sample, end_sample) of pixel i, j to color_sum, one at a time, so the
+        // sum is the same however the samples were split across passes. Each sample reseeds the
+        // random sequence and restarts the sampler from the pixel and sample index. If a
+        // framebuffer with AOVs is given, each sample's AOVs are recorded too.
+        std::uint64_t pixel_seed = mix_bits(seed + mix_bits((std::uint64_t(j) * image_width) + i));
+        bool record_aovs = framebuffer != nullptr && framebuffer->requested() != AOV_NONE;
+
+        for (int sample = first_sample; sample < end_sample; sample++) {
+            seed_random(mix_bits(pixel_seed + std::uint64_t(sample)));
+            sampler.start_pixel_sample(i, j, sample);
+            Ray r = get_ray(i, j, sampler);
+            if (!record_aovs) {
+                color_sum += ray_color(r, max_depth, world, sampler);
+            } else if (!(framebuffer->requested() & AOV_COSTS)) {
+                AovSample aov_sample;
+                color_sum += ray_color(r, max_depth, world, sampler, &aov_sample);
+                framebuffer->record(framebuffer->index(i, j), aov_sample, r.time());
+            } else {
+                // The counts only go up on this thread while it traces this sample, so the
+                // difference is the sample's own work.
+                AovSample aov_sample;
+                TraversalCounts before = traversal_counts();
+                auto start = std::chrono::steady_clock::now();
+                color_sum += ray_color(r, max_depth, world, sampler, &aov_sample);
+                auto end = std::chrono::steady_clock::now();
+                const TraversalCounts& after = traversal_counts();
+                aov_sample.nanoseconds = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+                aov_sample.bvh_nodes = double(after.bvh_nodes - before.bvh_nodes);
+                aov_sample.primitives = double(after.primitives - before.primitives);
+                aov_sample.path_segments = double(after.path_segments - before.path_segments);
+                framebuffer->record(framebuffer->index(i, j), aov_sample, r.time());
+            }
+        }
+    }
+
+    std::string image_stem() const {
+        // The output filename without its extension, used to name the AOV files.
+        size_t dot = image_filename.find_last_of('.');
+        return (dot == std::string::npos) ? image_filename : image_filename.substr(0, dot);
+    }
+
+    // Where a scattered ray left from, so that a light it reaches can be weighed against the
+    // chance of light sampling having found the same light from there.
+    struct PathVertex {
+        Point3 p;
+        Vec3 normal;
+        double scattering_pdf;
+        bool blur_environment; // Whether light from the environment was sampled from its low resolution copy
+    };
+
+    // What a path picks up at one vertex, and where it goes from there.
+    struct Bounce {
+        Color direct; // Emission plus what a shadow ray found, or everything if the path ends here
+        Color attenuation; // What the light the scattered ray brings back is multiplied by
+        Ray scattered;
+        PathVertex vertex; // Where the scattered ray left from
+        bool sampled_light; // Whether a shadow ray was sent from vertex, so the scattered ray needs MIS
+    };
+
+    // A camera path set aside between bounces by the batched renderer, with everything needed to
+    // pick it up again exactly where it left off.
+    struct BatchedPath {
+        int i;
+        int j;
+        int sample;
+        Pcg32 random; // Where the path's random sequence has got to
+        int sampler_dimension; // and how many of its sample dimensions it has used
+        Ray ray; // The next ray to trace
+        int depth; // Bounces left
+        bool has_from;
+        PathVertex from;
+        bool hit;
+        HitRecord rec;
+        std::vector<std::pair<Color, Color>> bounces; // Each vertex's direct light and attenuation so far
+        Color color; // What the path's last ray saw, once it has ended
+        AovSample aov;
+        double time; // The camera ray's time, for the time AOV
+    };
+
+    // A render thread's batch of paths, kept between scanlines so its buffers are reused.
+    struct PathBatch {
+        std::vector<BatchedPath> paths;
+        size_t size = 0;
+        std::vector<std::uint32_t> active;
+        RaySorter sorter;
+    };
+
+    void render_row(int j, int target_samples, const Hittable& world, Sampler& sampler, Framebuffer& framebuffer,
+                    PathBatch& batch) const {
+        // Brings every pixel of scanline j up to target_samples samples. Batched paths share their
+        // traversal, so the cost AOVs, which need each sample's own, are traced path by path.
+        if (batch_size > 0 && !(framebuffer.requested() & AOV_COSTS)) {
+            sample_row_batched(j, target_samples, world, sampler, framebuffer, batch);
+        }
+        int end_column = framebuffer.first_column() + framebuffer.image_width();
+        for (int i = framebuffer.first_column(); i < end_column; i++) {
+            size_t index = framebuffer.index(i, j);
+            unsigned& count = framebuffer.sample_count(index);
+            if (int(count) < target_samples) {
+                sample_pixel(i, j, int(count), target_samples, world, sampler, framebuffer.color_sum(index), &framebuffer);
+                count = target_samples;
+            }
+        }
+    }
+
+    void sample_row_batched(int j, int target_samples, const Hittable& world, Sampler& sampler, Framebuffer& framebuffer,
+                            PathBatch& batch) const {
+        // Brings every pixel of scanline j up to target_samples samples, tracing batch_size pixel
+        // samples at a time a bounce at a time instead of each path to its end in turn. Every
+        // path keeps its own place in its random sequence and sample dimensions, and the light it
+        // gathers is summed up in the same order ray_color() would, so the image comes out
+        // identical.
+        int end_column = framebuffer.first_column() + framebuffer.image_width();
+        for (int i = framebuffer.first_column(); i < end_column; i++) {
+            size_t index = framebuffer.index(i, j);
+            std::uint64_t pixel_seed = mix_bits(seed + mix_bits((std::uint64_t(j) * image_width) + i));
+            for (int sample = int(framebuffer.sample_count(index)); sample < target_samples; sample++) {
+                if (batch.size == batch.paths.size()) {
+                    batch.paths.emplace_back();
+                }
+                BatchedPath& path = batch.paths[batch.size++];
+                seed_random(mix_bits(pixel_seed + std::uint64_t(sample)));
+                sampler.start_pixel_sample(i, j, sample);
+                path.i = i;
+                path.j = j;
+                path.sample = sample;
+                path.ray = get_ray(i, j, sampler);
+                path.random = random_generator();
+                path.sampler_dimension = sampler.current_dimension();
+                path.depth = max_depth;
+                path.has_from = false;
+                path.bounces.clear();
+                path.aov = AovSample();
+                path.time = path.ray.time();
+
+                if (batch.size == size_t(batch_size)) {
+                    trace_batch(world, sampler, framebuffer, batch);
+                }
+            }
+        }
+        trace_batch(world, sampler, framebuffer, batch);
+
+        for (int i = framebuffer.first_column(); i < end_column; i++) {
+            unsigned& count = framebuffer.sample_count(framebuffer.index(i, j));
+            count = std::max(count, unsigned(target_samples));
+        }
+    }
+
+    void trace_batch(const Hittable& world, Sampler& sampler, Framebuffer& framebuffer, PathBatch& batch) const {
+        // Traces the batch's paths to their ends and adds them to the framebuffer in order.
+        bool record_aovs = framebuffer.requested() != AOV_NONE;
+        std::vector<std::uint32_t>& active = batch.active;
+        active.clear();
+        for (size_t p = 0; p < batch.size; p++) {
+            active.push_back(std::uint32_t(p));
+        }
+
+        while (!active.empty()) {
+            // End the paths out of bounces, as ray_color() does before tracing.
+            size_t live = 0;
+            for (std::uint32_t p : active) {
+                BatchedPath& path = batch.paths[p];
+                if (path.depth <= 0) {
+                    path.color = Color(0, 0, 0);
+                } else {
+                    active[live++] = p;
+                }
+            }
+            active.resize(live);
+
+            // Trace this bounce's rays, in sorted order if asked to. Hitting a volume draws on the
+            // path's random sequence, so each path's is swapped in around its ray.
+            const std::vector<std::uint32_t>* order = &active;
+            if (sort_rays) {
+                batch.sorter.clear();
+                for (std::uint32_t p : active) {
+                    batch.sorter.add(batch.paths[p].ray, p);
+                }
+                order = &batch.sorter.sorted();
+            }
+            for (std::uint32_t p : *order) {
+                BatchedPath& path = batch.paths[p];
+                random_generator() = path.random;
+                path.hit = world.hit(path.ray, Interval(0.001, infinity), path.rec);
+                path.random = random_generator();
+            }
+
+            // Shade every hit in path order, picking each path up where it left off.
+            live = 0;
+            for (std::uint32_t p : active) {
+                BatchedPath& path = batch.paths[p];
+                random_generator() = path.random;
+                sampler.start_pixel_sample(path.i, path.j, path.sample);
+                sampler.set_dimension(path.sampler_dimension);
+
+                Bounce bounce;
+                AovSample* aov = record_aovs && path.bounces.empty() ? &path.aov : nullptr;
+                if (shade(path.ray, path.hit ? &path.rec : nullptr, world, sampler, aov, path.has_from ? &path.from : nullptr, bounce)) {
+                    path.bounces.emplace_back(bounce.direct, bounce.attenuation);
+                    path.ray = bounce.scattered;
+                    path.depth--;
+                    path.has_from = bounce.sampled_light;
+                    path.from = bounce.vertex;
+                    active[live++] = p;
+                } else {
+                    path.color = bounce.direct;
+                }
+
+                path.random = random_generator();
+                path.sampler_dimension = sampler.current_dimension();
+            }
+            active.resize(live);
+        }
+
+        for (size_t p = 0; p < batch.size; p++) {
+            BatchedPath& path = batch.paths[p];
+            Color color = path.color;
+            for (auto bounce = path.bounces.rbegin(); bounce != path.bounces.rend(); ++bounce) {
+                color = bounce->first + (bounce->second * color);
+            }
+            size_t index = framebuffer.index(path.i, path.j);
+            framebuffer.color_sum(index) += color;
+            if (record_aovs) {
+                framebuffer.record(index, path.aov, path.time);
+            }
+        }
+        batch.size = 0;
+    }
+
+    Color ray_color(const Ray& r, int depth, const Hittable& world, Sampler& sampler, AovSample* aov = nullptr,
+                    const PathVertex* from = nullptr) const {
         // If we've exceeded the ray bounce limit, no more light is gathered
         if (depth <= 0) {
             return Color(0, 0, 0);
         }
 
         HitRecord rec;
+        count_path_segment();
+        bool hit = world.hit(r, Interval(0.001, infinity), rec);
+
+        Bounce bounce;
+        if (!shade(r, hit ? &rec : nullptr, world, sampler, aov, from, bounce)) {
+            return bounce.direct;
+        }
+
+        const PathVertex* vertex = bounce.sampled_light ? &bounce.vertex : nullptr;
+        Color color_from_scatter = bounce.attenuation * ray_color(bounce.scattered, depth - 1, world, sampler, nullptr, vertex);
+        return bounce.direct + color_from_scatter;
+    }
+
+    bool shade(const Ray& r, const HitRecord* hit, const Hittable& world, Sampler& sampler, AovSample* aov,
+               const PathVertex* from, Bounce& bounce) const {
+        // Gathers the light at the vertex where r hit (or the light r sees leaving the scene, if
+        // hit is null) into bounce, and picks the ray to continue the path with. Returns whether
+        // the path continues.
+        if (hit == nullptr) {
+            bounce.direct = escaped(r, from);
+            return false;
+        }
+        const HitRecord& rec = *hit;
+
+        Color color_from_emission = material_emitted(*rec.mat, rec.u, rec.v, rec.p);
+        if (from != nullptr && luminance(color_from_emission) > 0) {
+            double light_pdf = lights == nullptr ? 0
+                             : (1 - environment_probability()) * lights->pdf(from->p, from->normal, rec.primitive_id, r.direction(), r.time());
+            color_from_emission = color_from_emission * power_heuristic(from->scattering_pdf, light_pdf);
+        }
+
+        bool did_scatter = material_scatter(*rec.mat, r, rec, bounce.attenuation, bounce.scattered, sampler);
+
+        if (aov != nullptr) {
+            // Only camera rays are handed an AOV sample, so this records the primary hit.
+            aov->hit = true;
+            aov->depth = dot(rec.p - center, -w);
+            aov->normal = rec.normal;
+            aov->albedo = did_scatter ? bounce.attenuation : Color(0, 0, 0);
+            aov->material_id = rec.mat->id;
+            aov->primitive_id = rec.primitive_id;
+        }
+
+        bounce.direct = color_from_emission;
+        bounce.sampled_light = false;
+        if (!did_scatter) {
+            return false;
+        }
+
+        // Surfaces that scatter over a spread of directions also sample a light directly; the
+        // scattered ray then carries what it needs to weigh any light it finds by MIS.
+        double scattering_pdf = material_scattering_pdf(*rec.mat, r, rec, bounce.scattered);
+        if ((lights == nullptr && environment_probability() == 0) || scattering_pdf <= 0) {
+            return true;
+        }
 
-        if (!world.hit(r, Interval(0.001, infinity), rec)) {
+        // Light from the environment that reaches here after a diffuse bounce is blurred by it
+        // anyway, so the low resolution copy can do.
+        bool blur_environment = filtered_environment && from != nullptr;
+        Color color_from_lights = sample_light(r, rec, bounce.attenuation, world, sampler, blur_environment);
+        bounce.direct = color_from_emission + color_from_lights;
+        bounce.vertex = PathVertex{rec.p, rec.normal, scattering_pdf, blur_environment};
+        bounce.sampled_light = true;
+        return true;
+    }
+
+    Color escaped(const Ray& r, const PathVertex* from) const {
+        // What a ray that leaves the scene sees: the environment, weighed by MIS against the
+        // chance of a shadow ray having been sent the same way, or else the background color.
+        if (environment == nullptr) {
             return background;
         }
 
-        Ray scattered;
-        Color attenuation;
-        Color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
-        
-        if(!rec.mat->scatter(r, rec, attenuation, scattered)) {
-            return color_from_emission;
+        Vec3 direction = unit_vector(r.direction());
+        if (from == nullptr) {
+            return environment->radiance(direction);
         }
+        Color radiance = environment->radiance(direction, from->blur_environment);
+        double environment_pdf = environment_probability() * environment->pdf(direction, from->blur_environment);
+        return radiance * power_heuristic(from->scattering_pdf, environment_pdf);
+    }
+
+    double environment_probability() const {
+        // The chance of a shadow ray going to the environment rather than to one of the lights.
+        if (environment == nullptr || !sample_environment) {
+            return 0;
+        }
+        return lights == nullptr ? 1 : 0.5;
+    }
+
+    Color sample_light(const Ray& r_in, const HitRecord& rec, const Color& attenuation, const Hittable& world,
+                       Sampler& sampler, bool blur_environment) const {
+        // Next event estimation: sends a shadow ray towards the environment or a light picked by
+        // the light sampler, weighted by MIS against the scattered ray finding the same light.
+        // Always takes its three sample dimensions, so later bounces line up whatever happens
+        // here.
+        double light_choice = sampler.get_1d();
+        Point2 light_position = sampler.get_2d();
+
+        double choose_environment = environment_probability();
+        if (light_choice < choose_environment) {
+            return sample_environment_light(r_in, rec, attenuation, world, light_position, choose_environment, blur_environment);
+        }
+        light_choice = std::fmin((light_choice - choose_environment) / (1 - choose_environment), one_minus_epsilon);
+
+        SampledLight sampled;
+        if (!lights->sample(rec.p, rec.normal, light_choice, sampled)) {
+            return Color(0, 0, 0);
+        }
+
+        Vec3 direction = unit_vector(sampled.light->random(rec.p, light_position, r_in.time()));
+        Ray shadow_ray(rec.p, direction, r_in.time());
+        HitRecord light_rec;
+        if (!sampled.light->hit(shadow_ray, Interval(0.001, infinity), light_rec)) {
+            return Color(0, 0, 0);
+        }
+
+        double scattering_pdf = material_scattering_pdf(*rec.mat, r_in, rec, shadow_ray);
+        double light_pdf = (1 - choose_environment) * sampled.pmf * sampled.light->pdf_value(rec.p, direction, r_in.time());
+        if (scattering_pdf <= 0 || light_pdf <= 0) {
+            return Color(0, 0, 0);
+        }
+
+        // Stop just short of the light, so it doesn't shadow itself.
+        if (world.occluded(shadow_ray, Interval(0.001, light_rec.t * (1 - 1e-6)))) {
+            return Color(0, 0, 0);
+        }
+
+        Color emitted = material_emitted(*light_rec.mat, light_rec.u, light_rec.v, light_rec.p);
+        double weight = power_heuristic(light_pdf, scattering_pdf);
+        return attenuation * emitted * (scattering_pdf * weight / light_pdf);
+    }
 
-        Color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+    Color sample_environment_light(const Ray& r_in, const HitRecord& rec, const Color& attenuation, const Hittable& world,
+                                   Point2 u, double probability, bool blurred) const {
+        // Sends a shadow ray in a direction picked from the environment's own distribution, or
+        // its low resolution copy's if blurred, where probability is the chance of having picked
+        // the environment at all.
+        double environment_pdf;
+        Vec3 direction = environment->sample(u, environment_pdf, blurred);
+        environment_pdf *= probability;
+        Ray shadow_ray(rec.p, direction, r_in.time());
+
+        double scattering_pdf = material_scattering_pdf(*rec.mat, r_in, rec, shadow_ray);
+        if (scattering_pdf <= 0 || environment_pdf <= 0) {
+            return Color(0, 0, 0);
+        }
+        if (world.occluded(shadow_ray, Interval(0.001, infinity))) {
+            return Color(0, 0, 0);
+        }
+
+        double weight = power_heuristic(environment_pdf, scattering_pdf);
+        return attenuation * environment->radiance(direction, blurred) * (scattering_pdf * weight / environment_pdf);
+    }
 
-        return color_from_emission + color_from_scatter;
+    static double power_heuristic(double pdf, double other_pdf) {
+        // Veach's power heuristic with an exponent of two.
+        double pdf2 = pdf * pdf;
+        double other_pdf2 = other_pdf * other_pdf;
+        return pdf2 == 0 ? 0 : pdf2 / (pdf2 + other_pdf2);
     }
 };
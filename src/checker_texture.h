@@ -16,16 +16,29 @@ public:
       : CheckerTexture(scale, std::make_shared<SolidColorTexture>(c1), std::make_shared<SolidColorTexture>(c2)) {}
 
     Color value(double u, double v, const Point3& p) const override {
-        auto xInteger = int(std::floor(inv_scale * p.x()));
-        auto yInteger = int(std::floor(inv_scale * p.y()));
-        auto zInteger = int(std::floor(inv_scale * p.z()));
+        return is_even(inv_scale, p) ? even->value(u, v, p) : odd->value(u, v, p);
+    }
 
-        bool isEven = (xInteger + yInteger + zInteger) % 2 == 0; // Would a bitmask be better here?
+    static bool is_even(double inv_scale, const Point3& p) {
+        auto xInteger = floor_to_int(inv_scale * p.x());
+        auto yInteger = floor_to_int(inv_scale * p.y());
+        auto zInteger = floor_to_int(inv_scale * p.z());
 
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return ((xInteger + yInteger + zInteger) & 1) == 0;
     }
 
+    double inverse_scale() const { return inv_scale; }
+    const std::shared_ptr<Texture>& even_texture() const { return even; }
+    const std::shared_ptr<Texture>& odd_texture() const { return odd; }
+
 private:
+    static int floor_to_int(double x) {
+        // int(std::floor(x)) without calling floor, which is a library call unless the target
+        // has SSE4.1: truncate, then step down for negative non-integers.
+        int i = int(x);
+        return i - int(x < double(i));
+    }
+
     double inv_scale;
     std::shared_ptr<Texture> even;
     std::shared_ptr<Texture> odd;
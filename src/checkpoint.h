@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "framebuffer.h"
+#include "light_sampler.h"
+#include "sampler.h"
+
+// A checkpoint is the camera's seed, scene and camera hash, sampler, light sampling, sample count,
+// frame size and window followed by the framebuffer's raw accumulation state: the color sums, the per-pixel sample counts and any AOV sums. Every sample's random
+// values are derived from the seed, its pixel and its sample index, so the sample counts are all
+// the random state there is; continuing from a checkpoint takes exactly the samples an
+// uninterrupted render would have taken next.
+
+const char checkpoint_magic[8] = {'R', 'T', 'W', 'C', 'K', 'P', 'T', '6'};
+
+struct CheckpointKey {
+    // What a checkpoint has to agree on with the render resuming it, besides the framebuffer's
+    // size and AOVs.
+    std::uint64_t seed = 0;
+    std::uint64_t render_hash = 0; // Camera::render_hash(): the scene, the camera and its framing
+    std::uint32_t sampler = 0;
+    std::uint32_t light_sampling = 0;
+    std::int32_t first_column = 0; // Where the framebuffer's window starts, for crop windows
+    std::int32_t first_row = 0;
+    std::int32_t samples_per_pixel = 0; // The target, which the stratified and Sobol patterns depend on
+    std::int32_t frame_width = 0; // The full frame's size, which pixel seeds and the framing depend on
+    std::int32_t frame_height = 0;
+    std::uint32_t reserved = 0;
+};
+
+// Keys are written as raw bytes, so they mustn't have any padding for uninitialized bytes to hide in.
+static_assert(sizeof(CheckpointKey) == (2 * 8) + (8 * 4), "CheckpointKey has padding");
+
+inline bool write_checkpoint(const std::string& filename, const Framebuffer& framebuffer, CheckpointKey key) {
+    // Writes to a temporary file and renames it into place, so a crash mid-write never replaces a
+    // good checkpoint with a torn one.
+    std::string temp_filename = filename + ".tmp";
+    {
+        std::ofstream file(temp_filename, std::ios::binary);
+        file.write(checkpoint_magic, sizeof(checkpoint_magic));
+        file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        if (!file || !framebuffer.save(file)) {
+            spdlog::error("Could not write checkpoint '{}'", temp_filename);
+            return false;
+        }
+    }
+
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        spdlog::error("Could not move checkpoint into place at '{}'", filename);
+        return false;
+    }
+    return true;
+}
+
+inline bool checkpoint_exists(const std::string& filename) {
+    return bool(std::ifstream(filename, std::ios::binary));
+}
+
+inline bool read_checkpoint(const std::string& filename, Framebuffer& framebuffer, CheckpointKey key) {
+    // Loads a checkpoint into the framebuffer. Fails unless it was written for the same seed,
+    // sampler, light sampling, scene, camera, frame size, window and AOVs, and for the same
+    // samples per pixel if the sampler's pattern depends on it.
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        spdlog::error("Could not open checkpoint '{}'", filename);
+        return false;
+    }
+
+    char magic[sizeof(checkpoint_magic)];
+    CheckpointKey saved_key;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&saved_key), sizeof(saved_key));
+    if (!file || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) {
+        spdlog::error("'{}' is not a checkpoint", filename);
+        return false;
+    }
+    if (saved_key.seed != key.seed || saved_key.sampler != key.sampler || saved_key.light_sampling != key.light_sampling) {
+        spdlog::error("Checkpoint '{}' was rendered with seed {}, the {} sampler and {} light sampling, not seed {}, the {} sampler and {} light sampling",
+                      filename, saved_key.seed, sampler_type_name(SamplerType(saved_key.sampler)),
+                      light_sampling_name(LightSampling(saved_key.light_sampling)),
+                      key.seed, sampler_type_name(SamplerType(key.sampler)),
+                      light_sampling_name(LightSampling(key.light_sampling)));
+        return false;
+    }
+    if (saved_key.frame_width != key.frame_width || saved_key.frame_height != key.frame_height) {
+        spdlog::error("Checkpoint '{}' was rendered for a frame of {}x{} pixels, not {}x{}", filename, saved_key.frame_width,
+                      saved_key.frame_height, key.frame_width, key.frame_height);
+        return false;
+    }
+    if (saved_key.first_column != key.first_column || saved_key.first_row != key.first_row) {
+        spdlog::error("Checkpoint '{}' was rendered for a window at {},{}, not {},{}", filename, saved_key.first_column,
+                      saved_key.first_row, key.first_column, key.first_row);
+        return false;
+    }
+    if (sampler_depends_on_spp(SamplerType(key.sampler)) && saved_key.samples_per_pixel != key.samples_per_pixel) {
+        spdlog::error("Checkpoint '{}' was rendered for {} samples per pixel, and the {} sampler's pattern can't be "
+                      "extended to {}", filename, saved_key.samples_per_pixel,
+                      sampler_type_name(SamplerType(key.sampler)), key.samples_per_pixel);
+        return false;
+    }
+    if (saved_key.render_hash != key.render_hash) {
+        spdlog::error("Checkpoint '{}' was rendered for a different scene or camera", filename);
+        return false;
+    }
+    if (!framebuffer.load(file)) {
+        spdlog::error("Checkpoint '{}' doesn't match the image size and AOVs being rendered", filename);
+        return false;
+    }
+    return true;
+}
+
+class CheckpointWriter {
+public:
+    // Writes checkpoints on a background thread. The caller hands over a snapshot of the
+    // framebuffer, so rendering can carry on while the file is written.
+    ~CheckpointWriter() { wait(); }
+
+    bool busy() const { return writing; }
+
+    void write_async(const std::string& filename, Framebuffer snapshot, CheckpointKey key) {
+        wait();
+        writing = true;
+        worker = std::thread([this, filename, key, snapshot = std::make_shared<Framebuffer>(std::move(snapshot))] {
+            if (write_checkpoint(filename, *snapshot, key)) {
+                spdlog::info("Checkpoint written to {}", filename);
+            }
+            writing = false;
+        });
+    }
+
+    void wait() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+private:
+    std::thread worker;
+    std::atomic<bool> writing{false};
+};
@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "fast_math.h"
 #include "interval.h"
 #include "vec3.h"
 
@@ -9,27 +10,24 @@ using Color = Vec3;
 
 inline double linear_to_gamma(double linear_component) {
     if (linear_component > 0) {
-        return std::sqrt(linear_component);
+        return shading_sqrt(linear_component);
     }
     return 0;
 }
 
-void write_color(std::ostream& out, const Color& pixel_color) {
-    auto r = pixel_color[0];
-    auto g = pixel_color[1];
-    auto b = pixel_color[2];
-
-    // Apply a linear to gamma transform for gamma 2
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Translate the [0, 1] component values to the byte range [0, 255].
+inline void gamma_bytes(const Color& pixel_color, unsigned char bytes[3]) {
+    // Apply a linear to gamma transform for gamma 2, then translate the [0, 1] component values
+    // to the byte range [0, 255].
     static const Interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    for (int c = 0; c < 3; c++) {
+        bytes[c] = (unsigned char)(int(256 * intensity.clamp(linear_to_gamma(pixel_color[c]))));
+    }
+}
+
+void write_color(std::ostream& out, const Color& pixel_color) {
+    unsigned char bytes[3];
+    gamma_bytes(pixel_color, bytes);
 
     // Write out the pixel color components
-    out << rbyte << " " << gbyte << " " << bbyte << "\n";
+    out << int(bytes[0]) << " " << int(bytes[1]) << " " << int(bytes[2]) << "\n";
 }
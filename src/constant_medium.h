@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cmath>
+
+#include "rtweekend.h"
+
+#include "interval.h"
+#include "medium.h"
+#include "vec3.h"
+
+class ConstantMedium : public Medium {
+public:
+    // A medium with the same density everywhere, like fog.
+    ConstantMedium(double density) : constant_density(density) {}
+
+    double density(const Point3& p) const override { return constant_density; }
+
+    bool sample_collision(const Point3& origin, const Vec3& direction, Interval segment, double& distance) const override {
+        // The distance to the first interaction is exponentially distributed.
+        if (constant_density <= 0) {
+            return false;
+        }
+        distance = segment.min - (std::log(1 - random_double()) / constant_density);
+        return distance < segment.max;
+    }
+
+private:
+    double constant_density;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "sampler.h"
+
+inline double mean_squared_error(const Framebuffer& image, const Framebuffer& reference) {
+    // Mean squared error of the averaged pixel colors, over all pixels and channels.
+    size_t pixel_count = size_t(image.image_width()) * image.image_height();
+    double sum = 0;
+    for (size_t index = 0; index < pixel_count; index++) {
+        Vec3 difference = image.pixel_color(index) - reference.pixel_color(index);
+        sum += difference.length_squared();
+    }
+    return sum / (3.0 * pixel_count);
+}
+
+inline void sampler_convergence_report(Camera cam, const Hittable& world, int reference_multiplier) {
+    // Renders the scene with every sampler at 1, 2, 4, ... up to the camera's samples per pixel,
+    // and logs each image's error against an independent-sampler reference rendered with
+    // reference_multiplier times as many samples. The reference's own noise adds the same small
+    // offset to every entry.
+    cam.aovs = AOV_NONE;
+    cam.checkpoint_filename.clear();
+    cam.resume = false;
+    cam.preview_target.clear();
+
+    const SamplerType samplers[] = {SamplerType::Independent, SamplerType::Stratified, SamplerType::Halton, SamplerType::Sobol};
+    int max_samples = cam.samples_per_pixel;
+
+    spdlog::level::level_enum log_level = spdlog::get_level();
+    spdlog::info("Rendering the reference at {} samples per pixel", max_samples * reference_multiplier);
+    spdlog::set_level(spdlog::level::warn);
+
+    Camera reference_cam = cam;
+    reference_cam.samples_per_pixel = max_samples * reference_multiplier;
+    reference_cam.sampler_type = SamplerType::Independent;
+    reference_cam.seed = cam.seed + 1; // Keep the reference's noise independent of the images
+    Framebuffer reference = *reference_cam.render_to_framebuffer(world);
+
+    spdlog::set_level(log_level);
+    spdlog::info("{:>6} {:>12} {:>12} {:>12} {:>12}   (MSE; time in seconds)", "spp", "independent", "stratified", "halton", "sobol");
+
+    std::vector<double> final_errors;
+    for (int spp = 1; spp <= max_samples; spp *= 2) {
+        std::vector<double> errors;
+        std::vector<double> seconds;
+        for (SamplerType sampler : samplers) {
+            cam.samples_per_pixel = spp;
+            cam.sampler_type = sampler;
+
+            spdlog::set_level(spdlog::level::warn);
+            auto start = std::chrono::steady_clock::now();
+            Framebuffer image = *cam.render_to_framebuffer(world);
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            spdlog::set_level(log_level);
+
+            errors.push_back(mean_squared_error(image, reference));
+        }
+
+        spdlog::info("{:>6} {:>12.6f} {:>12.6f} {:>12.6f} {:>12.6f}", spp, errors[0], errors[1], errors[2], errors[3]);
+        spdlog::info("{:>6} {:>12.3f} {:>12.3f} {:>12.3f} {:>12.3f}", "", seconds[0], seconds[1], seconds[2], seconds[3]);
+        final_errors = errors;
+    }
+
+    for (size_t s = 1; s < final_errors.size(); s++) {
+        spdlog::info("{}: {:.2f}x lower MSE than independent sampling at {} spp",
+                     sampler_type_name(samplers[s]), final_errors[0] / final_errors[s], max_samples);
+    }
+}
@@ -1,15 +1,17 @@
 #pragma once
 
 #include "color.h"
+#include "fast_math.h"
 #include "hitrecord.h"
 #include "material.h"
 #include "ray.h"
+#include "sampler.h"
 
 class Dielectric : public Material {
 public:
-    Dielectric(double refraction_index) : refraction_index(refraction_index) {}
+    Dielectric(double refraction_index) : Material(MaterialKind::Dielectric, MATERIAL_SCATTERS), refraction_index(refraction_index) {}
 
-    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
+    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
         attenuation = Color(1.0, 1.0, 1.0);
         double ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
 
@@ -18,9 +20,10 @@ public:
         double sin_theta = std::sqrt(1.0 - (cos_theta * cos_theta));
 
         bool cannot_refract = (ri * sin_theta) > 1.0;
+        double reflect_sample = sampler.get_1d(); // Always taken, so later bounces use the same dimensions
         Vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double()) {
+        if (cannot_refract || reflectance(cos_theta, ri) > reflect_sample) {
             direction = reflect(unit_direction, rec.normal);
         } else {
             direction = refract(unit_direction, rec.normal, ri);
@@ -39,6 +42,6 @@ private:
         // Use Schlick's approximation for reflectance
         double r0 = (1 - refraction_index) / (1 + refraction_index);
         r0 = r0 * r0;
-        return r0 + ((1 - r0) * std::pow((1 - cosine), 5));
+        return r0 + ((1 - r0) * shading_pow5(1 - cosine));
     }
 };
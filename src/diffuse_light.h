@@ -6,16 +6,18 @@
 #include "ray.h"
 #include "solid_color_texture.h"
 #include "texture.h"
+#include "texture_program.h"
 
 class DiffuseLight : public Material {
 public:
-    DiffuseLight(std::shared_ptr<Texture> tex) : tex(tex) {}
-    DiffuseLight(const Color& emit) : tex(std::make_shared<SolidColorTexture>(emit)) {}
+    DiffuseLight(std::shared_ptr<Texture> tex) : Material(MaterialKind::DiffuseLight, MATERIAL_EMITS), tex(tex), texture(tex) {}
+    DiffuseLight(const Color& emit) : DiffuseLight(std::make_shared<SolidColorTexture>(emit)) {}
 
     Color emitted(double u, double v, const Point3& p) const override {
-        return tex->value(u, v, p);
+        return texture.value(u, v, p);
     }
 
 private:
     std::shared_ptr<Texture> tex;
+    TextureProgram texture; // tex, compiled
 };
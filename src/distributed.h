@@ -0,0 +1,547 @@
+#pragma once
+
+// Distributed tile rendering. A coordinator splits the image into tiles and hands them out, one at
+// a time, to worker processes connected over a Unix or TCP socket. Every worker holds its own copy
+// of the scene (forked workers inherit it, remote workers build it themselves) and streams each
+// finished tile back run-length compressed. Tiles held by a worker that dies, or that takes longer
+// than the tile timeout, are handed to another worker; whichever copy finishes first is kept.
+// Samples are seeded per pixel, so a tile comes out the same whichever worker renders it.
+//
+// The protocol sends raw structs, so both ends must share a byte order and float format.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "color.h"
+#include "hittable.h"
+
+enum MessageType : std::uint32_t {
+    MSG_HELLO = 1, // Worker -> coordinator: params are the worker's width, height, spp and folded render hash
+    MSG_ASSIGN, // Coordinator -> worker: render tile `tile`, params are x0, y0, x1, y1
+    MSG_RESULT, // Worker -> coordinator: `payload` bytes of compressed pixels for tile `tile`
+    MSG_SHUTDOWN, // Coordinator -> worker: no more work
+};
+
+struct MessageHeader {
+    std::uint32_t type;
+    std::uint32_t tile;
+    std::uint32_t payload;
+    std::int32_t params[4];
+};
+
+struct DistributedSettings {
+    std::string address; // "unix:/path/to/socket" or "tcp:host:port"
+    int local_workers = 0; // Worker processes to fork on this machine
+    int tile_size = 32; // Edge length of a square tile in pixels
+    double tile_timeout = 60; // Seconds before an unfinished tile is handed to another worker
+};
+
+// Socket helpers
+
+inline bool send_all(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = ::send(fd, bytes, size, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = ::recv(fd, bytes, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+inline bool send_message(int fd, MessageHeader header, const std::vector<char>& payload = {}) {
+    header.payload = std::uint32_t(payload.size());
+    return send_all(fd, &header, sizeof(header)) && send_all(fd, payload.data(), payload.size());
+}
+
+inline int open_socket(const std::string& address, bool listening) {
+    // Creates a socket bound to (listening) or connected to the given address. Returns -1 and logs
+    // the reason on failure.
+    int fd = -1;
+
+    if (address.rfind("unix:", 0) == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            spdlog::error("Socket path '{}' is too long", path);
+            return -1;
+        }
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listening) {
+            ::unlink(path.c_str());
+            if (fd >= 0 && (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0)) {
+                ::close(fd);
+                fd = -1;
+            }
+        } else if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    } else if (address.rfind("tcp:", 0) == 0) {
+        std::string host_port = address.substr(4);
+        size_t colon = host_port.find_last_of(':');
+        if (colon == std::string::npos) {
+            spdlog::error("TCP address '{}' needs a port", address);
+            return -1;
+        }
+        std::string host = host_port.substr(0, colon);
+        std::string port = host_port.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        addrinfo* info = nullptr;
+        if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info) != 0) {
+            spdlog::error("Could not resolve '{}'", address);
+            return -1;
+        }
+
+        fd = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd >= 0 && listening) {
+            int reuse = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (::bind(fd, info->ai_addr, info->ai_addrlen) != 0 || ::listen(fd, 64) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        } else if (fd >= 0 && ::connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        ::freeaddrinfo(info);
+    } else {
+        spdlog::error("Unknown address '{}', expected unix:PATH or tcp:HOST:PORT", address);
+        return -1;
+    }
+
+    if (fd < 0) {
+        spdlog::error("Could not {} '{}': {}", listening ? "listen on" : "connect to", address, std::strerror(errno));
+    }
+    return fd;
+}
+
+inline std::int32_t hello_hash(const Camera& cam) {
+    // The camera's render hash folded into a hello's last param, so that workers set up for
+    // another scene, seed, sampler or lighting are turned away before their tiles get mixed in.
+    std::uint64_t hash = cam.render_hash();
+    return std::int32_t(std::uint32_t(hash ^ (hash >> 32)));
+}
+
+// Tile compression
+
+struct TileRun {
+    std::uint32_t count; // Number of consecutive pixels with this color
+    float rgb[3];
+};
+
+// A record's count with this bit set is followed by that many pixels of their own, rather than one
+// color for all of them.
+constexpr std::uint32_t tile_literal_bit = 0x80000000u;
+
+inline size_t max_compressed_tile_size(size_t pixel_count) {
+    // The most compress_tile writes for a tile of pixel_count pixels: a lone pixel costs a whole
+    // record at worst.
+    return pixel_count * sizeof(TileRun);
+}
+
+inline std::vector<char> compress_tile(const std::vector<Color>& pixels) {
+    // Run-length encodes the tile as records of 32-bit values, with colors narrowed to floats.
+    // Runs of two or more identical pixels (empty background, unlit walls) collapse to a single
+    // (count, r, g, b) record. Path traced pixels seldom repeat, so the ones in between go out as
+    // literal runs: a count with tile_literal_bit set followed by that many r, g, b triples, which
+    // costs 4 bytes per run over raw floats rather than 4 per pixel.
+    std::vector<char> compressed;
+    compressed.reserve((pixels.size() * 3 * sizeof(float)) + sizeof(std::uint32_t));
+    auto rgb = [&](size_t index, float out[3]) {
+        out[0] = float(pixels[index][0]);
+        out[1] = float(pixels[index][1]);
+        out[2] = float(pixels[index][2]);
+    };
+    auto append = [&](const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        compressed.insert(compressed.end(), bytes, bytes + size);
+    };
+
+    size_t literal_start = 0; // Offset of the open literal run's count, if literal_count > 0
+    std::uint32_t literal_count = 0;
+    size_t index = 0;
+    while (index < pixels.size()) {
+        TileRun run{1, {}};
+        rgb(index, run.rgb);
+        while (index + run.count < pixels.size()) {
+            float next[3];
+            rgb(index + run.count, next);
+            if (next[0] != run.rgb[0] || next[1] != run.rgb[1] || next[2] != run.rgb[2]) {
+                break;
+            }
+            run.count++;
+        }
+
+        if (run.count >= 2) {
+            literal_count = 0;
+            append(&run, sizeof(run));
+        } else {
+            if (literal_count == 0) {
+                literal_start = compressed.size();
+                std::uint32_t header = tile_literal_bit;
+                append(&header, sizeof(header));
+            }
+            append(run.rgb, sizeof(run.rgb));
+            literal_count++;
+            std::uint32_t header = tile_literal_bit | literal_count;
+            std::memcpy(compressed.data() + literal_start, &header, sizeof(header));
+        }
+        index += run.count;
+    }
+    return compressed;
+}
+
+inline bool decompress_tile(const std::vector<char>& compressed, size_t pixel_count, std::vector<Color>& pixels) {
+    // Expands a tile written by compress_tile. Returns false if the data doesn't describe exactly
+    // pixel_count pixels.
+    pixels.clear();
+    size_t offset = 0;
+    while (offset < compressed.size()) {
+        std::uint32_t header;
+        if (compressed.size() - offset < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, compressed.data() + offset, sizeof(header));
+        offset += sizeof(header);
+
+        size_t count = header & ~tile_literal_bit;
+        size_t colors = (header & tile_literal_bit) ? count : 1;
+        if (count == 0 || pixels.size() + count > pixel_count || (compressed.size() - offset) / (3 * sizeof(float)) < colors) {
+            return false;
+        }
+        for (size_t c = 0; c < colors; c++) {
+            float rgb[3];
+            std::memcpy(rgb, compressed.data() + offset, sizeof(rgb));
+            offset += sizeof(rgb);
+            pixels.insert(pixels.end(), colors == 1 ? count : 1, Color(rgb[0], rgb[1], rgb[2]));
+        }
+    }
+    return pixels.size() == pixel_count;
+}
+
+// Worker
+
+inline int run_render_worker(const std::string& address, Camera cam, const Hittable& world) {
+    // Connects to a coordinator and renders the tiles it assigns until told to stop. Returns a
+    // process exit code.
+    int fd = open_socket(address, false);
+    if (fd < 0) {
+        return 1;
+    }
+
+    MessageHeader hello{MSG_HELLO, 0, 0, {cam.image_width, cam.height(), cam.samples_per_pixel, hello_hash(cam)}};
+    if (!send_message(fd, hello)) {
+        ::close(fd);
+        return 1;
+    }
+
+    std::vector<Color> pixels;
+    MessageHeader message;
+    while (recv_all(fd, &message, sizeof(message)) && message.type == MSG_ASSIGN) {
+        cam.render_tile(world, message.params[0], message.params[1], message.params[2], message.params[3], pixels);
+
+        MessageHeader result{MSG_RESULT, message.tile, 0, {message.params[0], message.params[1], message.params[2], message.params[3]}};
+        if (!send_message(fd, result, compress_tile(pixels))) {
+            break;
+        }
+    }
+
+    ::close(fd);
+    return 0;
+}
+
+// Coordinator
+
+inline bool render_distributed(Camera& cam, const Hittable& world, const DistributedSettings& settings, std::vector<Color>& image) {
+    // Renders the camera's image across the connected workers, leaving the final pixel colors in
+    // `image`, top scanline first. Returns false if the coordinator couldn't start.
+    using Clock = std::chrono::steady_clock;
+
+    struct Tile {
+        int x0, y0, x1, y1;
+        bool done = false;
+        Clock::time_point assigned_at;
+    };
+
+    struct Worker {
+        int fd;
+        bool ready = false; // Has sent a valid hello
+        int tile = -1; // Tile in flight, or -1 if idle
+    };
+
+    const int width = cam.image_width;
+    const int height = cam.height();
+    const std::int32_t render_hash = hello_hash(cam);
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += settings.tile_size) {
+        for (int x = 0; x < width; x += settings.tile_size) {
+            tiles.push_back(Tile{x, y, std::min(x + settings.tile_size, width), std::min(y + settings.tile_size, height)});
+        }
+    }
+
+    ::signal(SIGPIPE, SIG_IGN); // A dead worker shows up as a failed send instead
+    int listen_fd = open_socket(settings.address, true);
+    if (listen_fd < 0) {
+        return false;
+    }
+
+    std::vector<pid_t> children;
+    for (int n = 0; n < settings.local_workers; n++) {
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            ::close(listen_fd);
+            ::_exit(run_render_worker(settings.address, cam, world));
+        }
+        if (pid > 0) {
+            children.push_back(pid);
+        } else {
+            spdlog::error("Could not fork worker {}: {}", n, std::strerror(errno));
+        }
+    }
+
+    image.assign(size_t(width) * height, Color(0, 0, 0));
+    std::deque<int> pending;
+    for (int index = 0; index < int(tiles.size()); index++) {
+        pending.push_back(index);
+    }
+
+    std::vector<Worker> workers;
+    int workers_seen = 0;
+    size_t tiles_done = 0;
+    std::vector<Color> pixels;
+
+    auto drop_worker = [&](size_t w) {
+        // Put the worker's tile back at the front of the queue and forget about the worker.
+        if (workers[w].tile >= 0 && !tiles[workers[w].tile].done) {
+            pending.push_front(workers[w].tile);
+        }
+        ::close(workers[w].fd);
+        workers.erase(workers.begin() + w);
+    };
+
+    while (tiles_done < tiles.size()) {
+        // Requeue tiles that have been in flight too long, so an idle worker can race the slow one.
+        Clock::time_point now = Clock::now();
+        for (const Worker& worker : workers) {
+            if (worker.tile < 0) {
+                continue;
+            }
+            Tile& tile = tiles[worker.tile];
+            if (!tile.done && std::chrono::duration<double>(now - tile.assigned_at).count() > settings.tile_timeout) {
+                spdlog::warn("Tile {} timed out, reassigning", worker.tile);
+                tile.assigned_at = now;
+                pending.push_back(worker.tile);
+            }
+        }
+
+        // Hand out work to idle workers.
+        for (size_t w = 0; w < workers.size(); w++) {
+            while (workers[w].ready && workers[w].tile < 0 && !pending.empty()) {
+                int index = pending.front();
+                pending.pop_front();
+                if (tiles[index].done) {
+                    continue;
+                }
+
+                Tile& tile = tiles[index];
+                tile.assigned_at = Clock::now();
+                workers[w].tile = index;
+                if (!send_message(workers[w].fd, MessageHeader{MSG_ASSIGN, std::uint32_t(index), 0, {tile.x0, tile.y0, tile.x1, tile.y1}})) {
+                    drop_worker(w);
+                    w--;
+                    break;
+                }
+            }
+        }
+
+        // If every local worker has come and gone and nobody else is connected, finish here.
+        if (settings.local_workers > 0 && workers_seen >= settings.local_workers && workers.empty()) {
+            spdlog::warn("All workers are gone, rendering the remaining {} tiles locally", tiles.size() - tiles_done);
+            for (Tile& tile : tiles) {
+                if (tile.done) {
+                    continue;
+                }
+                cam.render_tile(world, tile.x0, tile.y0, tile.x1, tile.y1, pixels);
+                size_t p = 0;
+                for (int y = tile.y0; y < tile.y1; y++) {
+                    for (int x = tile.x0; x < tile.x1; x++) {
+                        image[(size_t(y) * width) + x] = pixels[p++];
+                    }
+                }
+                tile.done = true;
+                tiles_done++;
+            }
+            break;
+        }
+
+        // Wait for new connections or results.
+        std::vector<pollfd> fds;
+        fds.push_back(pollfd{listen_fd, POLLIN, 0});
+        for (const Worker& worker : workers) {
+            fds.push_back(pollfd{worker.fd, POLLIN, 0});
+        }
+        if (::poll(fds.data(), fds.size(), 250) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            spdlog::error("poll failed: {}", std::strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                workers.push_back(Worker{fd});
+                workers_seen++;
+            }
+        }
+
+        // Walk backwards so dropping a worker doesn't disturb the indices still to be visited.
+        for (size_t f = fds.size() - 1; f >= 1; f--) {
+            if (!(fds[f].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            size_t w = f - 1;
+
+            MessageHeader message;
+            if (!recv_all(workers[w].fd, &message, sizeof(message))) {
+                spdlog::warn("Lost a worker{}", workers[w].tile >= 0 ? fmt::format(", requeueing tile {}", workers[w].tile) : "");
+                drop_worker(w);
+                continue;
+            }
+
+            if (message.type == MSG_HELLO) {
+                if (message.params[0] != width || message.params[1] != height || message.params[2] != cam.samples_per_pixel) {
+                    spdlog::error("Rejecting a worker set up for a {}x{} image at {} spp", message.params[0], message.params[1], message.params[2]);
+                    send_message(workers[w].fd, MessageHeader{MSG_SHUTDOWN, 0, 0, {0, 0, 0, 0}});
+                    drop_worker(w);
+                    continue;
+                }
+                if (message.params[3] != render_hash) {
+                    spdlog::error("Rejecting a worker set up for a different scene, camera, seed, sampler or light sampling");
+                    send_message(workers[w].fd, MessageHeader{MSG_SHUTDOWN, 0, 0, {0, 0, 0, 0}});
+                    drop_worker(w);
+                    continue;
+                }
+                workers[w].ready = true;
+                continue;
+            }
+
+            // Only take as much as the tile could need, before trusting the size the worker gives.
+            if (message.type != MSG_RESULT || message.tile >= tiles.size()) {
+                drop_worker(w);
+                continue;
+            }
+            Tile& tile = tiles[message.tile];
+            size_t pixel_count = size_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+            std::vector<char> payload;
+            if (message.payload > max_compressed_tile_size(pixel_count)) {
+                spdlog::warn("Dropping a worker that sent {} bytes for tile {}", message.payload, message.tile);
+                drop_worker(w);
+                continue;
+            }
+            payload.resize(message.payload);
+            if (!recv_all(workers[w].fd, payload.data(), payload.size())) {
+                drop_worker(w);
+                continue;
+            }
+
+            workers[w].tile = -1;
+            if (tile.done || !decompress_tile(payload, pixel_count, pixels)) {
+                continue;
+            }
+
+            size_t p = 0;
+            for (int y = tile.y0; y < tile.y1; y++) {
+                for (int x = tile.x0; x < tile.x1; x++) {
+                    image[(size_t(y) * width) + x] = pixels[p++];
+                }
+            }
+            tile.done = true;
+            tiles_done++;
+            spdlog::info("Tiles Remaining: {}", tiles.size() - tiles_done);
+        }
+    }
+
+    for (const Worker& worker : workers) {
+        send_message(worker.fd, MessageHeader{MSG_SHUTDOWN, 0, 0, {0, 0, 0, 0}});
+        ::close(worker.fd);
+    }
+    ::close(listen_fd);
+    if (settings.address.rfind("unix:", 0) == 0) {
+        ::unlink(settings.address.substr(5).c_str());
+    }
+    for (pid_t child : children) {
+        ::waitpid(child, nullptr, 0);
+    }
+
+    return tiles_done == tiles.size();
+}
+
+inline void distributed_scaling_report(Camera cam, const Hittable& world, DistributedSettings settings, int max_workers) {
+    // Renders the same image with 1, 2, ... max_workers local workers and logs the wall time,
+    // speedup and parallel efficiency of each run.
+    std::vector<Color> image;
+    double single_worker_seconds = 0;
+
+    spdlog::info("{:>8} {:>10} {:>8} {:>11}", "workers", "seconds", "speedup", "efficiency");
+    for (int workers = 1; workers <= max_workers; workers++) {
+        settings.local_workers = workers;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!render_distributed(cam, world, settings, image)) {
+            return;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (workers == 1) {
+            single_worker_seconds = seconds;
+        }
+        double speedup = single_worker_seconds / seconds;
+        spdlog::info("{:>8} {:>10.3f} {:>8.2f} {:>10.0f}%", workers, seconds, speedup, 100.0 * speedup / workers);
+    }
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instrumentation.h"
+
+// What a DynamicBvh::refit() call had to touch.
+struct RefitStats {
+    size_t moved = 0; // Leaves whose objects reported moving
+    size_t refit_nodes = 0; // Interior nodes whose bounds were recomputed
+    size_t rebuilds = 0; // Subtrees rebuilt because their bounds had grown too much
+    size_t rebuilt_nodes = 0; // Nodes in those subtrees
+};
+
+class DynamicBvh : public Hittable {
+public:
+    // A bounding volume hierarchy whose objects may move between renders. Moving objects are
+    // handled by refitting: their leaves get new bounds and the change is propagated up through
+    // the parents, so the cost depends on how many objects moved rather than on the scene size.
+    // Refitting keeps the tree's structure, which gets worse as objects drift away from the
+    // neighbours they were grouped with; a subtree whose surface area grows past
+    // rebuild_threshold times its area when it was built is rebuilt from its own leaves.
+    DynamicBvh(const HittableList& list, double rebuild_threshold = 2)
+    : rebuild_threshold(rebuild_threshold) {
+        std::vector<std::shared_ptr<Hittable>> objects = list.objects;
+        if (objects.empty()) {
+            return;
+        }
+        nodes.resize((2 * objects.size()) - 1);
+        size_t next = 0;
+        build(objects, 0, objects.size(), no_parent, next);
+    }
+
+    RefitStats refit(const std::vector<const Hittable*>& moved) {
+        // Updates the bounds of the given objects, which must be in the hierarchy, and of every
+        // node above them.
+        RefitStats stats;
+        std::vector<size_t> degraded;
+
+        for (const Hittable* object : moved) {
+            auto found = leaf_of.find(object);
+            if (found == leaf_of.end()) {
+                continue;
+            }
+            stats.moved++;
+
+            size_t node_index = found->second;
+            nodes[node_index].bbox = object->bounding_box();
+            for (size_t parent = nodes[node_index].parent; parent != no_parent; parent = nodes[parent].parent) {
+                Node& node = nodes[parent];
+                AABB refit_bbox(nodes[parent + 1].bbox, nodes[node.right].bbox);
+                if (same_box(refit_bbox, node.bbox)) {
+                    // Nothing above here changes either.
+                    break;
+                }
+                node.bbox = refit_bbox;
+                stats.refit_nodes++;
+                if (surface_area(node.bbox) > rebuild_threshold * node.built_area) {
+                    degraded.push_back(parent);
+                }
+            }
+        }
+
+        // Rebuild the outermost degraded subtrees; anything degraded inside them is rebuilt along
+        // with them. The rebuilt subtree bounds the same objects, so its ancestors are unaffected.
+        std::sort(degraded.begin(), degraded.end());
+        degraded.erase(std::unique(degraded.begin(), degraded.end()), degraded.end());
+        size_t covered_end = 0;
+        for (size_t node_index : degraded) {
+            if (node_index < covered_end) {
+                continue;
+            }
+            rebuild(node_index);
+            stats.rebuilds++;
+            stats.rebuilt_nodes += nodes[node_index].end - node_index;
+            covered_end = nodes[node_index].end;
+        }
+        return stats;
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        // Nodes are laid out depth first, so a node's left child directly follows it and only the
+        // right child needs to be remembered.
+        bool hit_anything = false;
+        size_t stack[64];
+        size_t stack_size = 0;
+        size_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (node.bbox.hit(r, ray_t)) {
+                if (node.object) {
+                    if (node.object->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                } else {
+                    stack[stack_size++] = node.right;
+                    node_index++;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                break;
+            }
+            node_index = stack[--stack_size];
+        }
+        return hit_anything;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        size_t stack[64];
+        size_t stack_size = 0;
+        size_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (node.bbox.hit(r, ray_t)) {
+                if (node.object) {
+                    if (node.object->occluded(r, ray_t)) {
+                        return true;
+                    }
+                } else {
+                    stack[stack_size++] = node.right;
+                    node_index++;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                return false;
+            }
+            node_index = stack[--stack_size];
+        }
+    }
+
+    AABB bounding_box() const override { return nodes.empty() ? AABB::empty : nodes[0].bbox; }
+
+    bool describe_hierarchy(HierarchyDescription& description) const override {
+        description.type = "DynamicBvh";
+        description.bytes = (nodes.capacity() * sizeof(Node))
+                          + (leaf_of.size() * (sizeof(std::pair<const Hittable*, size_t>) + (2 * sizeof(void*))))
+                          + (leaf_of.bucket_count() * sizeof(void*));
+        description.nodes.resize(nodes.size());
+        for (size_t node_index = 0; node_index < nodes.size(); node_index++) {
+            const Node& node = nodes[node_index];
+            HierarchyDescription::Node& described = description.nodes[node_index];
+            described.bbox = node.bbox;
+            if (node.object) {
+                described.objects.push_back(node.object);
+            } else {
+                described.left = int(node_index + 1);
+                described.right = int(node.right);
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t no_parent = size_t(-1);
+
+    struct Node {
+        AABB bbox;
+        std::shared_ptr<Hittable> object; // Set for leaves only
+        size_t right = 0; // Right child of an interior node; the left child follows the node
+        size_t parent = no_parent;
+        size_t end = 0; // One past the last node of this node's subtree
+        double built_area = 0; // Surface area when the subtree was last built
+    };
+
+    double rebuild_threshold;
+    std::vector<Node> nodes;
+    std::unordered_map<const Hittable*, size_t> leaf_of;
+
+    void build(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end, size_t parent, size_t& next) {
+        // Builds the subtree over objects[start, end) into the nodes from `next` on, splitting at
+        // the median along the longest axis like BvhNode. A subtree over n objects always takes
+        // 2n - 1 nodes, which is what lets rebuild() reuse a subtree's slots.
+        size_t node_index = next++;
+        Node& node = nodes[node_index];
+        node.parent = parent;
+
+        if (end - start == 1) {
+            node.object = objects[start];
+            node.bbox = node.object->bounding_box();
+            node.built_area = surface_area(node.bbox);
+            node.end = next;
+            leaf_of[node.object.get()] = node_index;
+            return;
+        }
+        node.object = nullptr;
+
+        AABB span_bbox = AABB::empty;
+        for (size_t object_index = start; object_index < end; object_index++) {
+            span_bbox = AABB(span_bbox, objects[object_index]->bounding_box());
+        }
+        int axis = span_bbox.longest_axis();
+
+        size_t mid = start + ((end - start) / 2);
+        std::nth_element(std::begin(objects) + start, std::begin(objects) + mid, std::begin(objects) + end,
+                         [axis](const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
+                             return a->bounding_box().axis_interval(axis).min < b->bounding_box().axis_interval(axis).min;
+                         });
+
+        build(objects, start, mid, node_index, next);
+        nodes[node_index].right = next;
+        build(objects, mid, end, node_index, next);
+
+        Node& built = nodes[node_index];
+        built.bbox = span_bbox;
+        built.built_area = surface_area(span_bbox);
+        built.end = next;
+    }
+
+    void rebuild(size_t node_index) {
+        // Rebuilds the subtree rooted at node_index from its current leaves, in place.
+        std::vector<std::shared_ptr<Hittable>> objects;
+        for (size_t i = node_index; i < nodes[node_index].end; i++) {
+            if (nodes[i].object) {
+                objects.push_back(nodes[i].object);
+            }
+        }
+        size_t next = node_index;
+        build(objects, 0, objects.size(), nodes[node_index].parent, next);
+    }
+
+    static double surface_area(const AABB& box) {
+        double dx = box.x.size();
+        double dy = box.y.size();
+        double dz = box.z.size();
+        return 2 * ((dx * dy) + (dx * dz) + (dy * dz));
+    }
+
+    static bool same_box(const AABB& a, const AABB& b) {
+        return a.x.min == b.x.min && a.x.max == b.x.max && a.y.min == b.y.min && a.y.max == b.y.max
+            && a.z.min == b.z.min && a.z.max == b.z.max;
+    }
+};
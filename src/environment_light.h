@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "alias_table.h"
+#include "color.h"
+#include "fast_math.h"
+#include "image_cache.h"
+#include "light_bounds.h"
+#include "rtw_stb_image.h"
+#include "sampler.h"
+#include "vec3.h"
+
+class EnvironmentLight {
+public:
+    // Light arriving from infinitely far away in every direction, from an equirectangular
+    // (latitude-longitude) image: the top row looks straight up the y axis, the bottom row
+    // straight down, and the columns go around the y axis starting from -x, as Sphere lays out
+    // its texture coordinates. Directions are importance sampled in proportion to the radiance
+    // of each pixel through an alias table, so a small bright sun gets most of the shadow rays.
+    //
+    // A low resolution copy, averaged by solid angle so it gives off the same light, can stand in
+    // for the image wherever detail would be blurred away anyway, such as light reaching a
+    // diffuse surface from another one. Its own alias table samples it; sampling and looking up
+    // must use the same version for MIS weights to add up.
+    EnvironmentLight(const char* filename, double scale = 1) {
+        // Loads a Radiance .hdr (or any image stb can read, made linear) and scales its radiance.
+        std::shared_ptr<const RtwImage> loaded = load_image(filename);
+        const RtwImage& image = *loaded;
+        std::vector<Color> image_pixels;
+        image_pixels.reserve(size_t(image.width()) * image.height());
+        for (int y = 0; y < image.height(); y++) {
+            for (int x = 0; x < image.width(); x++) {
+                const float* pixel = image.pixel_floats(x, y);
+                image_pixels.push_back(scale * Color(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+        build(image.width(), image.height(), std::move(image_pixels));
+        if (image.height() > 0) {
+            spdlog::info("Environment '{}': {}x{} pixels", filename, full.width, full.height);
+        }
+    }
+
+    EnvironmentLight(int image_width, int image_height, std::vector<Color> image_pixels) {
+        // From pixels in memory, top row first.
+        build(image_width, image_height, std::move(image_pixels));
+    }
+
+    Color radiance(const Vec3& direction, bool filtered = false) const {
+        // The radiance arriving from the given unit direction.
+        const Map& map = filtered ? low_resolution : full;
+        return map.pixels[map.index(direction)];
+    }
+
+    Vec3 sample(Point2 u, double& pdf, bool filtered = false) const {
+        // Picks a unit direction with probability in proportion to its radiance, setting pdf to
+        // its density over solid angle. Returns a zero vector, with a pdf of zero, if the
+        // environment is black.
+        const Map& map = filtered ? low_resolution : full;
+        if (map.distribution.empty()) {
+            pdf = 0;
+            return Vec3(0, 0, 0);
+        }
+
+        // The alias table picks the pixel; what's left of u.x and all of u.y pick a point in it.
+        double ux;
+        size_t index = map.distribution.sample(u.x, &ux);
+        int x = int(index % size_t(map.width));
+        int y = int(index / size_t(map.width));
+
+        double theta = pi * (y + u.y) / map.height;
+        double phi = (2 * pi * (x + ux) / map.width) - pi;
+        double sin_theta = std::sin(theta);
+        Vec3 direction(sin_theta * std::cos(phi), std::cos(theta), -sin_theta * std::sin(phi));
+
+        pdf = map.pdf(index, sin_theta);
+        return direction;
+    }
+
+    double pdf(const Vec3& direction, bool filtered = false) const {
+        // The density over solid angle with which sample() picks the given unit direction.
+        const Map& map = filtered ? low_resolution : full;
+        if (map.distribution.empty()) {
+            return 0;
+        }
+        double sin_theta = std::sqrt(std::fmax(0.0, 1 - (direction.y() * direction.y())));
+        return map.pdf(map.index(direction), sin_theta);
+    }
+
+private:
+    struct Map {
+        int width = 0;
+        int height = 0;
+        std::vector<Color> pixels; // Top row first
+        AliasTable distribution;
+
+        size_t index(const Vec3& direction) const {
+            // The pixel the given unit direction falls in.
+            double theta = shading_acos(std::clamp(direction.y(), -1.0, 1.0));
+            double phi = shading_atan2(-direction.z(), direction.x()) + pi;
+            int x = std::clamp(int(phi / (2 * pi) * width), 0, width - 1);
+            int y = std::clamp(int(theta / pi * height), 0, height - 1);
+            return (size_t(y) * width) + x;
+        }
+
+        double pdf(size_t index, double sin_theta) const {
+            // The pixel's probability spread evenly over its rectangle of angles, which covers
+            // 2 pi^2 sin(theta) / (width * height) steradians around polar angle theta.
+            if (sin_theta <= 0) {
+                return 0;
+            }
+            return distribution.pmf(index) * width * height / (2 * pi * pi * sin_theta);
+        }
+
+        void build_distribution() {
+            // Pixels shrink towards the poles, in proportion to the sine of their polar angle, so
+            // a pixel's chance of being picked is its luminance times that.
+            std::vector<double> weights(pixels.size());
+            for (int y = 0; y < height; y++) {
+                double sin_theta = std::sin(pi * (y + 0.5) / height);
+                for (int x = 0; x < width; x++) {
+                    weights[(size_t(y) * width) + x] = luminance(pixels[(size_t(y) * width) + x]) * sin_theta;
+                }
+            }
+            distribution = AliasTable(weights);
+        }
+    };
+
+    Map full;
+    Map low_resolution;
+
+    static constexpr int max_filtered_width = 64;
+
+    void build(int image_width, int image_height, std::vector<Color> image_pixels) {
+        // A missing image becomes a single black pixel, so lookups still work.
+        if (image_width <= 0 || image_height <= 0 || image_pixels.size() != size_t(image_width) * image_height) {
+            spdlog::error("Environment image is empty or the wrong size; the environment will be black");
+            image_width = 1;
+            image_height = 1;
+            image_pixels.assign(1, Color(0, 0, 0));
+        }
+        for (Color& pixel : image_pixels) {
+            pixel = Color(std::fmax(0.0, pixel.x()), std::fmax(0.0, pixel.y()), std::fmax(0.0, pixel.z()));
+        }
+        full.width = image_width;
+        full.height = image_height;
+        full.pixels = std::move(image_pixels);
+        full.build_distribution();
+
+        low_resolution.width = std::min(full.width, max_filtered_width);
+        low_resolution.height = std::min(full.height, max_filtered_width / 2);
+        low_resolution.pixels.assign(size_t(low_resolution.width) * low_resolution.height, Color(0, 0, 0));
+        std::vector<double> solid_angles(low_resolution.pixels.size(), 0);
+        for (int y = 0; y < full.height; y++) {
+            double sin_theta = std::sin(pi * (y + 0.5) / full.height);
+            int low_y = int((long(y) * low_resolution.height) / full.height);
+            for (int x = 0; x < full.width; x++) {
+                int low_x = int((long(x) * low_resolution.width) / full.width);
+                size_t low_index = (size_t(low_y) * low_resolution.width) + low_x;
+                low_resolution.pixels[low_index] += sin_theta * full.pixels[(size_t(y) * full.width) + x];
+                solid_angles[low_index] += sin_theta;
+            }
+        }
+        for (size_t index = 0; index < low_resolution.pixels.size(); index++) {
+            if (solid_angles[index] > 0) {
+                low_resolution.pixels[index] /= solid_angles[index];
+            }
+        }
+        low_resolution.build_distribution();
+    }
+};
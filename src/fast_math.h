@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Fast approximations of the math functions shading calls on every hit or pixel, each with the
+// largest error it makes over its domain (checked by --fast-math-report). They are polynomials
+// without branches or table lookups, so loops over them vectorize. The polynomials interpolate
+// each function at Chebyshev nodes, which comes within a few percent of the best possible error
+// for their degree.
+//
+// Shading code calls the shading_* functions at the bottom rather than these. Those use the
+// approximations only in builds with RTW_FAST_MATH defined (the CMake option of the same name),
+// so renders that need the C library's accuracy, such as reference images, keep it by default.
+
+inline double fast_acos(double x) {
+    // Largest absolute error 3e-8 radians over [-1, 1]. acos(x) = sqrt(1 - x) P(x) for x in
+    // [0, 1], and acos(-x) = pi - acos(x).
+    double a = std::fabs(x);
+    double p = -0.0012117377695521551;
+    p = (p * a) + 0.006491521427536326;
+    p = (p * a) - 0.016841052414462963;
+    p = (p * a) + 0.030722122417552327;
+    p = (p * a) - 0.050114303104383355;
+    p = (p * a) + 0.08896885320062198;
+    p = (p * a) - 0.21459815556457443;
+    p = (p * a) + 1.570796298215578;
+    double r = std::sqrt(1 - a) * p;
+    return x < 0 ? 3.141592653589793 - r : r;
+}
+
+inline double fast_atan2(double y, double x) {
+    // Largest absolute error 2e-9 radians. The angle is folded into [0, pi/4] by symmetry, where
+    // atan(z) = z P(z^2).
+    double ax = std::fabs(x);
+    double ay = std::fabs(y);
+    double big = std::fmax(ax, ay);
+    double z = big > 0 ? std::fmin(ax, ay) / big : 0;
+    double u = z * z;
+    double p = -0.001701170068253273;
+    p = (p * u) + 0.010487649274509469;
+    p = (p * u) - 0.030351864824038073;
+    p = (p * u) + 0.057089555970894434;
+    p = (p * u) - 0.08349724970833343;
+    p = (p * u) + 0.10932341502243995;
+    p = (p * u) - 0.14260016083022323;
+    p = (p * u) + 0.19998075281171376;
+    p = (p * u) - 0.33333276291983654;
+    p = (p * u) + 0.9999999971605457;
+    double r = z * p;
+    r = ay > ax ? 1.5707963267948966 - r : r;
+    r = x < 0 ? 3.141592653589793 - r : r;
+    return std::copysign(r, y);
+}
+
+inline double fast_sin(double x) {
+    // Largest absolute error 1e-10 for |x| < 1e5. x is reduced by a multiple k of pi into
+    // [-pi/2, pi/2], where sin(x) = x P(x^2), and sin(x + k pi) = (-1)^k sin(x). Pi is split in
+    // two so the reduction stays accurate for large k.
+    double k = std::floor((x * 0.3183098861837907) + 0.5);
+    double r = (x - (k * 3.141592653589793)) - (k * 1.2246467991473532e-16);
+    double u = r * r;
+    double p = -2.3889217705508352e-08;
+    p = (p * u) + 2.752526980979108e-06;
+    p = (p * u) - 0.00019840861179315624;
+    p = (p * u) + 0.008333330974208214;
+    p = (p * u) - 0.16666666616815626;
+    p = (p * u) + 0.9999999999829192;
+    double s = r * p;
+    return (std::int64_t(k) & 1) ? -s : s;
+}
+
+inline double pow5(double x) {
+    // x^5 in three multiplications, without pow's exp and log; largest relative error 5e-16.
+    double x2 = x * x;
+    return x2 * x2 * x;
+}
+
+inline double fast_rsqrt(double x) {
+    // 1 / sqrt(x) for x > 0, largest relative error 4e-11: a first guess from halving the
+    // exponent with integer arithmetic, refined by three Newton steps.
+    std::uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5fe6eb50c7b537a9ULL - (bits >> 1);
+    double y;
+    std::memcpy(&y, &bits, sizeof(y));
+    double half_x = 0.5 * x;
+    y = y * (1.5 - (half_x * y * y));
+    y = y * (1.5 - (half_x * y * y));
+    y = y * (1.5 - (half_x * y * y));
+    return y;
+}
+
+// The functions shading uses, fast or exact depending on the build.
+
+inline double shading_acos(double x) {
+#ifdef RTW_FAST_MATH
+    return fast_acos(x);
+#else
+    return std::acos(x);
+#endif
+}
+
+inline double shading_atan2(double y, double x) {
+#ifdef RTW_FAST_MATH
+    return fast_atan2(y, x);
+#else
+    return std::atan2(y, x);
+#endif
+}
+
+inline double shading_sin(double x) {
+#ifdef RTW_FAST_MATH
+    return fast_sin(x);
+#else
+    return std::sin(x);
+#endif
+}
+
+inline double shading_pow5(double x) {
+#ifdef RTW_FAST_MATH
+    return pow5(x);
+#else
+    return std::pow(x, 5);
+#endif
+}
+
+inline double shading_sqrt(double x) {
+#ifdef RTW_FAST_MATH
+    return x > 0 ? x * fast_rsqrt(x) : 0;
+#else
+    return std::sqrt(x);
+#endif
+}
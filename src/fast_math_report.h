@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "fast_math.h"
+
+template <typename Exact, typename Fast>
+void fast_math_case(const char* name, const char* domain, size_t count, double bound, bool relative, Exact exact,
+                    Fast fast) {
+    // Logs the largest error of fast(i) against exact(i) over inputs 0 to count - 1, whether it is
+    // within the documented bound, and the time per call of each, as the least of a few runs
+    // over all the inputs.
+    double largest_error = 0;
+    for (size_t i = 0; i < count; i++) {
+        double expected = exact(i);
+        double error = std::fabs(fast(i) - expected);
+        if (relative) {
+            error /= std::fabs(expected);
+        }
+        largest_error = std::max(largest_error, error);
+    }
+
+    auto time_per_call = [count](auto function) {
+        double fastest = infinity;
+        volatile double sink = 0;
+        for (int run = 0; run < 5; run++) {
+            auto start = std::chrono::steady_clock::now();
+            double sum = 0;
+            for (size_t i = 0; i < count; i++) {
+                sum += function(i);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            sink = sink + sum;
+            fastest = std::min(fastest, seconds);
+        }
+        return fastest / double(count) * 1e9;
+    };
+    double exact_ns = time_per_call(exact);
+    double fast_ns = time_per_call(fast);
+
+    spdlog::info("{:>11} {:>16} {:>10.2e} {:>10.0e} {:>4} {:>9.2f} {:>9.2f} {:>8.2f}x", name, domain, largest_error, bound,
+                 largest_error <= bound ? "yes" : "NO", exact_ns, fast_ns, exact_ns / fast_ns);
+}
+
+inline void fast_math_report() {
+    // Checks each approximation in fast_math.h against the C library over a million points of its
+    // domain and times both, so the accuracy given up can be weighed against the time saved.
+    const size_t count = 1 << 20;
+    std::vector<double> x(count);
+    std::vector<double> y(count);
+
+#ifdef RTW_FAST_MATH
+    spdlog::info("This build shades with the approximations (RTW_FAST_MATH)");
+#else
+    spdlog::info("This build shades with the C library; configure with -DRTW_FAST_MATH=ON to use the approximations");
+#endif
+    spdlog::info("{:>11} {:>16} {:>10} {:>10} {:>4} {:>9} {:>9} {:>9}", "function", "domain", "max error", "bound", "ok",
+                 "libm ns", "fast ns", "speedup");
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = random_double(-1, 1);
+    }
+    fast_math_case("acos", "[-1, 1]", count, 3e-8, false, [&](size_t i) { return std::acos(x[i]); },
+                   [&](size_t i) { return fast_acos(x[i]); });
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = random_double(-1, 1);
+        y[i] = random_double(-1, 1);
+    }
+    fast_math_case("atan2", "[-1, 1]^2", count, 2e-9, false, [&](size_t i) { return std::atan2(y[i], x[i]); },
+                   [&](size_t i) { return fast_atan2(y[i], x[i]); });
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = random_double(-100, 100);
+    }
+    fast_math_case("sin", "[-100, 100]", count, 1e-10, false, [&](size_t i) { return std::sin(x[i]); },
+                   [&](size_t i) { return fast_sin(x[i]); });
+    for (size_t i = 0; i < count; i++) {
+        x[i] = random_double(-1e5, 1e5);
+    }
+    fast_math_case("sin", "[-1e5, 1e5]", count, 1e-10, false, [&](size_t i) { return std::sin(x[i]); },
+                   [&](size_t i) { return fast_sin(x[i]); });
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = random_double(0, 1);
+    }
+    fast_math_case("pow5", "[0, 1], rel.", count, 5e-16, true, [&](size_t i) { return std::pow(x[i], 5); },
+                   [&](size_t i) { return pow5(x[i]); });
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = std::exp(random_double(-14, 14));
+    }
+    fast_math_case("rsqrt", "[1e-6, 1e6], rel.", count, 4e-11, true, [&](size_t i) { return 1 / std::sqrt(x[i]); },
+                   [&](size_t i) { return fast_rsqrt(x[i]); });
+    fast_math_case("sqrt", "[1e-6, 1e6], rel.", count, 4e-11, true, [&](size_t i) { return std::sqrt(x[i]); },
+                   [&](size_t i) { return x[i] * fast_rsqrt(x[i]); });
+}
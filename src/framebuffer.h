@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "instrumentation.h"
+#include "pfm.h"
+#include "vec3.h"
+
+// Arbitrary output variables (AOVs) that can be recorded alongside the beauty pass. These are bit
+// flags, so a set of requested AOVs is just their bitwise OR.
+enum AovFlags : unsigned {
+    AOV_NONE = 0,
+    AOV_DEPTH = 1 << 0, // Camera space depth of the primary hit
+    AOV_NORMAL = 1 << 1, // World space shading normal of the primary hit
+    AOV_ALBEDO = 1 << 2, // Attenuation returned by the primary hit's material
+    AOV_MATERIAL_ID = 1 << 3, // Id of the primary hit's material
+    AOV_PRIMITIVE_ID = 1 << 4, // Id of the primary hit's primitive
+    AOV_SAMPLE_COUNT = 1 << 5, // Number of samples taken for the pixel
+    AOV_TIME = 1 << 6, // Average ray time of the pixel's samples
+    // What the pixel's samples cost, averaged over them. Only builds with RTW_INSTRUMENTATION
+    // count the work (see instrumentation.h), so only they offer these.
+    AOV_COST_NS = 1 << 7, // Wall time spent tracing a sample, in nanoseconds
+    AOV_BVH_NODES = 1 << 8, // Hierarchy nodes a sample's rays were tested against
+    AOV_PRIMITIVES = 1 << 9, // Primitives a sample's rays were tested against
+    AOV_PATH_LENGTH = 1 << 10, // Segments in a sample's path, shadow rays not included
+    AOV_COSTS = AOV_COST_NS | AOV_BVH_NODES | AOV_PRIMITIVES | AOV_PATH_LENGTH,
+};
+
+struct AovInfo {
+    AovFlags flag;
+    const char* name;
+    int components;
+};
+
+inline const AovInfo aov_table[] = {
+    {AOV_DEPTH, "depth", 1},
+    {AOV_NORMAL, "normal", 3},
+    {AOV_ALBEDO, "albedo", 3},
+    {AOV_MATERIAL_ID, "material_id", 1},
+    {AOV_PRIMITIVE_ID, "primitive_id", 1},
+    {AOV_SAMPLE_COUNT, "sample_count", 1},
+    {AOV_TIME, "time", 1},
+    {AOV_COST_NS, "cost_ns", 1},
+    {AOV_BVH_NODES, "bvh_nodes", 1},
+    {AOV_PRIMITIVES, "primitives", 1},
+    {AOV_PATH_LENGTH, "path_length", 1},
+};
+
+#ifdef RTW_INSTRUMENTATION
+inline constexpr unsigned available_aovs = ~0u;
+#else
+inline constexpr unsigned available_aovs = ~unsigned(AOV_COSTS);
+#endif
+
+inline bool parse_aov_flags(const std::string& list, unsigned& flags) {
+    // Parses a comma separated list of AOV names (or "all") into a set of AOV flags. Returns false
+    // if an unknown name is encountered, or one this build can't record.
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "all") {
+            for (const AovInfo& info : aov_table) {
+                flags |= info.flag & available_aovs;
+            }
+            continue;
+        }
+
+        bool found = false;
+        for (const AovInfo& info : aov_table) {
+            if (name == info.name) {
+                if (!(info.flag & available_aovs)) {
+                    spdlog::error("AOV '{}' needs a build configured with -DRTW_INSTRUMENTATION=ON", name);
+                    return false;
+                }
+                flags |= info.flag;
+                found = true;
+            }
+        }
+        if (!found) {
+            spdlog::error("Unknown AOV '{}'", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the camera learned about a single sample's primary hit.
+struct AovSample {
+    bool hit = false;
+    double depth = infinity;
+    Vec3 normal;
+    Color albedo;
+    int material_id = -1;
+    int primitive_id = -1;
+
+    // What tracing the sample cost, for the cost AOVs.
+    double nanoseconds = 0;
+    double bvh_nodes = 0;
+    double primitives = 0;
+    double path_segments = 0;
+};
+
+// A rectangle of pixels, [x0, x1) x [y0, y1).
+struct PixelRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+
+    PixelRect intersect(const PixelRect& other) const {
+        return PixelRect{std::max(x0, other.x0), std::max(y0, other.y0), std::min(x1, other.x1), std::min(y1, other.y1)};
+    }
+};
+
+class Framebuffer {
+public:
+    // Accumulates the beauty pass (a running sum of sample colors and a sample count per pixel)
+    // plus any requested AOVs. Only the requested AOV channels are allocated, so an empty request
+    // costs nothing beyond the beauty buffers. A framebuffer may also hold just a window of
+    // `width` x `height` pixels of a larger image, starting at first_column, first_row, and is
+    // then indexed by the image's pixel coordinates.
+    Framebuffer(int width, int height, unsigned aovs, int first_row = 0, int first_column = 0)
+    : width(width), height(height), aovs(aovs), row_offset(first_row), column_offset(first_column) {
+        size_t pixel_count = size_t(width) * height;
+        color_sums.assign(pixel_count, Color(0, 0, 0));
+        sample_counts.assign(pixel_count, 0);
+
+        for (const AovInfo& info : aov_table) {
+            if ((aovs & info.flag) && info.flag != AOV_SAMPLE_COUNT) {
+                // Ids can't be averaged, so they start out as "no hit" and are taken from the
+                // first sample that hits something.
+                bool is_id = info.flag & (AOV_MATERIAL_ID | AOV_PRIMITIVE_ID);
+                channel(info.flag).assign(pixel_count * info.components, is_id ? -1.0f : 0.0f);
+            }
+        }
+    }
+
+    int image_width() const { return width; }
+    int image_height() const { return height; }
+    unsigned requested() const { return aovs; }
+    int first_row() const { return row_offset; }
+    int first_column() const { return column_offset; }
+    PixelRect window() const { return PixelRect{column_offset, row_offset, column_offset + width, row_offset + height}; }
+
+    size_t index(int i, int j) const { return (size_t(j - row_offset) * width) + (i - column_offset); }
+
+    static size_t row_bytes(int width, unsigned aovs) {
+        // The memory a scanline of the given width and AOVs takes.
+        size_t bytes = sizeof(Color) + sizeof(unsigned);
+        for (const AovInfo& info : aov_table) {
+            if ((aovs & info.flag) && info.flag != AOV_SAMPLE_COUNT) {
+                bytes += info.components * sizeof(float);
+            }
+        }
+        return bytes * width;
+    }
+
+    Color& color_sum(size_t index) { return color_sums[index]; }
+    unsigned& sample_count(size_t index) { return sample_counts[index]; }
+    unsigned sample_count(size_t index) const { return sample_counts[index]; }
+
+    unsigned min_sample_count() const {
+        unsigned min_count = std::numeric_limits<unsigned>::max();
+        for (unsigned count : sample_counts) {
+            min_count = std::min(min_count, count);
+        }
+        return sample_counts.empty() ? 0 : min_count;
+    }
+
+    Color pixel_color(size_t index) const {
+        // The average of the samples taken so far.
+        return sample_counts[index] > 0 ? color_sums[index] / sample_counts[index] : Color(0, 0, 0);
+    }
+
+    void record(size_t index, const AovSample& sample, double time) {
+        // Accumulate one sample's AOVs into the pixel at index. The sample itself is counted along
+        // with its color.
+        if (aovs & AOV_TIME) {
+            this->time[index] += float(time);
+        }
+        if (aovs & AOV_DEPTH) {
+            // Misses count as infinitely deep, which the average preserves.
+            depth[index] += float(sample.depth);
+        }
+        if (aovs & AOV_NORMAL) {
+            add3(normal, index, sample.normal);
+        }
+        if (aovs & AOV_ALBEDO) {
+            add3(albedo, index, sample.albedo);
+        }
+        if ((aovs & AOV_MATERIAL_ID) && sample.hit && material_ids[index] < 0) {
+            material_ids[index] = float(sample.material_id);
+        }
+        if ((aovs & AOV_PRIMITIVE_ID) && sample.hit && primitive_ids[index] < 0) {
+            primitive_ids[index] = float(sample.primitive_id);
+        }
+        if (aovs & AOV_COSTS) {
+            record_costs(index, sample);
+        }
+    }
+
+    void resolve_row(const AovInfo& info, int j, float* out) const {
+        // Stores scanline j of a requested AOV in out, info.components floats per pixel.
+        // Everything except the ids and the sample count is averaged over the pixel's samples.
+        size_t first = index(column_offset, j);
+        if (info.flag == AOV_SAMPLE_COUNT) {
+            std::copy(&sample_counts[first], &sample_counts[first] + width, out);
+            return;
+        }
+        const float* plane = &channel(info.flag)[first * info.components];
+        std::copy(plane, plane + (size_t(width) * info.components), out);
+        if (info.flag & (AOV_MATERIAL_ID | AOV_PRIMITIVE_ID)) {
+            return;
+        }
+        for (int i = 0; i < width; i++) {
+            unsigned count = sample_counts[first + i];
+            float scale = count > 0 ? 1.0f / count : 0.0f;
+            for (int c = 0; c < info.components; c++) {
+                out[(size_t(i) * info.components) + c] *= scale;
+            }
+        }
+    }
+
+    void write_pfms(const std::string& stem) const {
+        // Writes each requested AOV to its own PFM file named <stem>.<aov>.pfm.
+        for (const AovInfo& info : aov_table) {
+            if (!(aovs & info.flag)) {
+                continue;
+            }
+
+            std::vector<float> resolved(size_t(width) * height * info.components);
+            for (int j = row_offset; j < row_offset + height; j++) {
+                resolve_row(info, j, &resolved[index(column_offset, j) * info.components]);
+            }
+
+            std::string filename = stem + "." + info.name + ".pfm";
+            if (write_pfm(filename, width, height, info.components, resolved.data())) {
+                spdlog::info("Wrote AOV '{}' to {}", info.name, filename);
+                if (info.flag & AOV_COSTS) {
+                    write_heatmap(filename, stem + "." + info.name + ".heatmap.ppm");
+                }
+            }
+        }
+    }
+
+    void copy_from(const Framebuffer& other) {
+        // Replaces the pixels this framebuffer shares with another one (with the same AOVs) by
+        // that one's, samples, AOVs and all.
+        PixelRect shared = window().intersect(other.window());
+        for (int j = shared.y0; j < shared.y1 && !shared.empty(); j++) {
+            size_t from = other.index(shared.x0, j);
+            size_t to = index(shared.x0, j);
+            size_t count = size_t(shared.width());
+            std::copy_n(&other.color_sums[from], count, &color_sums[to]);
+            std::copy_n(&other.sample_counts[from], count, &sample_counts[to]);
+            for (const AovInfo& info : aov_table) {
+                if ((aovs & info.flag) && info.flag != AOV_SAMPLE_COUNT) {
+                    std::copy_n(&other.channel(info.flag)[from * info.components], count * info.components,
+                                &channel(info.flag)[to * info.components]);
+                }
+            }
+        }
+    }
+
+    bool save(std::ostream& out) const {
+        // Writes the raw accumulation state (not the averaged image) in native byte order.
+        out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+        out.write(reinterpret_cast<const char*>(&height), sizeof(height));
+        out.write(reinterpret_cast<const char*>(&aovs), sizeof(aovs));
+        write_plane(out, sample_counts);
+        write_plane(out, color_sums);
+        for (const AovInfo& info : aov_table) {
+            if ((aovs & info.flag) && info.flag != AOV_SAMPLE_COUNT) {
+                write_plane(out, channel(info.flag));
+            }
+        }
+        return bool(out);
+    }
+
+    bool load(std::istream& in) {
+        // Restores state written by save(). Fails, leaving the framebuffer untouched, unless the
+        // saved dimensions and AOVs match this framebuffer's.
+        int saved_width;
+        int saved_height;
+        unsigned saved_aovs;
+        in.read(reinterpret_cast<char*>(&saved_width), sizeof(saved_width));
+        in.read(reinterpret_cast<char*>(&saved_height), sizeof(saved_height));
+        in.read(reinterpret_cast<char*>(&saved_aovs), sizeof(saved_aovs));
+        if (!in || saved_width != width || saved_height != height || saved_aovs != aovs) {
+            return false;
+        }
+
+        Framebuffer loaded(width, height, aovs, row_offset, column_offset);
+        bool ok = read_plane(in, loaded.sample_counts) && read_plane(in, loaded.color_sums);
+        for (const AovInfo& info : aov_table) {
+            if ((aovs & info.flag) && info.flag != AOV_SAMPLE_COUNT) {
+                ok = ok && read_plane(in, loaded.channel(info.flag));
+            }
+        }
+        if (ok) {
+            *this = std::move(loaded);
+        }
+        return ok;
+    }
+
+private:
+    int width;
+    int height;
+    unsigned aovs;
+    int row_offset;
+    int column_offset;
+    std::vector<Color> color_sums;
+    std::vector<unsigned> sample_counts;
+
+    std::vector<float> depth;
+    std::vector<float> normal;
+    std::vector<float> albedo;
+    std::vector<float> material_ids;
+    std::vector<float> primitive_ids;
+    std::vector<float> time;
+    std::vector<float> cost_ns;
+    std::vector<float> bvh_nodes;
+    std::vector<float> primitives;
+    std::vector<float> path_length;
+
+    std::vector<float>& channel(AovFlags flag) {
+        return const_cast<std::vector<float>&>(static_cast<const Framebuffer&>(*this).channel(flag));
+    }
+
+    const std::vector<float>& channel(AovFlags flag) const {
+        switch (flag) {
+            case AOV_DEPTH: return depth;
+            case AOV_NORMAL: return normal;
+            case AOV_ALBEDO: return albedo;
+            case AOV_MATERIAL_ID: return material_ids;
+            case AOV_PRIMITIVE_ID: return primitive_ids;
+            case AOV_COST_NS: return cost_ns;
+            case AOV_BVH_NODES: return bvh_nodes;
+            case AOV_PRIMITIVES: return primitives;
+            case AOV_PATH_LENGTH: return path_length;
+            default: return time;
+        }
+    }
+
+    void record_costs(size_t index, const AovSample& sample) {
+        if (aovs & AOV_COST_NS) {
+            cost_ns[index] += float(sample.nanoseconds);
+        }
+        if (aovs & AOV_BVH_NODES) {
+            bvh_nodes[index] += float(sample.bvh_nodes);
+        }
+        if (aovs & AOV_PRIMITIVES) {
+            primitives[index] += float(sample.primitives);
+        }
+        if (aovs & AOV_PATH_LENGTH) {
+            path_length[index] += float(sample.path_segments);
+        }
+    }
+
+    static void add3(std::vector<float>& plane, size_t index, const Vec3& value) {
+        plane[(index * 3) + 0] += float(value[0]);
+        plane[(index * 3) + 1] += float(value[1]);
+        plane[(index * 3) + 2] += float(value[2]);
+    }
+
+    template <typename T>
+    static void write_plane(std::ostream& out, const std::vector<T>& plane) {
+        out.write(reinterpret_cast<const char*>(plane.data()), plane.size() * sizeof(T));
+    }
+
+    template <typename T>
+    static bool read_plane(std::istream& in, std::vector<T>& plane) {
+        in.read(reinterpret_cast<char*>(plane.data()), plane.size() * sizeof(T));
+        return bool(in);
+    }
+};
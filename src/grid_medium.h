@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "interval.h"
+#include "medium.h"
+#include "vec3.h"
+
+class GridMedium : public Medium {
+public:
+    // A medium whose density varies through space, given by a grid of nx * ny * nz density values
+    // (x varying fastest) spread over bounds and trilinearly interpolated between voxel centers.
+    // The density is zero outside bounds.
+    //
+    // Delta tracking needs a majorant, a density at least as high as the real one, and takes steps
+    // whose average length is one over it. A single majorant for the whole grid would make a ray
+    // crossing mostly empty space step as often as one crossing the densest part, so the bounds
+    // are also split into a coarse grid of majorant cells, each with the highest density found
+    // within it. Rays walk through the majorant cells and skip empty ones entirely, so the work per
+    // ray follows the density it actually passes through.
+    GridMedium(const AABB& bounds, int nx, int ny, int nz, std::vector<double> densities, int majorant_resolution = 16)
+    : bounds(bounds), resolution{nx, ny, nz}, densities(std::move(densities)) {
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& extent = bounds.axis_interval(axis);
+            majorant_cells[axis] = std::max(1, std::min(majorant_resolution, resolution[axis]));
+            cell_size[axis] = extent.size() / majorant_cells[axis];
+        }
+        build_majorants();
+    }
+
+    double density(const Point3& p) const override {
+        // Trilinear interpolation between the eight nearest voxel centers, clamped at the edges.
+        int index[3];
+        double fraction[3];
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& extent = bounds.axis_interval(axis);
+            if (!extent.contains(p[axis])) {
+                return 0;
+            }
+            double g = ((p[axis] - extent.min) / extent.size() * resolution[axis]) - 0.5;
+            double floor_g = std::floor(g);
+            index[axis] = int(floor_g);
+            fraction[axis] = g - floor_g;
+        }
+
+        double result = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            double weight = 1;
+            int voxel[3];
+            for (int axis = 0; axis < 3; axis++) {
+                bool upper = corner & (1 << axis);
+                weight *= upper ? fraction[axis] : 1 - fraction[axis];
+                voxel[axis] = std::clamp(index[axis] + int(upper), 0, resolution[axis] - 1);
+            }
+            result += weight * voxel_density(voxel[0], voxel[1], voxel[2]);
+        }
+        return result;
+    }
+
+    bool sample_collision(const Point3& origin, const Vec3& direction, Interval segment, double& distance) const override {
+        // Clip the segment to the grid.
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& extent = bounds.axis_interval(axis);
+            if (direction[axis] == 0) {
+                if (!extent.contains(origin[axis])) {
+                    return false;
+                }
+                continue;
+            }
+            double t0 = (extent.min - origin[axis]) / direction[axis];
+            double t1 = (extent.max - origin[axis]) / direction[axis];
+            segment.min = std::max(segment.min, std::min(t0, t1));
+            segment.max = std::min(segment.max, std::max(t0, t1));
+        }
+        if (segment.min >= segment.max) {
+            return false;
+        }
+
+        // Walk through the majorant cells (Amanatides and Woo), delta tracking within each one
+        // against its majorant. Exponential distances are memoryless, so a step that runs past a
+        // cell's end can simply start over from there with the next cell's majorant.
+        Point3 start = origin + (segment.min * direction);
+        int cell[3];
+        int step[3];
+        double next_crossing[3];
+        double crossing_delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& extent = bounds.axis_interval(axis);
+            cell[axis] = std::clamp(int((start[axis] - extent.min) / cell_size[axis]), 0, majorant_cells[axis] - 1);
+            if (direction[axis] == 0) {
+                step[axis] = 0;
+                next_crossing[axis] = infinity;
+                crossing_delta[axis] = infinity;
+                continue;
+            }
+            step[axis] = direction[axis] > 0 ? 1 : -1;
+            double boundary = extent.min + ((cell[axis] + (step[axis] > 0 ? 1 : 0)) * cell_size[axis]);
+            next_crossing[axis] = segment.min + ((boundary - start[axis]) / direction[axis]);
+            crossing_delta[axis] = cell_size[axis] / std::fabs(direction[axis]);
+        }
+
+        double t = segment.min;
+        while (true) {
+            int axis = next_crossing[0] < next_crossing[1]
+                     ? (next_crossing[0] < next_crossing[2] ? 0 : 2)
+                     : (next_crossing[1] < next_crossing[2] ? 1 : 2);
+            double cell_end = std::min(next_crossing[axis], segment.max);
+
+            double majorant = majorants[majorant_index(cell[0], cell[1], cell[2])];
+            if (majorant > 0) {
+                while (true) {
+                    t -= std::log(1 - random_double()) / majorant;
+                    if (t >= cell_end) {
+                        break;
+                    }
+                    // A real collision with probability density / majorant, otherwise a null
+                    // collision that the light passes straight through.
+                    if (random_double() * majorant < density(origin + (t * direction))) {
+                        distance = t;
+                        return true;
+                    }
+                }
+            }
+
+            if (cell_end >= segment.max) {
+                return false;
+            }
+            t = cell_end;
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= majorant_cells[axis]) {
+                return false;
+            }
+            next_crossing[axis] += crossing_delta[axis];
+        }
+    }
+
+private:
+    AABB bounds;
+    int resolution[3];
+    std::vector<double> densities;
+    int majorant_cells[3];
+    double cell_size[3];
+    std::vector<double> majorants;
+
+    double voxel_density(int x, int y, int z) const {
+        return densities[(((size_t(z) * resolution[1]) + y) * resolution[0]) + x];
+    }
+
+    size_t majorant_index(int x, int y, int z) const {
+        return (((size_t(z) * majorant_cells[1]) + y) * majorant_cells[0]) + x;
+    }
+
+    void build_majorants() {
+        // Each cell's majorant is the highest density of any voxel that density() could
+        // interpolate from within the cell.
+        std::vector<int> first[3];
+        std::vector<int> last[3];
+        for (int axis = 0; axis < 3; axis++) {
+            first[axis].resize(majorant_cells[axis]);
+            last[axis].resize(majorant_cells[axis]);
+            for (int c = 0; c < majorant_cells[axis]; c++) {
+                double lo = double(c) * resolution[axis] / majorant_cells[axis];
+                double hi = double(c + 1) * resolution[axis] / majorant_cells[axis];
+                first[axis][c] = std::clamp(int(std::floor(lo - 0.5)), 0, resolution[axis] - 1);
+                last[axis][c] = std::clamp(int(std::floor(hi - 0.5)) + 1, 0, resolution[axis] - 1);
+            }
+        }
+
+        majorants.assign(size_t(majorant_cells[0]) * majorant_cells[1] * majorant_cells[2], 0);
+        for (int cz = 0; cz < majorant_cells[2]; cz++) {
+            for (int cy = 0; cy < majorant_cells[1]; cy++) {
+                for (int cx = 0; cx < majorant_cells[0]; cx++) {
+                    double majorant = 0;
+                    for (int z = first[2][cz]; z <= last[2][cz]; z++) {
+                        for (int y = first[1][cy]; y <= last[1][cy]; y++) {
+                            for (int x = first[0][cx]; x <= last[0][cx]; x++) {
+                                majorant = std::max(majorant, voxel_density(x, y, z));
+                            }
+                        }
+                    }
+                    majorants[majorant_index(cx, cy, cz)] = majorant;
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+
+class Hittable;
+
+// An acceleration structure's nodes as it describes them to inspection tools, whatever its own
+// layout. Nodes are listed root first, and every node lists its children by index.
+struct HierarchyDescription {
+    struct Node {
+        AABB bbox;
+        int left = -1; // Children of an interior node; -1 for leaves
+        int right = -1;
+        std::vector<std::shared_ptr<Hittable>> objects; // A leaf's objects
+    };
+
+    std::string type; // The structure's class
+    size_t bytes = 0; // Memory the structure itself takes, not counting its objects
+    std::vector<Node> nodes;
+
+    int add_node(const AABB& bbox) {
+        nodes.emplace_back();
+        nodes.back().bbox = bbox;
+        return int(nodes.size()) - 1;
+    }
+};
@@ -15,6 +15,7 @@ public:
     Point3 p;
     Vec3 normal;
     std::shared_ptr<Material> mat;
+    int primitive_id; // Id of the primitive that was hit
     double t;
     double u;
     double v;
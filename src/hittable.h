@@ -1,15 +1,55 @@
 #pragma once
 
+#include <atomic>
+
 #include "aabb.h"
+#include "hierarchy_description.h"
 #include "interval.h"
 #include "hitrecord.h"
+#include "light_bounds.h"
 #include "ray.h"
+#include "sampler.h"
 
 class Hittable {
 public:
+    int id = next_id(); // Unique id, reported by primitives through HitRecord::primitive_id
+
     virtual ~Hittable() = default;
 
     virtual bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const = 0;
 
+    // Returns whether anything is hit within ray_t, without finding the closest hit or filling in
+    // a hit record. Used for shadow and visibility rays; objects and acceleration structures that
+    // can stop at the first hit override it.
+    virtual bool occluded(const Ray& r, Interval ray_t) const {
+        HitRecord rec;
+        return hit(r, ray_t, rec);
+    }
+
     virtual AABB bounding_box() const = 0;
+
+    // Bounds of the object over the ray times in `time` only. Objects that don't move, or don't
+    // know how they move, just return their bounds over all time.
+    virtual AABB bounding_box(const Interval& time) const { return bounding_box(); }
+
+    // Area light interface, for primitives that can be sampled as lights. random() picks a
+    // direction from origin towards the object using the sample u, and pdf_value() returns the
+    // solid angle density of picking a given direction that way (zero if it misses the object).
+    // light_bounds() summarizes the object's emission for the light hierarchy; it returns false
+    // for objects that don't emit.
+    virtual double pdf_value(const Point3& origin, const Vec3& direction, double time) const { return 0; }
+
+    virtual Vec3 random(const Point3& origin, Point2 u, double time) const { return Vec3(1, 0, 0); }
+
+    virtual bool light_bounds(LightBounds& bounds) const { return false; }
+
+    // Acceleration structures describe their nodes for tools like bvh_inspector and return true;
+    // everything else is a primitive as far as they are concerned.
+    virtual bool describe_hierarchy(HierarchyDescription& description) const { return false; }
+
+private:
+    static int next_id() {
+        static std::atomic<int> counter{0};
+        return counter++;
+    }
 };
@@ -38,8 +38,25 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        for (const std::shared_ptr<Hittable>& object : objects) {
+            if (object->occluded(r, ray_t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     AABB bounding_box() const override { return bbox; }
 
+    AABB bounding_box(const Interval& time) const override {
+        AABB time_bbox = AABB::empty;
+        for (const std::shared_ptr<Hittable>& object : objects) {
+            time_bbox = AABB(time_bbox, object->bounding_box(time));
+        }
+        return time_bbox;
+    }
+
 private:
     AABB bbox;
 };
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "resource_cache.h"
+#include "rtw_stb_image.h"
+
+// An image file that something was built from, with the hash of its contents at the time.
+struct FileDependency {
+    std::string filename;
+    std::uint64_t hash;
+};
+
+class FileDependencyRecorder {
+public:
+    // While one of these lives, load_image() on the same thread records every file it is asked
+    // for, so that whatever is being built can be cached along with the files it depends on.
+    FileDependencyRecorder() : previous(active()) { active() = this; }
+
+    ~FileDependencyRecorder() { active() = previous; }
+
+    FileDependencyRecorder(const FileDependencyRecorder&) = delete;
+    FileDependencyRecorder& operator=(const FileDependencyRecorder&) = delete;
+
+    std::vector<FileDependency> files;
+    size_t loaded_bytes = 0; // Of the images decoded rather than found in the cache
+
+    static FileDependencyRecorder*& active() {
+        static thread_local FileDependencyRecorder* recorder = nullptr;
+        return recorder;
+    }
+
+private:
+    FileDependencyRecorder* previous;
+};
+
+class ImageCachePartition {
+public:
+    // While one of these lives, load_image() on the same thread keeps its images apart from
+    // those of other partitions, so that each NUMA node's copy of a scene gets textures in its
+    // own memory rather than sharing whichever node's copy was loaded first.
+    explicit ImageCachePartition(int partition) : previous(active()) { active() = partition; }
+
+    ~ImageCachePartition() { active() = previous; }
+
+    ImageCachePartition(const ImageCachePartition&) = delete;
+    ImageCachePartition& operator=(const ImageCachePartition&) = delete;
+
+    static int& active() {
+        static thread_local int partition = 0;
+        return partition;
+    }
+
+private:
+    int previous;
+};
+
+inline bool files_unchanged(const std::vector<FileDependency>& files) {
+    // Whether every file still has the contents it had when recorded. A file that can't be read
+    // hashes like an empty one, so one that was missing then and still is counts as unchanged.
+    for (const FileDependency& file : files) {
+        ContentHash hash;
+        hash.add_file(file.filename);
+        if (hash.value() != file.hash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline std::shared_ptr<const RtwImage> load_image(const char* filename) {
+    // Loads an image through ResourceCache::shared(), keyed by the file's contents, so a file
+    // that was loaded before (by this scene or another, under any name) isn't decoded again.
+    // Files that can't be read aren't cached, and get RtwImage's usual error and empty image.
+    ContentHash contents;
+    bool readable = contents.add_file(filename);
+    if (FileDependencyRecorder* recorder = FileDependencyRecorder::active()) {
+        recorder->files.push_back(FileDependency{filename, contents.value()});
+    }
+    if (!readable) {
+        return std::make_shared<const RtwImage>(filename);
+    }
+
+    std::uint64_t key = ContentHash()
+                            .add(std::string("image"))
+                            .add_value(contents.value())
+                            .add_value(ImageCachePartition::active())
+                            .value();
+    ResourceCache& cache = ResourceCache::shared();
+    if (std::shared_ptr<const RtwImage> image = cache.get<RtwImage>(key)) {
+        return image;
+    }
+    auto image = std::make_shared<const RtwImage>(filename);
+    // Every pixel is held as three floats and three bytes.
+    size_t bytes = size_t(image->width()) * image->height() * 3 * (sizeof(float) + 1);
+    if (FileDependencyRecorder* recorder = FileDependencyRecorder::active()) {
+        recorder->loaded_bytes += bytes;
+    }
+    cache.put(key, image, bytes);
+    return image;
+}
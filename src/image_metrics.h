@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "color.h"
+#include "framebuffer.h"
+#include "vec3.h"
+
+// Ways of measuring how far a rendered image is from a reference.
+struct ImageErrors {
+    double mse = 0; // Mean squared error over all pixels and channels
+    double rel_mse = 0; // MSE with each pixel's error divided by the reference's squared value
+    double perceptual = 0; // Mean perceived color difference in [0, 1], see perceptual_errors()
+};
+
+inline std::vector<Color> resolve_pixels(const Framebuffer& framebuffer) {
+    // The average of each pixel's samples, top scanline first.
+    size_t pixel_count = size_t(framebuffer.image_width()) * framebuffer.image_height();
+    std::vector<Color> pixels(pixel_count);
+    for (size_t index = 0; index < pixel_count; index++) {
+        pixels[index] = framebuffer.pixel_color(index);
+    }
+    return pixels;
+}
+
+inline Vec3 linear_rgb_to_lab(const Color& rgb) {
+    // CIELAB under D65, from linear sRGB primaries.
+    double x = (0.4124 * rgb.x()) + (0.3576 * rgb.y()) + (0.1805 * rgb.z());
+    double y = (0.2126 * rgb.x()) + (0.7152 * rgb.y()) + (0.0722 * rgb.z());
+    double z = (0.0193 * rgb.x()) + (0.1192 * rgb.y()) + (0.9505 * rgb.z());
+
+    auto f = [](double t) {
+        const double delta = 6.0 / 29.0;
+        return t > delta * delta * delta ? std::cbrt(t) : (t / (3 * delta * delta)) + (4.0 / 29.0);
+    };
+    double fx = f(x / 0.9505);
+    double fy = f(y);
+    double fz = f(z / 1.0890);
+    return Vec3((116 * fy) - 16, 500 * (fx - fy), 200 * (fy - fz));
+}
+
+inline std::vector<Vec3> blurred_lab(const std::vector<Color>& pixels, int width, int height) {
+    // Converts what a display would show (colors clamped to [0, 1]) to CIELAB, then blurs the
+    // lightness a little and the color channels more, since the eye resolves less chromatic than
+    // achromatic detail. This is what keeps per-pixel noise too fine to see from counting fully.
+    std::vector<Vec3> lab(pixels.size());
+    for (size_t index = 0; index < pixels.size(); index++) {
+        const Color& c = pixels[index];
+        lab[index] = linear_rgb_to_lab(Color(std::clamp(c.x(), 0.0, 1.0), std::clamp(c.y(), 0.0, 1.0), std::clamp(c.z(), 0.0, 1.0)));
+    }
+
+    const double sigmas[3] = {0.8, 1.5, 1.5};
+    for (int channel = 0; channel < 3; channel++) {
+        int radius = int(std::ceil(3 * sigmas[channel]));
+        std::vector<double> kernel(2 * radius + 1);
+        double kernel_sum = 0;
+        for (int k = -radius; k <= radius; k++) {
+            kernel[k + radius] = std::exp(-(k * k) / (2 * sigmas[channel] * sigmas[channel]));
+            kernel_sum += kernel[k + radius];
+        }
+
+        // Separable, clamping at the edges.
+        std::vector<double> row_pass(lab.size());
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int x = std::clamp(i + k, 0, width - 1);
+                    sum += kernel[k + radius] * lab[(size_t(j) * width) + x][channel];
+                }
+                row_pass[(size_t(j) * width) + i] = sum / kernel_sum;
+            }
+        }
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int y = std::clamp(j + k, 0, height - 1);
+                    sum += kernel[k + radius] * row_pass[(size_t(y) * width) + i];
+                }
+                lab[(size_t(j) * width) + i][channel] = sum / kernel_sum;
+            }
+        }
+    }
+    return lab;
+}
+
+inline double hyab(const Vec3& a, const Vec3& b) {
+    // The HyAB color distance: lightness and chroma differences added rather than combined
+    // Euclidean, which tracks perceived differences better for large ones.
+    double da = a.y() - b.y();
+    double db = a.z() - b.z();
+    return std::fabs(a.x() - b.x()) + std::sqrt((da * da) + (db * db));
+}
+
+inline std::vector<double> perceptual_errors(const std::vector<Color>& image, const std::vector<Color>& reference,
+                                             int width, int height) {
+    // Per-pixel perceived color differences in [0, 1], after the color pipeline of NVIDIA's FLIP:
+    // blurred CIELAB colors compared by HyAB distance, compressed by a power of 0.7 and remapped
+    // so that differences beyond 40% of the largest possible one (green against blue) count
+    // almost fully. FLIP's edge and point feature term is left out.
+    const double exponent = 0.7;
+    const double pc = 0.4;
+    const double pt = 0.95;
+    double cmax = std::pow(hyab(linear_rgb_to_lab(Color(0, 1, 0)), linear_rgb_to_lab(Color(0, 0, 1))), exponent);
+
+    std::vector<Vec3> image_lab = blurred_lab(image, width, height);
+    std::vector<Vec3> reference_lab = blurred_lab(reference, width, height);
+    std::vector<double> errors(image.size());
+    for (size_t index = 0; index < image.size(); index++) {
+        double difference = std::pow(hyab(image_lab[index], reference_lab[index]), exponent);
+        double error = difference < pc * cmax
+                     ? (pt / (pc * cmax)) * difference
+                     : pt + ((difference - (pc * cmax)) / (cmax - (pc * cmax)) * (1 - pt));
+        errors[index] = std::min(error, 1.0);
+    }
+    return errors;
+}
+
+inline ImageErrors compare_images(const std::vector<Color>& image, const std::vector<Color>& reference, int width, int height) {
+    ImageErrors errors;
+    for (size_t index = 0; index < image.size(); index++) {
+        for (int c = 0; c < 3; c++) {
+            double difference = image[index][c] - reference[index][c];
+            errors.mse += difference * difference;
+            // The small constant keeps dark pixels from dominating.
+            errors.rel_mse += (difference * difference) / ((reference[index][c] * reference[index][c]) + 0.01);
+        }
+    }
+    double count = 3.0 * image.size();
+    errors.mse /= count;
+    errors.rel_mse /= count;
+
+    std::vector<double> perceptual = perceptual_errors(image, reference, width, height);
+    for (double error : perceptual) {
+        errors.perceptual += error;
+    }
+    errors.perceptual /= double(perceptual.size());
+    return errors;
+}
@@ -1,16 +1,19 @@
 #pragma once
 
+#include <memory>
+
 #include "color.h"
 #include "texture.h"
+#include "image_cache.h"
 #include "rtw_stb_image.h"
 
 class ImageTexture : public Texture {
 public:
-    ImageTexture(const char* filename) : image(filename) {}
+    ImageTexture(const char* filename) : image(load_image(filename)) {}
 
     Color value(double u, double v, const Point3& p) const override {
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0) {
+        if (image->height() <= 0) {
             return Color(0, 1, 1);
         }
 
@@ -18,15 +21,15 @@ public:
         u = Interval(0, 1).clamp(u);
         v = 1.0 - Interval(0, 1).clamp(v); // Flip V to image coordinates
 
-        int i = int(u * image.width());
-        int j = int(v * image.height());
-        const unsigned char* pixel = image.pixel_data(i, j);
+        int i = int(u * image->width());
+        int j = int(v * image->height());
+        const unsigned char* pixel = image->pixel_data(i, j);
 
         double color_scale = 1.0 / 255.0;
         return Color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
     }
 
 private:
-    RtwImage image;
+    std::shared_ptr<const RtwImage> image; // Shared with other textures of the same file
 
 };
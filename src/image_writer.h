@@ -0,0 +1,252 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "color.h"
+#include "framebuffer.h"
+#include "pfm.h"
+
+class ImageWriter {
+public:
+    // Writes an image on a background thread as its scanlines are finished, so that encoding and
+    // writing overlap with rendering instead of following it. Scanlines can arrive in any order.
+    // A filename ending in .pfm gets linear float colors in a PFM; anything else gets a gamma
+    // encoded plain text PPM (P3), byte for byte what write_color() produces.
+    //
+    // PPM rows vary in length, so they are encoded as soon as they arrive but written in order;
+    // PFM rows have a fixed size and are written straight to their place in the file.
+    //
+    // The image may be a window of a larger one, starting at scanline first_row and column
+    // first_column; scanlines are then handed over by their number in the larger image.
+    ImageWriter(const std::string& filename, int width, int height, int first_row = 0, int first_column = 0)
+    : filename(filename), width(width), height(height), row_offset(first_row), column_offset(first_column),
+      received(height, false) {
+        pfm = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0;
+
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            spdlog::error("Could not open '{}' for writing: {}", filename, std::strerror(errno));
+            return;
+        }
+
+        std::string header = pfm
+            ? fmt::format("PF\n{} {}\n{}\n", width, height, host_is_little_endian() ? "-1.0" : "1.0")
+            : fmt::format("P3\n{} {}\n255\n", width, height);
+        header_size = header.size();
+        buffer = std::move(header);
+        worker = std::thread([this] { run(); });
+    }
+
+    ~ImageWriter() { finish(); }
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    void add_row(int j, const Color* pixels) {
+        // Hands over the final colors of scanline j. Safe to call from any thread.
+        std::vector<Color> row(pixels, pixels + width);
+        j -= row_offset;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fd < 0 || received[j]) {
+                return;
+            }
+            received[j] = true;
+            queue.emplace_back(j, std::move(row));
+        }
+        wake.notify_one();
+    }
+
+    void add_row(int j, const Framebuffer& framebuffer) {
+        std::vector<Color> row(width);
+        for (int i = 0; i < width; i++) {
+            row[i] = framebuffer.pixel_color(framebuffer.index(column_offset + i, j));
+        }
+        add_row(j, row.data());
+    }
+
+    void add_missing_rows(const Framebuffer& framebuffer) {
+        // Hands over every scanline that hasn't been yet.
+        for (int j = 0; j < height; j++) {
+            bool missing;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                missing = !received[j];
+            }
+            if (missing) {
+                add_row(row_offset + j, framebuffer);
+            }
+        }
+    }
+
+    bool finish() {
+        // Waits for every scanline handed over to be written and closes the file. Returns whether
+        // the whole image was written.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishing = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        if (fd >= 0) {
+            if (::close(fd) != 0) {
+                failed = true;
+            }
+            fd = -1;
+            if (failed || rows_written < height) {
+                spdlog::error("Could not write '{}' ({} of {} scanlines written)", filename, rows_written, height);
+                return false;
+            }
+        }
+        return !failed && rows_written == height;
+    }
+
+private:
+    std::string filename;
+    int width;
+    int height;
+    int row_offset;
+    int column_offset;
+    bool pfm = false;
+    int fd = -1;
+    size_t header_size = 0;
+
+    std::mutex mutex; // Guards received, queue and finishing
+    std::condition_variable wake;
+    std::vector<bool> received;
+    std::deque<std::pair<int, std::vector<Color>>> queue;
+    bool finishing = false;
+    std::thread worker;
+
+    // Owned by the background thread.
+    std::string buffer; // PPM text waiting to be written
+    std::map<int, std::string> encoded; // PPM rows that arrived ahead of the next one to write
+    int next_row = 0;
+    int rows_written = 0;
+    bool failed = false;
+
+    static constexpr size_t flush_size = size_t(4) << 20;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return finishing || !queue.empty(); });
+            if (queue.empty() && finishing) {
+                break;
+            }
+            std::pair<int, std::vector<Color>> row = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            if (pfm) {
+                write_pfm_row(row.first, row.second);
+            } else {
+                encoded[row.first] = encode_ppm_row(row.second);
+                for (auto next = encoded.find(next_row); next != encoded.end(); next = encoded.find(next_row)) {
+                    buffer += next->second;
+                    encoded.erase(next);
+                    next_row++;
+                    rows_written++;
+                }
+                if (buffer.size() >= flush_size) {
+                    flush();
+                }
+            }
+
+            lock.lock();
+        }
+        lock.unlock();
+
+        if (pfm && rows_written == height) {
+            write_all(buffer.data(), buffer.size(), 0);
+        } else if (!pfm) {
+            flush();
+        }
+    }
+
+    static std::string encode_ppm_row(const std::vector<Color>& row) {
+        // The same text as write_color(), from a table of the 256 possible components rather than
+        // through a stream.
+        static const std::vector<std::string> components = [] {
+            std::vector<std::string> table;
+            for (int value = 0; value < 256; value++) {
+                table.push_back(std::to_string(value));
+            }
+            return table;
+        }();
+
+        std::string text;
+        text.reserve(row.size() * 12);
+        unsigned char bytes[3];
+        for (const Color& pixel : row) {
+            gamma_bytes(pixel, bytes);
+            text += components[bytes[0]];
+            text += ' ';
+            text += components[bytes[1]];
+            text += ' ';
+            text += components[bytes[2]];
+            text += '\n';
+        }
+        return text;
+    }
+
+    void write_pfm_row(int j, const std::vector<Color>& row) {
+        // PFM stores scanlines bottom to top. The header goes in last, once every row is there.
+        std::vector<float> data(row.size() * 3);
+        for (size_t i = 0; i < row.size(); i++) {
+            data[(i * 3) + 0] = float(row[i].x());
+            data[(i * 3) + 1] = float(row[i].y());
+            data[(i * 3) + 2] = float(row[i].z());
+        }
+        size_t row_bytes = data.size() * sizeof(float);
+        off_t offset = off_t(header_size + (size_t(height - 1 - j) * row_bytes));
+        if (write_all(reinterpret_cast<const char*>(data.data()), row_bytes, offset)) {
+            rows_written++;
+        }
+    }
+
+    void flush() {
+        // Appends the buffered PPM text to the file.
+        if (!buffer.empty()) {
+            write_all(buffer.data(), buffer.size(), -1);
+            buffer.clear();
+        }
+    }
+
+    bool write_all(const char* data, size_t size, off_t offset) {
+        // Writes size bytes at offset, or at the end of what was written so far if offset is -1.
+        while (size > 0 && !failed) {
+            ssize_t written = offset < 0 ? ::write(fd, data, size) : ::pwrite(fd, data, size, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                spdlog::error("Could not write to '{}': {}", filename, std::strerror(errno));
+                failed = true;
+                break;
+            }
+            data += written;
+            size -= size_t(written);
+            if (offset >= 0) {
+                offset += written;
+            }
+        }
+        return !failed;
+    }
+};
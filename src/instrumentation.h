@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "pfm.h"
+
+// Counts of the work rays do, kept per thread, for the per-pixel cost AOVs. The hierarchies count
+// every node whose bounds a ray is tested against, the primitives every intersection test, and
+// the camera every segment of a path. Counting costs a thread local increment in the innermost
+// loops, so it only happens in builds with RTW_INSTRUMENTATION defined (the CMake option of the
+// same name); elsewhere these functions do nothing and the counts stay zero.
+
+struct TraversalCounts {
+    std::uint64_t bvh_nodes = 0;
+    std::uint64_t primitives = 0;
+    std::uint64_t path_segments = 0;
+};
+
+inline TraversalCounts& traversal_counts() {
+    static thread_local TraversalCounts counts;
+    return counts;
+}
+
+inline void count_bvh_node() {
+#ifdef RTW_INSTRUMENTATION
+    traversal_counts().bvh_nodes++;
+#endif
+}
+
+inline void count_primitive() {
+#ifdef RTW_INSTRUMENTATION
+    traversal_counts().primitives++;
+#endif
+}
+
+inline void count_path_segment() {
+#ifdef RTW_INSTRUMENTATION
+    traversal_counts().path_segments++;
+#endif
+}
+
+inline void heatmap_color(double value, unsigned char bytes[3]) {
+    // Maps value in [0, 1] to black, blue, magenta, orange, yellow and white, in that order.
+    static const double stops[6][3] = {
+        {0, 0, 0}, {0.1, 0.1, 0.7}, {0.7, 0.1, 0.6}, {1, 0.5, 0.1}, {1, 0.9, 0.2}, {1, 1, 1},
+    };
+    double position = std::clamp(value, 0.0, 1.0) * 5;
+    int stop = std::min(int(position), 4);
+    double blend = position - stop;
+    for (int c = 0; c < 3; c++) {
+        double component = (stops[stop][c] * (1 - blend)) + (stops[stop + 1][c] * blend);
+        bytes[c] = static_cast<unsigned char>(255.999 * component);
+    }
+}
+
+inline bool write_heatmap(const std::string& pfm_filename, const std::string& heatmap_filename) {
+    // Writes a one channel PFM as a false color binary PPM, scaled so that its 99th percentile
+    // is white, which keeps a few extreme pixels from washing out the rest, and logs its mean and
+    // 99th percentile.
+    int width;
+    int height;
+    int components;
+    std::vector<float> values;
+    if (!read_pfm(pfm_filename, width, height, components, values) || components != 1) {
+        spdlog::error("Could not read '{}' for a heatmap", pfm_filename);
+        return false;
+    }
+
+    std::vector<float> sorted = values;
+    size_t percentile = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+    std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+    double scale = sorted[percentile] > 0 ? 1.0 / sorted[percentile] : 0;
+    double sum = 0;
+    for (float value : values) {
+        sum += value;
+    }
+
+    std::ofstream file(heatmap_filename, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> row(size_t(width) * 3);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            heatmap_color(values[(size_t(j) * width) + i] * scale, &row[size_t(i) * 3]);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), std::streamsize(row.size()));
+    }
+    if (!file) {
+        spdlog::error("Could not write '{}'", heatmap_filename);
+        return false;
+    }
+    spdlog::info("Wrote heatmap {} (mean {:.4g}, 99th percentile {:.4g} per sample)", heatmap_filename,
+                 sum / double(values.size()), sorted[percentile]);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hitrecord.h"
+#include "material.h"
+#include "ray.h"
+#include "sampler.h"
+#include "solid_color_texture.h"
+#include "texture.h"
+#include "texture_program.h"
+#include "vec3.h"
+
+class Isotropic : public Material {
+public:
+    // The phase function of a medium that scatters light equally in every direction.
+    Isotropic(const Color& albedo) : Isotropic(std::make_shared<SolidColorTexture>(albedo)) {}
+
+    Isotropic(std::shared_ptr<Texture> tex)
+    : Material(MaterialKind::Isotropic, MATERIAL_SCATTERS | MATERIAL_DIFFUSE), tex(tex), texture(tex) {}
+
+    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
+        scattered = Ray(rec.p, sample_unit_vector(sampler.get_2d()), r_in.time());
+        attenuation = texture.value(rec.u, rec.v, rec.p);
+        return true;
+    }
+
+    double scattering_pdf(const Ray& r_in, const HitRecord& rec, const Ray& scattered) const override {
+        return 1 / (4 * pi);
+    }
+
+private:
+    std::shared_ptr<Texture> tex;
+    TextureProgram texture; // tex, compiled
+};
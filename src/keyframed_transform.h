@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "hitrecord.h"
+#include "hittable.h"
+#include "interval.h"
+#include "ray.h"
+#include "vec3.h"
+
+// An object's placement at one frame of an animation: a rotation about the Y axis followed by a
+// translation.
+struct Keyframe {
+    double frame;
+    Vec3 translation;
+    double rotation_y = 0; // Degrees
+};
+
+class KeyframedTransform : public Hittable {
+public:
+    // Places an object according to keyframes, linearly interpolated between them and held at the
+    // first and last keyframe outside their range. The placement only changes through
+    // set_frame(), between renders.
+    KeyframedTransform(std::shared_ptr<Hittable> object, std::vector<Keyframe> keyframes)
+    : object(object), keyframes(std::move(keyframes)) {
+        std::sort(this->keyframes.begin(), this->keyframes.end(),
+                  [](const Keyframe& a, const Keyframe& b) { return a.frame < b.frame; });
+        if (this->keyframes.empty()) {
+            this->keyframes.push_back({0, Vec3(0, 0, 0), 0});
+        }
+        place(this->keyframes.front().translation, this->keyframes.front().rotation_y);
+    }
+
+    bool set_frame(double frame) {
+        // Moves the object to where it is at `frame`. Returns whether it moved.
+        Vec3 new_translation;
+        double new_rotation;
+        interpolate(frame, new_translation, new_rotation);
+
+        bool moved = new_rotation != rotation_y || new_translation[0] != translation[0]
+                  || new_translation[1] != translation[1] || new_translation[2] != translation[2];
+        if (moved) {
+            place(new_translation, new_rotation);
+        }
+        return moved;
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        if (!object->hit(to_object_space(r), ray_t, rec)) {
+            return false;
+        }
+
+        rec.p = rotate(rec.p) + translation;
+        rec.normal = rotate(rec.normal);
+        return true;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+private:
+    std::shared_ptr<Hittable> object;
+    std::vector<Keyframe> keyframes;
+    Vec3 translation;
+    double rotation_y = 0;
+    double sin_theta = 0;
+    double cos_theta = 1;
+    AABB bbox;
+
+    void interpolate(double frame, Vec3& new_translation, double& new_rotation) const {
+        auto next = std::upper_bound(keyframes.begin(), keyframes.end(), frame,
+                                     [](double f, const Keyframe& k) { return f < k.frame; });
+        if (next == keyframes.begin()) {
+            new_translation = keyframes.front().translation;
+            new_rotation = keyframes.front().rotation_y;
+            return;
+        }
+        if (next == keyframes.end()) {
+            new_translation = keyframes.back().translation;
+            new_rotation = keyframes.back().rotation_y;
+            return;
+        }
+
+        const Keyframe& a = *(next - 1);
+        const Keyframe& b = *next;
+        double t = (frame - a.frame) / (b.frame - a.frame);
+        new_translation = ((1 - t) * a.translation) + (t * b.translation);
+        new_rotation = ((1 - t) * a.rotation_y) + (t * b.rotation_y);
+    }
+
+    void place(const Vec3& new_translation, double new_rotation) {
+        translation = new_translation;
+        rotation_y = new_rotation;
+        double radians = degrees_to_radians(rotation_y);
+        sin_theta = std::sin(radians);
+        cos_theta = std::cos(radians);
+
+        // Bound the rotated corners of the object's box, then move that box into place.
+        AABB object_bbox = object->bounding_box();
+        Point3 min(infinity, infinity, infinity);
+        Point3 max(-infinity, -infinity, -infinity);
+        for (int i = 0; i < 8; i++) {
+            Point3 corner((i & 1) ? object_bbox.x.max : object_bbox.x.min,
+                          (i & 2) ? object_bbox.y.max : object_bbox.y.min,
+                          (i & 4) ? object_bbox.z.max : object_bbox.z.min);
+            Vec3 rotated = rotate(corner);
+            for (int c = 0; c < 3; c++) {
+                min[c] = std::fmin(min[c], rotated[c]);
+                max[c] = std::fmax(max[c], rotated[c]);
+            }
+        }
+        bbox = AABB(min, max) + translation;
+    }
+
+    Vec3 rotate(const Vec3& v) const {
+        // Object space to world space.
+        return Vec3((cos_theta * v.x()) + (sin_theta * v.z()), v.y(), (-sin_theta * v.x()) + (cos_theta * v.z()));
+    }
+
+    Ray to_object_space(const Ray& r) const {
+        Vec3 origin = r.origin() - translation;
+        Vec3 direction = r.direction();
+        return Ray(
+            Point3((cos_theta * origin.x()) - (sin_theta * origin.z()), origin.y(), (sin_theta * origin.x()) + (cos_theta * origin.z())),
+            Vec3((cos_theta * direction.x()) - (sin_theta * direction.z()), direction.y(), (sin_theta * direction.x()) + (cos_theta * direction.z())),
+            r.time());
+    }
+};
@@ -7,17 +7,20 @@
 #include "material.h"
 #include "solid_color_texture.h"
 #include "texture.h"
+#include "texture_program.h"
 #include "ray.h"
+#include "sampler.h"
 #include "vec3.h"
 
 class Lambertian : public Material {
 public:
-    Lambertian(const Color& albedo) : tex(std::make_shared<SolidColorTexture>(albedo)) {}
+    Lambertian(const Color& albedo) : Lambertian(std::make_shared<SolidColorTexture>(albedo)) {}
 
-    Lambertian(std::shared_ptr<Texture> tex) : tex(tex) {}
+    Lambertian(std::shared_ptr<Texture> tex)
+    : Material(MaterialKind::Lambertian, MATERIAL_SCATTERS | MATERIAL_DIFFUSE), tex(tex), texture(tex) {}
 
-    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
-        Vec3 scatter_direction = rec.normal + random_unit_vector();
+    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
+        Vec3 scatter_direction = rec.normal + sample_unit_vector(sampler.get_2d());
 
         // Catch degenerate scatter direction
         if (scatter_direction.near_zero()) {
@@ -25,10 +28,17 @@ public:
         }
 
         scattered = Ray(rec.p, scatter_direction, r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        attenuation = texture.value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    double scattering_pdf(const Ray& r_in, const HitRecord& rec, const Ray& scattered) const override {
+        // scatter() picks cosine weighted directions.
+        double cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+        return cos_theta < 0 ? 0 : cos_theta / pi;
+    }
+
 private:
     std::shared_ptr<Texture> tex;
+    TextureProgram texture; // tex, compiled
 };
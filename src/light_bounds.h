@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "color.h"
+#include "vec3.h"
+
+inline double luminance(const Color& c) {
+    return (0.2126 * c.x()) + (0.7152 * c.y()) + (0.0722 * c.z());
+}
+
+inline double safe_sqrt(double x) {
+    return std::sqrt(std::fmax(0.0, x));
+}
+
+inline double safe_acos(double x) {
+    return std::acos(std::clamp(x, -1.0, 1.0));
+}
+
+class LightBounds {
+public:
+    // A conservative summary of one or more emitters, used to estimate how much light they could
+    // send towards a point without looking at the emitters themselves. The surface normals all lie
+    // within theta_o of the axis w, and each surface point emits within theta_e of its normal.
+    AABB bounds = AABB::empty;
+    Vec3 w = Vec3(0, 0, 1); // Axis of the cone of surface normals
+    double phi = 0; // Total emitted power (luminance)
+    double cos_theta_o = 1; // Spread of the surface normals around w
+    double cos_theta_e = 0; // Spread of the emission around each normal; pi/2 for diffuse emitters
+    bool two_sided = false; // Whether the surfaces also emit from their backs
+
+    LightBounds() {}
+
+    LightBounds(const AABB& bounds, const Vec3& w, double phi, double cos_theta_o, double cos_theta_e, bool two_sided)
+    : bounds(bounds), w(unit_vector(w)), phi(phi), cos_theta_o(cos_theta_o), cos_theta_e(cos_theta_e),
+      two_sided(two_sided) {}
+
+    LightBounds(const LightBounds& a, const LightBounds& b) {
+        // The bounds enclosing both a and b.
+        if (a.phi == 0) {
+            *this = b;
+            return;
+        }
+        if (b.phi == 0) {
+            *this = a;
+            return;
+        }
+
+        bounds = AABB(a.bounds, b.bounds);
+        phi = a.phi + b.phi;
+        cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+        two_sided = a.two_sided || b.two_sided;
+        union_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, w, cos_theta_o);
+    }
+
+    Point3 centroid() const {
+        return Point3((bounds.x.min + bounds.x.max) / 2, (bounds.y.min + bounds.y.max) / 2, (bounds.z.min + bounds.z.max) / 2);
+    }
+
+    double importance(const Point3& p, const Vec3& n) const {
+        // An estimate of the light these emitters send to p, on a surface with normal n (or a zero
+        // normal for a point in a medium). It bounds the angles involved so that it is only ever
+        // zero when none of the emitters can possibly light p.
+        Point3 pc = centroid();
+        Vec3 diagonal(bounds.x.size(), bounds.y.size(), bounds.z.size());
+        double d2 = std::max((p - pc).length_squared(), diagonal.length() / 2);
+
+        // Angle between the normal axis and the direction from the bounds to p.
+        Vec3 wi = unit_vector(p - pc);
+        double cos_theta_w = dot(w, wi);
+        if (two_sided) {
+            cos_theta_w = std::fabs(cos_theta_w);
+        }
+        double sin_theta_w = safe_sqrt(1 - (cos_theta_w * cos_theta_w));
+
+        // Angle subtended by the bounds as seen from p.
+        double cos_theta_b = cos_subtended(p);
+        double sin_theta_b = safe_sqrt(1 - (cos_theta_b * cos_theta_b));
+
+        // The smallest possible angle between a surface normal and the direction to p, then
+        // between an emission direction and the direction to p.
+        double sin_theta_o = safe_sqrt(1 - (cos_theta_o * cos_theta_o));
+        double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= cos_theta_e) {
+            return 0;
+        }
+
+        double importance = phi * cos_theta_p / d2;
+
+        if (n.length_squared() > 0) {
+            // The smallest possible incident angle at p.
+            double cos_theta_i = std::fabs(dot(wi, n));
+            double sin_theta_i = safe_sqrt(1 - (cos_theta_i * cos_theta_i));
+            importance *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+
+        return std::max(importance, 0.0);
+    }
+
+    double orientation_measure() const {
+        // The solid angle measure of all the directions light can leave in, used to compare the
+        // cost of splits when building a light hierarchy.
+        double theta_o = safe_acos(cos_theta_o);
+        double theta_w = std::min(theta_o + safe_acos(cos_theta_e), pi);
+        double sin_theta_o = safe_sqrt(1 - (cos_theta_o * cos_theta_o));
+        return (2 * pi * (1 - cos_theta_o))
+             + ((pi / 2) * ((2 * theta_w * sin_theta_o) - std::cos(theta_o - (2 * theta_w))
+                            - (2 * theta_o * sin_theta_o) + cos_theta_o));
+    }
+
+private:
+    double cos_subtended(const Point3& p) const {
+        // Cosine of the half angle of the cone from p that contains the bounds' bounding sphere,
+        // or -1 if p is inside it.
+        Point3 pc = centroid();
+        Vec3 diagonal(bounds.x.size(), bounds.y.size(), bounds.z.size());
+        double radius2 = diagonal.length_squared() / 4;
+        double d2 = (p - pc).length_squared();
+        if (d2 < radius2) {
+            return -1;
+        }
+        return safe_sqrt(1 - (radius2 / d2));
+    }
+
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // cos(max(0, a - b))
+        if (cos_a > cos_b) {
+            return 1;
+        }
+        return (cos_a * cos_b) + (sin_a * sin_b);
+    }
+
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // sin(max(0, a - b))
+        if (cos_a > cos_b) {
+            return 0;
+        }
+        return (sin_a * cos_b) - (cos_a * sin_b);
+    }
+
+    static void union_cones(const Vec3& wa, double cos_a, const Vec3& wb, double cos_b, Vec3& w, double& cos_theta) {
+        // The smallest cone (by half angle) containing the cones around wa and wb.
+        double theta_a = safe_acos(cos_a);
+        double theta_b = safe_acos(cos_b);
+        double theta_d = safe_acos(dot(wa, wb));
+
+        if (std::min(theta_d + theta_b, pi) <= theta_a) {
+            w = wa;
+            cos_theta = cos_a;
+            return;
+        }
+        if (std::min(theta_d + theta_a, pi) <= theta_b) {
+            w = wb;
+            cos_theta = cos_b;
+            return;
+        }
+
+        double theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vec3 axis = cross(wa, wb);
+        if (theta_o >= pi || axis.length_squared() == 0) {
+            w = wa;
+            cos_theta = -1;
+            return;
+        }
+
+        // Rotate wa towards wb by theta_o - theta_a (Rodrigues' formula; axis is perpendicular to
+        // wa).
+        double theta_r = theta_o - theta_a;
+        Vec3 k = unit_vector(axis);
+        w = unit_vector((std::cos(theta_r) * wa) + (std::sin(theta_r) * cross(k, wa)));
+        cos_theta = std::cos(theta_o);
+    }
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_bounds.h"
+#include "vec3.h"
+
+enum class LightSampling {
+    None, // Lights are only found by scattered rays
+    Uniform, // Every light is equally likely
+    Bvh, // Lights are picked by their estimated contribution, through a light hierarchy
+};
+
+inline bool parse_light_sampling(const std::string& name, LightSampling& sampling) {
+    if (name == "none") {
+        sampling = LightSampling::None;
+    } else if (name == "uniform") {
+        sampling = LightSampling::Uniform;
+    } else if (name == "bvh") {
+        sampling = LightSampling::Bvh;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* light_sampling_name(LightSampling sampling) {
+    switch (sampling) {
+        case LightSampling::Uniform: return "uniform";
+        case LightSampling::Bvh: return "bvh";
+        default: return "none";
+    }
+}
+
+// A light picked for a shading point, with the probability of having picked it.
+struct SampledLight {
+    const Hittable* light;
+    double pmf;
+};
+
+class LightSampler {
+public:
+    // Picks which emitter to send a shadow ray towards. With LightSampling::Bvh the emitters are
+    // organized in a bounding volume hierarchy whose nodes store the total power and the cone of
+    // emission directions of everything below them. Sampling walks down from the root, choosing
+    // each child in proportion to an estimate of how much light it sends to the shading point, so
+    // a pick costs O(log n) however many lights there are and rarely lands on a light that can't
+    // contribute.
+    LightSampler(const HittableList& lights, LightSampling strategy) : strategy(strategy) {
+        std::vector<BuildLight> build_lights;
+        for (const std::shared_ptr<Hittable>& object : lights.objects) {
+            LightBounds bounds;
+            if (!object->light_bounds(bounds)) {
+                spdlog::warn("Ignoring a light that doesn't emit or can't be sampled");
+                continue;
+            }
+            light_index[object->id] = this->lights.size();
+            build_lights.push_back({this->lights.size(), bounds});
+            this->lights.push_back(object);
+        }
+
+        bit_trails.assign(this->lights.size(), 0);
+        if (strategy == LightSampling::Bvh && !build_lights.empty()) {
+            build(build_lights, 0, build_lights.size(), 0, 0);
+        }
+    }
+
+    LightSampling sampling_strategy() const { return strategy; }
+    size_t light_count() const { return lights.size(); }
+
+    bool sample(const Point3& p, const Vec3& n, double u, SampledLight& sampled) const {
+        // Picks a light for the point p with surface normal n using the uniform sample u. Returns
+        // false if there is no light that could illuminate p.
+        if (lights.empty()) {
+            return false;
+        }
+
+        if (strategy != LightSampling::Bvh) {
+            size_t index = std::min(size_t(u * lights.size()), lights.size() - 1);
+            sampled = {lights[index].get(), 1.0 / lights.size()};
+            return true;
+        }
+
+        size_t node_index = 0;
+        double pmf = 1;
+        while (!nodes[node_index].leaf) {
+            const Node& node = nodes[node_index];
+            double importance0 = nodes[node_index + 1].bounds.importance(p, n);
+            double importance1 = nodes[node.second].bounds.importance(p, n);
+            if (importance0 == 0 && importance1 == 0) {
+                return false;
+            }
+
+            // Pick a child and stretch u back over [0, 1) for the levels below.
+            double p0 = importance0 / (importance0 + importance1);
+            if (u < p0) {
+                node_index = node_index + 1;
+                pmf *= p0;
+                u = std::min(u / p0, one_minus_epsilon);
+            } else {
+                node_index = node.second;
+                pmf *= 1 - p0;
+                u = std::min((u - p0) / (1 - p0), one_minus_epsilon);
+            }
+        }
+
+        const Node& leaf = nodes[node_index];
+        if (node_index == 0 && leaf.bounds.importance(p, n) == 0) {
+            return false;
+        }
+        sampled = {lights[leaf.second].get(), pmf};
+        return true;
+    }
+
+    double pmf(const Point3& p, const Vec3& n, int light_id) const {
+        // The probability that sample() picks the light with Hittable id light_id for the point p
+        // with surface normal n, or zero if it isn't one of the sampled lights.
+        auto found = light_index.find(light_id);
+        if (found == light_index.end()) {
+            return 0;
+        }
+        if (strategy != LightSampling::Bvh) {
+            return 1.0 / lights.size();
+        }
+
+        // Follow the light's path down from the root, multiplying in the probability of each turn
+        // that sample() would have taken.
+        std::uint64_t trail = bit_trails[found->second];
+        size_t node_index = 0;
+        double pmf = 1;
+        while (!nodes[node_index].leaf) {
+            const Node& node = nodes[node_index];
+            double importance0 = nodes[node_index + 1].bounds.importance(p, n);
+            double importance1 = nodes[node.second].bounds.importance(p, n);
+            if (importance0 == 0 && importance1 == 0) {
+                return 0;
+            }
+
+            bool second = trail & 1;
+            pmf *= (second ? importance1 : importance0) / (importance0 + importance1);
+            node_index = second ? node.second : node_index + 1;
+            trail >>= 1;
+        }
+
+        if (node_index == 0 && nodes[0].bounds.importance(p, n) == 0) {
+            return 0;
+        }
+        return pmf;
+    }
+
+    double pdf(const Point3& p, const Vec3& n, int light_id, const Vec3& direction, double time) const {
+        // The solid angle density of sampling `direction` from p through this light sampler, for
+        // the light with Hittable id light_id.
+        double light_pmf = pmf(p, n, light_id);
+        if (light_pmf == 0) {
+            return 0;
+        }
+        return light_pmf * lights[light_index.find(light_id)->second]->pdf_value(p, direction, time);
+    }
+
+private:
+    struct Node {
+        LightBounds bounds;
+        size_t second = 0; // Second child of an interior node (the first follows it), or a leaf's light
+        bool leaf = false;
+    };
+
+    struct BuildLight {
+        size_t index;
+        LightBounds bounds;
+    };
+
+    LightSampling strategy;
+    std::vector<std::shared_ptr<Hittable>> lights;
+    std::unordered_map<int, size_t> light_index; // Hittable id to index in lights
+    std::vector<Node> nodes; // Depth first
+    std::vector<std::uint64_t> bit_trails; // Per light, the turns from the root to its leaf (1 = second child)
+
+    size_t build(std::vector<BuildLight>& build_lights, size_t start, size_t end, std::uint64_t bit_trail, int depth) {
+        // Builds the subtree over build_lights[start, end), splitting where the surface area
+        // orientation heuristic (power times bounds area times emission solid angle, summed over
+        // both halves) is lowest. Returns the index of the subtree's root.
+        size_t node_index = nodes.size();
+        nodes.emplace_back();
+
+        if (end - start == 1) {
+            nodes[node_index].bounds = build_lights[start].bounds;
+            nodes[node_index].second = build_lights[start].index;
+            nodes[node_index].leaf = true;
+            bit_trails[build_lights[start].index] = bit_trail;
+            return node_index;
+        }
+
+        AABB bounds = AABB::empty;
+        AABB centroid_bounds = AABB::empty;
+        for (size_t i = start; i < end; i++) {
+            Point3 pc = build_lights[i].bounds.centroid();
+            bounds = AABB(bounds, build_lights[i].bounds.bounds);
+            centroid_bounds = AABB(centroid_bounds, AABB(pc, pc));
+        }
+
+        const int bucket_count = 12;
+        double min_cost = infinity;
+        int min_cost_bucket = -1;
+        int min_cost_axis = -1;
+        double max_extent = std::max({bounds.x.size(), bounds.y.size(), bounds.z.size()});
+
+        // Past depth 32 lights are split evenly, which bounds the depth (and the bit trails)
+        // however unbalanced the cheapest splits are.
+        for (int axis = 0; axis < 3 && depth < 32; axis++) {
+            const Interval& centroid_range = centroid_bounds.axis_interval(axis);
+            if (centroid_range.max == centroid_range.min) {
+                continue;
+            }
+
+            LightBounds buckets[bucket_count];
+            size_t counts[bucket_count] = {};
+            for (size_t i = start; i < end; i++) {
+                int b = bucket(build_lights[i].bounds, centroid_range, axis, bucket_count);
+                buckets[b] = LightBounds(buckets[b], build_lights[i].bounds);
+                counts[b]++;
+            }
+
+            // Costs of splitting after each bucket, from running unions in both directions.
+            double costs[bucket_count - 1];
+            LightBounds below;
+            for (int b = 0; b < bucket_count - 1; b++) {
+                below = LightBounds(below, buckets[b]);
+                costs[b] = split_cost(below, max_extent, axis);
+            }
+            LightBounds above;
+            for (int b = bucket_count - 1; b > 0; b--) {
+                above = LightBounds(above, buckets[b]);
+                costs[b - 1] += split_cost(above, max_extent, axis);
+            }
+
+            size_t count_below = 0;
+            for (int b = 0; b < bucket_count - 1; b++) {
+                count_below += counts[b];
+                bool splits = count_below > 0 && count_below < end - start;
+                if (splits && costs[b] < min_cost) {
+                    min_cost = costs[b];
+                    min_cost_bucket = b;
+                    min_cost_axis = axis;
+                }
+            }
+        }
+
+        size_t mid;
+        if (min_cost_axis == -1) {
+            // Every light has the same centroid, or the tree is already deep; just halve them.
+            mid = (start + end) / 2;
+        } else {
+            const Interval& centroid_range = centroid_bounds.axis_interval(min_cost_axis);
+            auto split = std::partition(build_lights.begin() + start, build_lights.begin() + end,
+                                        [&](const BuildLight& light) {
+                                            return bucket(light.bounds, centroid_range, min_cost_axis, bucket_count) <= min_cost_bucket;
+                                        });
+            mid = split - build_lights.begin();
+            if (mid == start || mid == end) {
+                mid = (start + end) / 2;
+            }
+        }
+
+        size_t first = build(build_lights, start, mid, bit_trail, depth + 1);
+        size_t second = build(build_lights, mid, end, bit_trail | (std::uint64_t(1) << depth), depth + 1);
+        nodes[node_index].bounds = LightBounds(nodes[first].bounds, nodes[second].bounds);
+        nodes[node_index].second = second;
+        return node_index;
+    }
+
+    static int bucket(const LightBounds& bounds, const Interval& centroid_range, int axis, int bucket_count) {
+        double offset = (bounds.centroid()[axis] - centroid_range.min) / centroid_range.size();
+        return std::clamp(int(offset * bucket_count), 0, bucket_count - 1);
+    }
+
+    static double split_cost(const LightBounds& bounds, double max_extent, int axis) {
+        // Power times orientation measure times surface area, scaled up for thin boxes split
+        // along their short side.
+        const AABB& box = bounds.bounds;
+        double dx = box.x.size();
+        double dy = box.y.size();
+        double dz = box.z.size();
+        double area = 2 * ((dx * dy) + (dx * dz) + (dy * dz));
+        double extent = box.axis_interval(axis).size();
+        double regularization = extent > 0 ? max_extent / extent : 1;
+        return bounds.phi * bounds.orientation_measure() * area * regularization;
+    }
+};
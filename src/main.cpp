@@ -1,324 +1,301 @@
-#include <fstream>
-#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include "rtweekend.h"
 
-#include "bvh.h"
+#include "animation.h"
+#include "bvh_build_report.h"
 #include "camera.h"
-#include "checker_texture.h"
-#include "dielectric.h"
-#include "diffuse_light.h"
-#include "hittable.h"
-#include "hittable_list.h"
-#include "image_texture.h"
-#include "lambertian.h"
-#include "material.h"
-#include "metal.h"
-#include "noise_texture.h"
-#include "quad.h"
-#include "rotate_y.h"
-#include "sphere.h"
-#include "texture.h"
-#include "translate.h"
-#include "vec3.h"
-
-void bouncing_spheres() {
-    HittableList world;
-
-    // --- Three Sphere Render
-    //std::shared_ptr<Material> material_ground = std::make_shared<Lambertian>(Color(0.8, 0.8, 0.0));
-    //std::shared_ptr<Material> material_center = std::make_shared<Lambertian>(Color(0.1, 0.2, 0.5));
-    //std::shared_ptr<Material> material_left = std::make_shared<Dielectric>(1.5);
-    //std::shared_ptr<Material> material_bubble = std::make_shared<Dielectric>(1.0 / 1.5);
-    //std::shared_ptr<Material> material_right = std::make_shared<Metal>(Color(0.8, 0.6, 0.2), 0.01);
-    //
-    //world.add(std::make_shared<Sphere>(Point3(0.0, -100.5, -1), 100.0, material_ground));
-    //world.add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1.2), 0.5, material_center));
-    //world.add(std::make_shared<Sphere>(Point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    //world.add(std::make_shared<Sphere>(Point3(-1.0, 0.0, -1.0), 0.4, material_bubble));
-    //world.add(std::make_shared<Sphere>(Point3(1.0, 0.0, -1.0), 0.5, material_right));
-
-    // --- Simple Render
-    //double R = std::cos(pi/4);
-    //
-    //std::shared_ptr<Material> material_left = std::make_shared<Lambertian>(Color(0, 0, 1));
-    //std::shared_ptr<Material> material_right = std::make_shared<Lambertian>(Color(1, 0, 0));
-    //
-    //world.add(std::make_shared<Sphere>(Point3(-R, 0, -1), R, material_left));
-    //world.add(std::make_shared<Sphere>(Point3(R, 0, -1), R, material_right));
-
-    // --- Final Render
-    //std::shared_ptr<Material> ground_material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
-    //world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground_material));
-
-    // --- Checker Render
-    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            double choose_mat = random_double();
-            Point3 center(a + (0.9 * random_double()), 0.2, b + (0.9 * random_double()));
-
-            if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<Material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    Color albedo = Color::random() * Color::random();
-                    Point3 center2 = center + Vec3(0, random_double(0, 0.5), 0);
-                    sphere_material = std::make_shared<Lambertian>(albedo);
-                    world.add(std::make_shared<Sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    Color albedo = Color::random(0.5, 1);
-                    double fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<Metal>(albedo, fuzz);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = std::make_shared<Dielectric>(1.5);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
+#include "convergence_report.h"
+#include "distributed.h"
+#include "fast_math_report.h"
+#include "framebuffer.h"
+#include "light_sampler.h"
+#include "numa_report.h"
+#include "ray_sorting_report.h"
+#include "render_job_report.h"
+#include "sampler.h"
+#include "scenes.h"
+
+int main(int argc, char* argv[]) {
+    // Parse Command Arguments
+    int scene_id = 7;
+    int image_width = 0; // Zero keeps the scene's own setting
+    int samples_per_pixel = 0;
+    unsigned aovs = AOV_NONE;
+    DistributedSettings distributed;
+    distributed.address = fmt::format("unix:/tmp/raytracinginaweekend-{}.sock", ::getpid());
+    std::string worker_address; // Set when running as a worker for a remote coordinator
+    bool listen_for_workers = false;
+    int scaling_report_workers = 0;
+    int threads = 0;
+    int samples_per_pass = 0;
+    std::uint64_t seed = 0;
+    std::string checkpoint_filename;
+    double checkpoint_interval = 0;
+    bool resume = false;
+    SamplerType sampler_type = SamplerType::Independent;
+    bool convergence_report = false;
+    LightSampling light_sampling = LightSampling::Bvh;
+    int batch_size = 0;
+    bool sort_rays = true;
+    bool ray_sorting_report_requested = false;
+    size_t bvh_build_report_primitives = 0;
+    bool fast_math_report_requested = false;
+    int render_job_report_jobs = 0;
+    int numa_report_nodes = -1; // Nodes to split the machine into for the NUMA report, or 0 for its own
+    bool pin_threads = false;
+    bool numa_replicate = false;
+    double framebuffer_mb = 0;
+    PixelRect crop_window;
+    std::string environment_filename;
+    double environment_scale = 1;
+    bool filtered_environment = false;
+    int first_frame = -1; // Frame range to render for animated scenes, if set
+    int last_frame = -1;
+    bool incremental = false;
+    std::string preview_target;
+    double preview_interval = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+
+        if (option == "--scene" && has_value) {
+            scene_id = std::atoi(argv[++arg]);
+        } else if (option == "--width" && has_value) {
+            image_width = std::atoi(argv[++arg]);
+        } else if (option == "--spp" && has_value) {
+            samples_per_pixel = std::atoi(argv[++arg]);
+        } else if (option == "--aovs" && has_value) {
+            if (!parse_aov_flags(argv[++arg], aovs)) {
+                return 1;
+            }
+        } else if (option == "--threads" && has_value) {
+            threads = std::atoi(argv[++arg]);
+        } else if (option == "--samples-per-pass" && has_value) {
+            samples_per_pass = std::atoi(argv[++arg]);
+        } else if (option == "--seed" && has_value) {
+            seed = std::strtoull(argv[++arg], nullptr, 10);
+        } else if (option == "--checkpoint" && has_value) {
+            checkpoint_filename = argv[++arg];
+        } else if (option == "--checkpoint-interval" && has_value) {
+            checkpoint_interval = std::atof(argv[++arg]);
+        } else if (option == "--resume") {
+            resume = true;
+        } else if (option == "--sampler" && has_value) {
+            if (!parse_sampler_type(argv[++arg], sampler_type)) {
+                spdlog::error("Unknown sampler '{}', expected independent, stratified, halton or sobol", argv[arg]);
+                return 1;
+            }
+        } else if (option == "--light-sampling" && has_value) {
+            if (!parse_light_sampling(argv[++arg], light_sampling)) {
+                spdlog::error("Unknown light sampling '{}', expected none, uniform or bvh", argv[arg]);
+                return 1;
+            }
+        } else if (option == "--batch-size" && has_value) {
+            batch_size = std::atoi(argv[++arg]);
+        } else if (option == "--no-ray-sorting") {
+            sort_rays = false;
+        } else if (option == "--ray-sorting-report") {
+            ray_sorting_report_requested = true;
+        } else if (option == "--bvh-build-report" && has_value) {
+            bvh_build_report_primitives = std::strtoull(argv[++arg], nullptr, 10);
+        } else if (option == "--fast-math-report") {
+            fast_math_report_requested = true;
+        } else if (option == "--render-job-report" && has_value) {
+            render_job_report_jobs = std::atoi(argv[++arg]);
+        } else if (option == "--numa-report" && has_value) {
+            numa_report_nodes = std::atoi(argv[++arg]);
+        } else if (option == "--pin-threads") {
+            pin_threads = true;
+        } else if (option == "--numa-replicate") {
+            numa_replicate = true;
+        } else if (option == "--framebuffer-mb" && has_value) {
+            framebuffer_mb = std::atof(argv[++arg]);
+        } else if (option == "--environment" && has_value) {
+            environment_filename = argv[++arg];
+        } else if (option == "--environment-scale" && has_value) {
+            environment_scale = std::atof(argv[++arg]);
+        } else if (option == "--filtered-environment") {
+            filtered_environment = true;
+        } else if (option == "--crop" && has_value) {
+            PixelRect& crop = crop_window;
+            if (std::sscanf(argv[++arg], "%d,%d,%d,%d", &crop.x0, &crop.y0, &crop.x1, &crop.y1) != 4 || crop.empty()) {
+                spdlog::error("--crop expects X0,Y0,X1,Y1, got '{}'", argv[arg]);
+                return 1;
+            }
+        } else if (option == "--incremental") {
+            incremental = true;
+        } else if (option == "--frames" && has_value) {
+            if (std::sscanf(argv[++arg], "%d:%d", &first_frame, &last_frame) != 2 || first_frame < 0 || last_frame < first_frame) {
+                spdlog::error("--frames expects FIRST:LAST, got '{}'", argv[arg]);
+                return 1;
             }
+        } else if (option == "--preview" && has_value) {
+            preview_target = argv[++arg];
+        } else if (option == "--preview-interval" && has_value) {
+            preview_interval = std::atof(argv[++arg]);
+        } else if (option == "--convergence-report") {
+            convergence_report = true;
+        } else if (option == "--workers" && has_value) {
+            distributed.local_workers = std::atoi(argv[++arg]);
+        } else if (option == "--listen" && has_value) {
+            distributed.address = argv[++arg];
+            listen_for_workers = true;
+        } else if (option == "--connect" && has_value) {
+            worker_address = argv[++arg];
+        } else if (option == "--tile-size" && has_value) {
+            distributed.tile_size = std::atoi(argv[++arg]);
+        } else if (option == "--tile-timeout" && has_value) {
+            distributed.tile_timeout = std::atof(argv[++arg]);
+        } else if (option == "--scaling-report" && has_value) {
+            scaling_report_workers = std::atoi(argv[++arg]);
+        } else {
+            spdlog::error("Unknown or incomplete argument '{}'", option);
+            return 1;
         }
     }
 
-    std::shared_ptr<Material> material1 = std::make_shared<Dielectric>(1.5);
-    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-    std::shared_ptr<Material> material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-    std::shared_ptr<Material> material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-    world = HittableList(std::make_shared<BvhNode>(world));
-
-    // Camera
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    //cam.image_width = 19200;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = Point3(13, 2, 3);
-    cam.lookat = Point3(0, 0, 0);
-    cam.vup = Vec3(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_distance = 10.0;
-
-    cam.render(world);
-}
-
-void checkered_spheres() {
-    HittableList world;
-
-    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-
-    world.add(std::make_shared<Sphere>(Point3(0, -10, 0), 10, std::make_shared<Lambertian>(checker)));
-    world.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
-
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = Point3(13, 2, 3);
-    cam.lookat = Point3(0, 0, 0);
-    cam.vup = Vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void earth() {
-    std::shared_ptr<Texture> earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
-    std::shared_ptr<Material> earth_surface = std::make_shared<Lambertian>(earth_texture);
-    std::shared_ptr<Sphere> globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
-
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = Point3(0, 0, 12);
-    cam.lookat = Point3(0, 0, 0);
-    cam.vup = Vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(HittableList(globe));
-}
-
-void perlin_spheres() {
-    HittableList world;
-
-    std::shared_ptr<Texture> pertext = std::make_shared<NoiseTexture>(4);
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = Point3(13, 2, 3);
-    cam.lookat = Point3(0, 0, 0);
-    cam.vup = Vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void quads() {
-    HittableList world;
-
-    // Materials
-    std::shared_ptr<Material> left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
-    std::shared_ptr<Material> back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
-    std::shared_ptr<Material> right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
-    std::shared_ptr<Material> upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
-    std::shared_ptr<Material> lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(std::make_shared<Quad>(Point3(-3,-2, 5), Vec3(0, 0,-4), Vec3(0, 4, 0), left_red));
-    world.add(std::make_shared<Quad>(Point3(-2,-2, 0), Vec3(4, 0, 0), Vec3(0, 4, 0), back_green));
-    world.add(std::make_shared<Quad>(Point3( 3,-2, 1), Vec3(0, 0, 4), Vec3(0, 4, 0), right_blue));
-    world.add(std::make_shared<Quad>(Point3(-2, 3, 1), Vec3(4, 0, 0), Vec3(0, 0, 4), upper_orange));
-    world.add(std::make_shared<Quad>(Point3(-2,-3, 5), Vec3(4, 0, 0), Vec3(0, 0,-4), lower_teal));
-
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.70, 0.80, 1.00);
-
-    cam.vfov = 80;
-    cam.lookfrom = Point3(0,0,9);
-    cam.lookat = Point3(0,0,0);
-    cam.vup = Vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void simple_light() {
-    HittableList world;
-
-    std::shared_ptr<NoiseTexture> pertext = std::make_shared<NoiseTexture>(4);
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    std::shared_ptr<DiffuseLight> difflight = std::make_shared<DiffuseLight>(Color(4, 4, 4));
-    world.add(std::make_shared<Sphere>(Point3(0, 7, 0), 2, difflight));
-    world.add(std::make_shared<Quad>(Point3(3, 1, -2), Vec3(2, 0, 0), Vec3(0, 2, 0), difflight));
-
-    Camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = Point3(26, 3, 6);
-    cam.lookat = Point3(0, 2, 0);
-    cam.vup = Vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
+    // Setup Logging
+    if (preview_target == "-") {
+        // stdout carries the preview images.
+        spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+    }
+    spdlog::set_level(spdlog::level::debug);
 
-void cornell_box() {
-    HittableList world;
+    if (bvh_build_report_primitives > 0) {
+        bvh_build_report(bvh_build_report_primitives);
+        return 0;
+    }
 
-    std::shared_ptr<Lambertian> red = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
-    std::shared_ptr<Lambertian> white = std::make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
-    std::shared_ptr<Lambertian> green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
-    std::shared_ptr<DiffuseLight> light = std::make_shared<DiffuseLight>(Color(15, 15, 15));
+    if (fast_math_report_requested) {
+        fast_math_report();
+        return 0;
+    }
 
-    world.add(std::make_shared<Quad>(Point3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), green));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
-    world.add(std::make_shared<Quad>(Point3(343, 554, 332), Vec3(-130, 0, 0), Vec3(0, 0, -105), light));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white));
-    world.add(std::make_shared<Quad>(Point3(555, 555, 555), Vec3(-555, 0, 0), Vec3(0, 0, -555), white));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white));
+    // Build the scene
+    Scene scene;
+    if (!build_scene(scene_id, scene)) {
+        spdlog::error("Unknown scene {}", scene_id);
+        return 1;
+    }
 
-    //world.add(box(Point3(130, 0, 65), Point3(295, 165, 230), white));
-    //world.add(box(Point3(265, 9, 295), Point3(430, 330, 460), white));
+    if (image_width > 0) {
+        scene.cam.image_width = image_width;
+    }
+    if (samples_per_pixel > 0) {
+        scene.cam.samples_per_pixel = samples_per_pixel;
+    }
+    if (samples_per_pass > 0) {
+        scene.cam.samples_per_pass = samples_per_pass;
+    }
+    if (checkpoint_interval > 0) {
+        scene.cam.checkpoint_interval = checkpoint_interval;
+    }
+    scene.cam.aovs = aovs;
+    scene.cam.threads = threads;
+    scene.cam.seed = seed;
+    scene.cam.sampler_type = sampler_type;
+    scene.cam.checkpoint_filename = checkpoint_filename;
+    scene.cam.resume = resume;
+    scene.cam.preview_target = preview_target;
+    if (preview_interval > 0) {
+        scene.cam.preview_interval = preview_interval;
+    }
+    if (light_sampling != LightSampling::None && !scene.lights.objects.empty()) {
+        scene.cam.lights = std::make_shared<LightSampler>(scene.lights, light_sampling);
+    }
+    if (!environment_filename.empty()) {
+        scene.cam.environment = std::make_shared<EnvironmentLight>(environment_filename.c_str(), environment_scale);
+    }
+    scene.cam.sample_environment = light_sampling != LightSampling::None;
+    scene.cam.filtered_environment = filtered_environment;
+    scene.cam.batch_size = batch_size;
+    scene.cam.sort_rays = sort_rays;
+    scene.cam.pin_threads = pin_threads;
+    scene.cam.framebuffer_budget = size_t(framebuffer_mb * (1 << 20));
+    scene.cam.crop_window = crop_window;
+
+    if (batch_size > 0 && (aovs & AOV_COSTS)) {
+        spdlog::warn("The cost AOVs need each sample's own work, so samples are traced one at a time, not in batches");
+    }
+    if (resume && checkpoint_filename.empty()) {
+        spdlog::error("--resume needs a --checkpoint file to resume from");
+        return 1;
+    }
+    if (!scene.cam.window_in_frame()) {
+        return 1;
+    }
 
-    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
-    world.add(box1);
+    // Run the tracer
+    if (!worker_address.empty()) {
+        return run_render_worker(worker_address, scene.cam, scene.world);
+    }
 
-    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
-    world.add(box2);
+    if (convergence_report) {
+        sampler_convergence_report(scene.cam, scene.world, 16);
+        return 0;
+    }
 
-    Camera cam;
+    if (ray_sorting_report_requested) {
+        ray_sorting_report(scene.cam, scene.world, batch_size > 0 ? batch_size : 4096);
+        return 0;
+    }
 
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 256;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0, 0, 0);
+    if (render_job_report_jobs > 0) {
+        render_job_report(scene.cam, std::make_shared<HittableList>(scene.world), render_job_report_jobs);
+        return 0;
+    }
 
-    cam.vfov = 40;
-    cam.lookfrom = Point3(278, 278, -800);
-    cam.lookat = Point3(278, 278, 0);
-    cam.vup = Vec3(0, 1, 0);
+    if (numa_report_nodes >= 0) {
+        numa_report(scene_id, scene.cam, light_sampling, environment_filename, environment_scale, numa_report_nodes);
+        return 0;
+    }
 
-    cam.defocus_angle = 0;
+    if (!crop_window.empty() && (distributed.local_workers > 0 || listen_for_workers || scaling_report_workers > 0)) {
+        spdlog::error("--crop is not supported by distributed renders");
+        return 1;
+    }
 
-    cam.render(world);
-}
+    if (scaling_report_workers > 0) {
+        distributed_scaling_report(scene.cam, scene.world, distributed, scaling_report_workers);
+        return 0;
+    }
 
-int main(void) {
-    // Parse Command Arguments
+    if (distributed.local_workers > 0 || listen_for_workers) {
+        if (aovs != AOV_NONE) {
+            spdlog::warn("AOVs are not recorded by distributed renders");
+        }
+        std::vector<Color> image;
+        if (!render_distributed(scene.cam, scene.world, distributed, image)) {
+            return 1;
+        }
+        scene.cam.write_image(image);
+        return 0;
+    }
 
-    // Setup Logging
-    spdlog::set_level(spdlog::level::debug);
+    if (first_frame >= 0) {
+        if (!scene.animation) {
+            spdlog::error("Scene {} isn't animated", scene_id);
+            return 1;
+        }
+        scene.animation->first_frame = first_frame;
+        scene.animation->last_frame = last_frame;
+        scene.animation->incremental = incremental;
+        return scene.animation->render(scene.cam, scene.world) ? 0 : 1;
+    }
 
-    // Run the tracer
-    switch (7) {
-        case 1: bouncing_spheres(); break;
-        case 2: checkered_spheres(); break;
-        case 3: earth(); break;
-        case 4: perlin_spheres(); break;
-        case 5: quads(); break;
-        case 6: simple_light(); break;
-        case 7: cornell_box(); break;
+    if (numa_replicate) {
+        return numa_render(scene_id, scene.cam, light_sampling, environment_filename, environment_scale) ? 0 : 1;
     }
 
-    return 0;
+    return scene.cam.render(scene.world) ? 0 : 1;
 }
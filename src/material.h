@@ -1,18 +1,54 @@
 #pragma once
 
+#include <atomic>
+
 #include "color.h"
 #include "hitrecord.h"
 #include "ray.h"
+#include "sampler.h"
+
+// What shading needs to know about a material without calling it, as bits of Material::flags.
+enum MaterialFlags : unsigned {
+    MATERIAL_EMITS = 1 << 0, // emitted() may return light
+    MATERIAL_SCATTERS = 1 << 1, // scatter() may continue the path
+    MATERIAL_DIFFUSE = 1 << 2, // scattering_pdf() may be nonzero, so the material samples lights
+};
+
+// The concrete class of a material, so that shading can call it directly rather than through its
+// vtable (see material_dispatch.h). Materials defined elsewhere are Other.
+enum class MaterialKind { Other, Lambertian, Metal, Dielectric, DiffuseLight, Isotropic };
 
 class Material {
 public:
+    int id = next_id(); // Unique id, used for the material id AOV
+    MaterialKind kind = MaterialKind::Other;
+    unsigned flags = MATERIAL_EMITS | MATERIAL_SCATTERS | MATERIAL_DIFFUSE; // MaterialFlags; all set unless known
+
+    Material() {}
+
+    Material(MaterialKind kind, unsigned flags) : kind(kind), flags(flags) {}
+
     virtual ~Material() = default;
 
     virtual Color emitted(double u, double v, const Point3& p) const {
         return Color(0, 0, 0);
     }
 
-    virtual bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered) const {
+    virtual bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const {
         return false;
     }
+
+    virtual double scattering_pdf(const Ray& r_in, const HitRecord& rec, const Ray& scattered) const {
+        // The density with which scatter() picks the direction of `scattered`. Together with the
+        // attenuation it gives the material's response to light arriving from any direction, which
+        // is what light sampling needs. Materials that scatter into a single direction (mirrors,
+        // glass) return zero and are never sampled towards lights.
+        return 0;
+    }
+
+private:
+    static int next_id() {
+        static std::atomic<int> counter{0};
+        return counter++;
+    }
 };
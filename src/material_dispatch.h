@@ -0,0 +1,64 @@
+#pragma once
+
+#include "color.h"
+#include "dielectric.h"
+#include "diffuse_light.h"
+#include "hitrecord.h"
+#include "isotropic.h"
+#include "lambertian.h"
+#include "material.h"
+#include "metal.h"
+#include "ray.h"
+#include "sampler.h"
+#include "vec3.h"
+
+// The calls shading makes on every hit, without going through the material's vtable: the flags
+// skip calls whose answer is known (black for materials that don't emit, no light sampling for
+// mirrors and glass), and the kind picks the concrete class's function, which the compiler can
+// then inline. Materials of kind Other are called through their vtable as before. Each gives the
+// same result as the virtual call it replaces.
+
+inline Color material_emitted(const Material& mat, double u, double v, const Point3& p) {
+    if (!(mat.flags & MATERIAL_EMITS)) {
+        return Color(0, 0, 0);
+    }
+    switch (mat.kind) {
+    case MaterialKind::DiffuseLight:
+        return static_cast<const DiffuseLight&>(mat).DiffuseLight::emitted(u, v, p);
+    default:
+        return mat.emitted(u, v, p);
+    }
+}
+
+inline bool material_scatter(const Material& mat, const Ray& r_in, const HitRecord& rec, Color& attenuation,
+                             Ray& scattered, Sampler& sampler) {
+    if (!(mat.flags & MATERIAL_SCATTERS)) {
+        return false;
+    }
+    switch (mat.kind) {
+    case MaterialKind::Lambertian:
+        return static_cast<const Lambertian&>(mat).Lambertian::scatter(r_in, rec, attenuation, scattered, sampler);
+    case MaterialKind::Metal:
+        return static_cast<const Metal&>(mat).Metal::scatter(r_in, rec, attenuation, scattered, sampler);
+    case MaterialKind::Dielectric:
+        return static_cast<const Dielectric&>(mat).Dielectric::scatter(r_in, rec, attenuation, scattered, sampler);
+    case MaterialKind::Isotropic:
+        return static_cast<const Isotropic&>(mat).Isotropic::scatter(r_in, rec, attenuation, scattered, sampler);
+    default:
+        return mat.scatter(r_in, rec, attenuation, scattered, sampler);
+    }
+}
+
+inline double material_scattering_pdf(const Material& mat, const Ray& r_in, const HitRecord& rec, const Ray& scattered) {
+    if (!(mat.flags & MATERIAL_DIFFUSE)) {
+        return 0;
+    }
+    switch (mat.kind) {
+    case MaterialKind::Lambertian:
+        return static_cast<const Lambertian&>(mat).Lambertian::scattering_pdf(r_in, rec, scattered);
+    case MaterialKind::Isotropic:
+        return static_cast<const Isotropic&>(mat).Isotropic::scattering_pdf(r_in, rec, scattered);
+    default:
+        return mat.scattering_pdf(r_in, rec, scattered);
+    }
+}
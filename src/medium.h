@@ -0,0 +1,19 @@
+#pragma once
+
+#include "interval.h"
+#include "vec3.h"
+
+class Medium {
+public:
+    // A participating medium: something that absorbs and scatters light throughout a volume
+    // rather than at a surface. Its density is the extinction coefficient, the chance per unit
+    // distance that light traveling through it interacts with it.
+    virtual ~Medium() = default;
+
+    virtual double density(const Point3& p) const = 0;
+
+    // Samples where light traveling from origin + segment.min * direction (a unit vector) first
+    // interacts with the medium, by delta tracking. Returns false if it gets to segment.max
+    // first, which happens with probability equal to the transmittance of the segment.
+    virtual bool sample_collision(const Point3& origin, const Vec3& direction, Interval segment, double& distance) const = 0;
+};
@@ -4,15 +4,17 @@
 #include "hitrecord.h"
 #include "material.h"
 #include "ray.h"
+#include "sampler.h"
 #include "vec3.h"
 
 class Metal : public Material {
 public:
-    Metal(const Color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1)  {}
+    Metal(const Color& albedo, double fuzz)
+    : Material(MaterialKind::Metal, MATERIAL_SCATTERS), albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
-    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
+    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
         Vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+        reflected = unit_vector(reflected) + (fuzz * sample_unit_vector(sampler.get_2d()));
         scattered = Ray(rec.p, reflected, r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Morton (Z-order) codes interleave the bits of quantized coordinates, so that points close in
+// space mostly get close codes and sorting by code groups them.
+
+inline std::uint32_t expand_bits_3d(std::uint32_t v) {
+    // Spreads the low 10 bits of v apart, leaving two zero bits after each.
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+inline std::uint32_t morton_code_3d(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    // The 30 bit code of a point on a 1024^3 grid, x's bits most significant of each triple.
+    return (expand_bits_3d(x) << 2) | (expand_bits_3d(y) << 1) | expand_bits_3d(z);
+}
+
+inline std::uint64_t expand_bits_3d_63(std::uint64_t v) {
+    // Spreads the low 21 bits of v apart, leaving two zero bits after each.
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+inline std::uint64_t morton_code_3d_63(std::uint64_t x, std::uint64_t y, std::uint64_t z) {
+    // The 63 bit code of a point on a 2097152^3 grid, for when 1024 cells an axis put too many
+    // points in the same cell.
+    return (expand_bits_3d_63(x) << 2) | (expand_bits_3d_63(y) << 1) | expand_bits_3d_63(z);
+}
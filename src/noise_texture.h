@@ -1,6 +1,7 @@
 #pragma once
 
 #include "color.h"
+#include "fast_math.h"
 #include "perlin.h"
 #include "texture.h"
 #include "vec3.h"
@@ -14,7 +15,7 @@ public:
     Color value(double u, double v, const Point3& p) const override {
         //return Color(1, 1, 1) * 0.5 * (1.0 + noise.noise(scale * p));
         //return Color(1, 1, 1) * noise.turb(p, 7);
-        return Color(0.5, 0.5, 0.5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
+        return Color(0.5, 0.5, 0.5) * (1 + shading_sin(scale * p.z() + 10 * noise.turb(p, 7)));
     }
 
 private:
@@ -0,0 +1,201 @@
+#pragma once
+
+// NUMA topology and placement, from Linux's sysfs and system calls rather than libnuma. Memory
+// is placed the way Linux places it by default: on the node of the thread that first touches it.
+// So data built by a thread pinned to a node lives on that node, and replicating read-only data
+// per node is a matter of building a copy on a thread pinned to each.
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    // The CPUs in a sysfs list such as "0-3,8-11".
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        int first;
+        int last;
+        int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields == 1) {
+            last = first;
+        } else if (fields != 2) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+class NumaTopology {
+public:
+    std::vector<int> node_ids; // The system's number for each node
+    std::vector<std::vector<int>> node_cpus; // The CPUs of each node with any
+
+    static NumaTopology detect() {
+        // The nodes this process may run on, from /sys/devices/system/node. Machines without
+        // that (or without NUMA) get a single node of every CPU the process may use.
+        NumaTopology topology;
+        std::vector<int> allowed = allowed_cpus();
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        if (online && std::getline(online, nodes)) {
+            for (int node : parse_cpu_list(nodes)) {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string list;
+                std::vector<int> cpus;
+                if (file && std::getline(file, list)) {
+                    for (int cpu : parse_cpu_list(list)) {
+                        if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                            cpus.push_back(cpu);
+                        }
+                    }
+                }
+                if (!cpus.empty()) {
+                    topology.node_ids.push_back(node);
+                    topology.node_cpus.push_back(cpus);
+                }
+            }
+        }
+        if (topology.node_cpus.empty()) {
+            topology.node_ids.push_back(0);
+            topology.node_cpus.push_back(allowed);
+        }
+        return topology;
+    }
+
+    static const NumaTopology& system() {
+        static NumaTopology topology = detect();
+        return topology;
+    }
+
+    NumaTopology split(int nodes) const {
+        // The same CPUs dealt out round robin into the given number of nodes, to emulate a NUMA
+        // machine on one that isn't (or has fewer nodes). With fewer CPUs than nodes, nodes share
+        // CPUs.
+        std::vector<int> cpus;
+        for (const std::vector<int>& node : node_cpus) {
+            cpus.insert(cpus.end(), node.begin(), node.end());
+        }
+        NumaTopology topology;
+        topology.node_cpus.resize(size_t(std::max(nodes, 1)));
+        for (size_t node = 0; node < topology.node_cpus.size(); node++) {
+            topology.node_ids.push_back(int(node));
+        }
+        for (size_t i = 0; i < std::max(cpus.size(), topology.node_cpus.size()); i++) {
+            topology.node_cpus[i % topology.node_cpus.size()].push_back(cpus[i % cpus.size()]);
+        }
+        return topology;
+    }
+
+    int nodes() const { return int(node_cpus.size()); }
+
+    int cpus() const {
+        int count = 0;
+        for (const std::vector<int>& node : node_cpus) {
+            count += int(node.size());
+        }
+        return count;
+    }
+
+    int thread_node(int thread, int threads) const {
+        // The node of render thread `thread` of `threads`, grouping the threads into contiguous
+        // runs per node, in proportion to the nodes' CPU counts.
+        int total = cpus();
+        int first = 0;
+        for (int node = 0; node < nodes(); node++) {
+            first += int(node_cpus[size_t(node)].size());
+            if (thread < (long(first) * threads + total - 1) / total) {
+                return node;
+            }
+        }
+        return nodes() - 1;
+    }
+
+    int thread_cpu(int thread, int threads) const {
+        // The CPU to pin render thread `thread` of `threads` to: one core each within its node.
+        int node = thread_node(thread, threads);
+        int first_thread = 0;
+        while (first_thread < thread && thread_node(first_thread, threads) != node) {
+            first_thread++;
+        }
+        const std::vector<int>& cpus = node_cpus[size_t(node)];
+        return cpus[size_t(thread - first_thread) % cpus.size()];
+    }
+
+private:
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        if (cpus.empty()) {
+            cpus.push_back(0);
+        }
+        return cpus;
+    }
+};
+
+inline bool pin_thread(const std::vector<int>& cpus) {
+    // Restricts the calling thread to the given CPUs. Returns whether that worked.
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+inline bool interleave_memory(const std::vector<int>& node_ids) {
+    // Spreads the pages the calling thread allocates from now on round robin over the given
+    // nodes, or puts it back to the default, first touch placement if there are none. Returns
+    // whether the kernel agreed, which it doesn't on kernels without NUMA support.
+#ifdef SYS_set_mempolicy
+    const int mpol_default = 0;
+    const int mpol_interleave = 3;
+    const int mask_bits = 8 * sizeof(unsigned long);
+    unsigned long mask[16] = {};
+    for (int node : node_ids) {
+        if (node >= 0 && node < 16 * mask_bits) {
+            mask[node / mask_bits] |= 1UL << (node % mask_bits);
+        }
+    }
+    long result = node_ids.empty() ? syscall(SYS_set_mempolicy, mpol_default, nullptr, 0)
+                                   : syscall(SYS_set_mempolicy, mpol_interleave, mask, 16 * mask_bits + 1);
+    return result == 0;
+#else
+    return false;
+#endif
+}
+
+inline void run_on_cpus(const std::vector<int>& cpus, const std::function<void()>& function) {
+    // Runs function on a thread pinned to the given CPUs, so that the memory it allocates and
+    // touches first is placed on their node, and waits for it.
+    std::thread thread([&] {
+        if (!pin_thread(cpus)) {
+            spdlog::warn("Could not pin a thread to its node's CPUs");
+        }
+        function();
+    });
+    thread.join();
+}
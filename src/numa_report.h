@@ -0,0 +1,245 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "environment_light.h"
+#include "framebuffer.h"
+#include "image_cache.h"
+#include "light_sampler.h"
+#include "numa.h"
+#include "render_job_report.h"
+#include "scenes.h"
+
+struct SceneReplica {
+    // One copy of a scene and everything its camera reads while rendering, built on one node.
+    Scene scene;
+    Camera cam;
+};
+
+inline std::unique_ptr<SceneReplica> build_scene_replica(int scene_id, const Camera& settings,
+                                                         LightSampling light_sampling,
+                                                         const std::string& environment_filename,
+                                                         double environment_scale, int partition) {
+    // Builds the scene, its hierarchy, its light sampler and its environment afresh on the calling
+    // thread, with settings' camera, so the memory they take is first touched (and placed) there.
+    // Images are loaded into their own cache partition rather than shared with other replicas.
+    ImageCachePartition images(partition);
+    auto replica = std::make_unique<SceneReplica>();
+    build_scene(scene_id, replica->scene);
+    replica->cam = settings;
+    replica->cam.lights.reset();
+    if (light_sampling != LightSampling::None && !replica->scene.lights.objects.empty()) {
+        replica->cam.lights = std::make_shared<LightSampler>(replica->scene.lights, light_sampling);
+    }
+    if (!environment_filename.empty()) {
+        replica->cam.environment = std::make_shared<EnvironmentLight>(environment_filename.c_str(), environment_scale);
+    }
+    replica->cam.start_render();
+    return replica;
+}
+
+inline size_t render_placed(const NumaTopology& topology, int threads, const std::vector<SceneReplica*>& node_replicas,
+                            bool pin, bool node_queues, Framebuffer& framebuffer) {
+    // Renders the image with `threads` threads grouped by node, each rendering its node's replica
+    // (node_replicas may hold the same one for every node). With node_queues, each node has its
+    // own band of scanlines, and its threads only take another node's once theirs have run out;
+    // otherwise all threads take scanlines from one queue. Returns how many scanlines were taken
+    // from another node's band.
+    int nodes = topology.nodes();
+    int first_row = framebuffer.first_row();
+    int height = framebuffer.image_height();
+    int queues = node_queues ? nodes : 1;
+    std::vector<int> band_end(queues, 0);
+    std::unique_ptr<std::atomic<int>[]> next_row(new std::atomic<int>[size_t(queues)]);
+    for (int queue = 0; queue < queues; queue++) {
+        next_row[queue] = first_row + (queue * height / queues);
+        band_end[size_t(queue)] = first_row + ((queue + 1) * height / queues);
+    }
+    std::atomic<size_t> steals{0};
+
+    auto render_thread = [&](int thread) {
+        int node = topology.thread_node(thread, threads);
+        if (pin && !pin_thread({topology.thread_cpu(thread, threads)})) {
+            spdlog::warn("Could not pin render thread {}", thread);
+        }
+        const SceneReplica& replica = *node_replicas[size_t(node)];
+        const Hittable& world = replica.scene.world;
+        // The node's own band first, then the others' in turn, nearest numbered first.
+        for (int offset = 0; offset < queues; offset++) {
+            int queue = node_queues ? (node + offset) % queues : 0;
+            for (int j = next_row[queue]++; j < band_end[size_t(queue)]; j = next_row[queue]++) {
+                replica.cam.render_rows(world, framebuffer, j, j + 1, replica.cam.samples_per_pixel);
+                if (offset > 0) {
+                    steals++;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int thread = 0; thread < threads; thread++) {
+        workers.emplace_back(render_thread, thread);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return steals;
+}
+
+inline bool numa_render(int scene_id, const Camera& settings, LightSampling light_sampling,
+                        const std::string& environment_filename, double environment_scale) {
+    // Renders the image the way numa_report()'s "Replicated" placement does: a copy of the scene
+    // in each node's memory, built by a thread pinned to the node, rendered by that node's pinned
+    // threads, which take scanlines from their own node's band before stealing other nodes'.
+    // The image is the same as Camera::render()'s, but in a single pass without checkpoints or
+    // previews. Returns false, having rendered nothing, if asked to resume or if the crop window
+    // lies outside the frame.
+    const NumaTopology& topology = NumaTopology::system();
+    int threads = settings.threads > 0 ? settings.threads : std::max(1, int(std::thread::hardware_concurrency()));
+    if (settings.resume) {
+        spdlog::error("Renders with replicated scenes can't be resumed; leave out --numa-replicate to resume from '{}'",
+                      settings.checkpoint_filename);
+        return false;
+    }
+    if (!settings.checkpoint_filename.empty() || !settings.preview_target.empty()) {
+        spdlog::warn("Checkpoints and previews are not available when rendering with replicated scenes");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<SceneReplica>> replicas;
+    std::vector<SceneReplica*> node_replicas;
+    for (int node = 0; node < topology.nodes(); node++) {
+        run_on_cpus(topology.node_cpus[size_t(node)], [&] {
+            replicas.push_back(build_scene_replica(scene_id, settings, light_sampling, environment_filename,
+                                                   environment_scale, node + 1));
+        });
+        node_replicas.push_back(replicas.back().get());
+    }
+    spdlog::info("Built {} cop{} of the scene, one per NUMA node, in {:.2f} s", replicas.size(),
+                 replicas.size() == 1 ? "y" : "ies",
+                 std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    Camera& cam = replicas[0]->cam;
+    std::optional<Framebuffer> framebuffer = cam.start_render();
+    if (!framebuffer) {
+        return false;
+    }
+    size_t steals = render_placed(topology, threads, node_replicas, true, true, *framebuffer);
+    spdlog::info("{} scanlines stolen from other nodes", steals);
+    cam.write_image(*framebuffer);
+    spdlog::info("Done");
+    return true;
+}
+
+inline void numa_report(int scene_id, const Camera& settings, LightSampling light_sampling,
+                        const std::string& environment_filename, double environment_scale, int nodes) {
+    // Renders the scene with its data placed four ways: on whichever node the unpinned main
+    // thread happened to build it, interleaved page by page across the nodes, all on node 0 with
+    // render threads pinned across every node, and replicated into each node's memory with each
+    // node's threads rendering their own copy and stealing scanlines from other nodes only once
+    // their own band is done. Logs the time each takes and checks the images are identical.
+    // nodes > 0 splits this machine's CPUs into that many nodes, to try the placements out on
+    // machines with fewer (memory then stays wherever the kernel puts it).
+    const NumaTopology& system = NumaTopology::system();
+    NumaTopology topology = nodes > 0 ? system.split(nodes) : system;
+    int threads = settings.threads > 0 ? settings.threads : std::max(1, int(std::thread::hardware_concurrency()));
+    spdlog::info("{} nodes ({} on this machine), {} CPUs, {} threads, {} samples per pixel", topology.nodes(),
+                 system.nodes(), topology.cpus(), threads, settings.samples_per_pixel);
+    for (int node = 0; node < topology.nodes(); node++) {
+        std::string node_threads;
+        for (int thread = 0; thread < threads; thread++) {
+            if (topology.thread_node(thread, threads) == node) {
+                node_threads += (node_threads.empty() ? "" : ",") + std::to_string(thread);
+            }
+        }
+        spdlog::info("  Node {}: {} CPUs, threads {}", topology.node_ids[size_t(node)],
+                     topology.node_cpus[size_t(node)].size(), node_threads);
+    }
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    spdlog::level::level_enum log_level = spdlog::get_level();
+    spdlog::set_level(spdlog::level::warn);
+
+    struct Placement {
+        const char* name;
+        std::vector<std::unique_ptr<SceneReplica>> replicas;
+        std::vector<SceneReplica*> node_replicas;
+        bool pin;
+        bool node_queues;
+        double build_seconds;
+    };
+    std::vector<Placement> placements;
+    int partitions = 0; // Every copy gets its own images, placed along with the rest of it
+    auto add_placement = [&](const char* name, bool pin, bool node_queues, int copies,
+                             const std::function<void(int copy, const std::function<void()>&)>& place) {
+        Placement placement{name, {}, {}, pin, node_queues, 0};
+        auto start = std::chrono::steady_clock::now();
+        for (int copy = 0; copy < copies; copy++) {
+            place(copy, [&] {
+                placement.replicas.push_back(build_scene_replica(scene_id, settings, light_sampling,
+                                                                 environment_filename, environment_scale,
+                                                                 ++partitions));
+            });
+        }
+        placement.build_seconds = seconds_since(start);
+        for (int node = 0; node < topology.nodes(); node++) {
+            placement.node_replicas.push_back(placement.replicas[size_t(node) % placement.replicas.size()].get());
+        }
+        placements.push_back(std::move(placement));
+    };
+
+    add_placement("Unpinned", false, false, 1, [](int, const std::function<void()>& build) { build(); });
+    add_placement("Interleaved", true, false, 1, [&](int, const std::function<void()>& build) {
+        std::thread thread([&] {
+            if (!interleave_memory(system.node_ids)) {
+                spdlog::warn("Could not interleave memory across nodes; it stays where it is first touched");
+            }
+            build();
+            interleave_memory({});
+        });
+        thread.join();
+    });
+    add_placement("Node 0", true, false, 1, [&](int, const std::function<void()>& build) {
+        run_on_cpus(topology.node_cpus[0], build);
+    });
+    add_placement("Replicated", true, true, topology.nodes(), [&](int copy, const std::function<void()>& build) {
+        run_on_cpus(topology.node_cpus[size_t(copy)], build);
+    });
+
+    spdlog::set_level(log_level);
+    std::unique_ptr<Framebuffer> reference;
+    double reference_seconds = 0;
+    for (Placement& placement : placements) {
+        Framebuffer framebuffer = *placement.replicas[0]->cam.start_render();
+        auto start = std::chrono::steady_clock::now();
+        size_t steals = render_placed(topology, threads, placement.node_replicas, placement.pin, placement.node_queues,
+                                      framebuffer);
+        double seconds = seconds_since(start);
+        double samples = double(framebuffer.image_width()) * framebuffer.image_height() * settings.samples_per_pixel;
+        if (!reference) {
+            reference = std::make_unique<Framebuffer>(std::move(framebuffer));
+            reference_seconds = seconds;
+            spdlog::info("{:<12} {:.2f} s, {:.3g} samples/s ({} cop{} built in {:.2f} s)", placement.name, seconds,
+                         samples / seconds, placement.replicas.size(), placement.replicas.size() == 1 ? "y" : "ies",
+                         placement.build_seconds);
+            continue;
+        }
+        spdlog::info("{:<12} {:.2f} s, {:.3g} samples/s ({:.2f}x), {} scanlines stolen ({} cop{} built in {:.2f} s), "
+                     "image {}",
+                     placement.name, seconds, samples / seconds, reference_seconds / seconds, steals,
+                     placement.replicas.size(), placement.replicas.size() == 1 ? "y" : "ies", placement.build_seconds,
+                     same_image(framebuffer, *reference) ? "identical" : "NOT identical");
+    }
+}
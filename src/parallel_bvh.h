@@ -0,0 +1,654 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instrumentation.h"
+#include "morton.h"
+#include "thread_pool.h"
+
+// How a ParallelBvh is built.
+enum class BvhBuilder {
+    BinnedSah, // Top down, splitting where the surface area heuristic is lowest; the best trees
+    Linear,    // From the objects sorted along a Morton curve (an LBVH); much faster to build
+};
+
+class ParallelBvh : public Hittable {
+public:
+    // A bounding volume hierarchy built by every thread of a thread pool, for scenes with far
+    // more objects than BvhNode's single threaded build copes with. The nodes live in one array,
+    // and leaves hold runs of objects from a second one, so tracing never chases shared_ptrs
+    // between nodes.
+    //
+    // The binned SAH builder sorts each node's objects into bins by centroid along each axis and
+    // splits between the bins where the surface area heuristic's estimate of the cost of tracing
+    // is lowest. Large nodes are binned in parallel, and each subtree above a minimum size
+    // becomes a task of its own.
+    //
+    // The linear builder (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees,
+    // and k-d Trees", 2012) radix sorts the objects by the Morton code of their centroids, then
+    // works out every interior node independently from the sorted codes, and finally fills in
+    // the bounds from the leaves up. Its trees trace more slowly, but it builds several times
+    // faster, which suits previews and scenes rebuilt every frame.
+    ParallelBvh(const HittableList& list, BvhBuilder builder = BvhBuilder::BinnedSah, int threads = 0) {
+        ThreadPool pool(threads);
+        build(list, builder, pool);
+    }
+
+    ParallelBvh(const HittableList& list, BvhBuilder builder, ThreadPool& pool) { build(list, builder, pool); }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        bool hit_anything = false;
+        std::uint32_t stack[max_stack_depth];
+        int stack_size = 0;
+        std::uint32_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (node.bbox.hit(r, ray_t)) {
+                if (node.count > 0) {
+                    for (std::uint32_t o = node.first; o < node.first + node.count; o++) {
+                        if (objects[o]->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                } else {
+                    // Visit the child on the side the ray comes from first, so that the closest
+                    // hit tends to be found early and prunes the other.
+                    bool right_first = r.is_negative(node.axis);
+                    stack[stack_size++] = right_first ? node.left : node.right;
+                    node_index = right_first ? node.right : node.left;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                break;
+            }
+            node_index = stack[--stack_size];
+        }
+        return hit_anything;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        std::uint32_t stack[max_stack_depth];
+        int stack_size = 0;
+        std::uint32_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (node.bbox.hit(r, ray_t)) {
+                if (node.count > 0) {
+                    for (std::uint32_t o = node.first; o < node.first + node.count; o++) {
+                        if (objects[o]->occluded(r, ray_t)) {
+                            return true;
+                        }
+                    }
+                } else {
+                    stack[stack_size++] = node.right;
+                    node_index = node.left;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                return false;
+            }
+            node_index = stack[--stack_size];
+        }
+    }
+
+    AABB bounding_box() const override { return nodes.empty() ? AABB::empty : nodes[0].bbox; }
+
+    bool describe_hierarchy(HierarchyDescription& description) const override {
+        description.type = "ParallelBvh";
+        description.bytes = (nodes.capacity() * sizeof(Node)) + (objects.capacity() * sizeof(objects[0]));
+        description.nodes.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const Node& node = nodes[i];
+            HierarchyDescription::Node& described = description.nodes[i];
+            described.bbox = node.bbox;
+            if (node.count > 0) {
+                described.objects.assign(objects.begin() + node.first, objects.begin() + node.first + node.count);
+            } else {
+                described.left = int(node.left);
+                described.right = int(node.right);
+            }
+        }
+        return true;
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+    int depth() const { return tree_depth; }
+
+    double sah_cost() const {
+        // The surface area heuristic's estimate of the tree's cost to trace, counting a node
+        // visit and an object test as one each: every node weighted by the chance that a ray
+        // through the root also passes through it.
+        if (nodes.empty()) {
+            return 0;
+        }
+        double root_area = surface_area(nodes[0].bbox);
+        double cost = 0;
+        for (const Node& node : nodes) {
+            cost += surface_area(node.bbox) / root_area * (node.count > 0 ? node.count : 1);
+        }
+        return cost;
+    }
+
+private:
+    struct Node {
+        AABB bbox;
+        std::uint32_t left = 0; // Children of an interior node
+        std::uint32_t right = 0;
+        std::uint32_t first = 0; // A leaf's objects, from objects[first]
+        std::uint32_t count = 0; // Zero for interior nodes
+        int axis = 0; // The axis an interior node splits along
+    };
+
+    std::vector<Node> nodes; // The root first
+    std::vector<std::shared_ptr<Hittable>> objects; // In leaf order
+    int tree_depth = 0; // Edges from the root to the deepest leaf, at most max_stack_depth
+
+    // What the builders work from: each object's bounds and centroid, by its index in the list.
+    struct BuildInput {
+        std::vector<AABB> bounds;
+        std::vector<Point3> centroids;
+    };
+
+    static const int bin_count = 16;
+    static const std::uint32_t max_leaf_size = 4;
+    static const size_t parallel_binning_size = 1 << 16; // Nodes at least this big are binned in parallel
+    static const size_t subtree_task_size = 1 << 12; // Subtrees at least this big become tasks
+    // Traversal keeps one node per level on a fixed stack. Below sah_depth_limit the SAH builder
+    // splits at the median, which takes at most 32 more levels for 2^32 objects.
+    static constexpr int max_stack_depth = 64;
+    static constexpr int sah_depth_limit = 32;
+
+    void build(const HittableList& list, BvhBuilder builder, ThreadPool& pool) {
+        size_t n = list.objects.size();
+        if (n == 0) {
+            return;
+        }
+
+        BuildInput input;
+        input.bounds.resize(n);
+        input.centroids.resize(n);
+        pool.parallel_for(n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                input.bounds[i] = list.objects[i]->bounding_box();
+                input.centroids[i] = centroid(input.bounds[i]);
+            }
+        });
+
+        std::vector<std::uint32_t> order(n);
+        for (size_t i = 0; i < n; i++) {
+            order[i] = std::uint32_t(i);
+        }
+
+        if (builder == BvhBuilder::Linear) {
+            build_linear(input, order, pool);
+            tree_depth = measure_depth();
+            if (tree_depth > max_stack_depth) {
+                // Long runs of nearly equal Morton codes can chain deeper than traversal allows.
+                spdlog::warn("The LBVH over {} objects is {} levels deep, more than the {} tracing allows; "
+                             "building it with binned SAH instead", n, tree_depth, max_stack_depth);
+                build_binned_sah(input, order, pool);
+            }
+        } else {
+            build_binned_sah(input, order, pool);
+        }
+        tree_depth = measure_depth();
+
+        objects.resize(n);
+        pool.parallel_for(n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                objects[i] = list.objects[order[i]];
+            }
+        });
+    }
+
+    // Binned SAH build
+
+    struct Bin {
+        AABB bounds = AABB::empty;
+        std::uint32_t count = 0;
+    };
+
+    using Bins = std::array<std::array<Bin, bin_count>, 3>;
+
+    void build_binned_sah(const BuildInput& input, std::vector<std::uint32_t>& order, ThreadPool& pool) {
+        nodes.resize((2 * order.size()) - 1);
+        std::atomic<std::uint32_t> next_node{1};
+        ThreadPool::TaskGroup group;
+        build_sah_node(input, order, 0, order.size(), 0, 0, next_node, pool, group);
+        pool.wait(group);
+        nodes.resize(next_node.load());
+    }
+
+    void build_sah_node(const BuildInput& input, std::vector<std::uint32_t>& order, size_t begin, size_t end,
+                        std::uint32_t node_index, int depth, std::atomic<std::uint32_t>& next_node, ThreadPool& pool,
+                        ThreadPool::TaskGroup& group) {
+        // Builds the subtree over order[begin, end) into nodes[node_index], `depth` levels below
+        // the root, reordering that span so every leaf's objects are contiguous.
+        size_t n = end - begin;
+        bool parallel = n >= parallel_binning_size;
+
+        // The node's bounds and the bounds of its objects' centroids.
+        AABB bbox = AABB::empty;
+        AABB centroid_bounds = AABB::empty;
+        auto gather_bounds = [&](size_t from, size_t to, AABB& span_bbox, AABB& span_centroids) {
+            for (size_t i = from; i < to; i++) {
+                span_bbox = AABB(span_bbox, input.bounds[order[i]]);
+                const Point3& c = input.centroids[order[i]];
+                span_centroids = AABB(span_centroids, AABB(c, c));
+            }
+        };
+        if (parallel) {
+            std::mutex merge;
+            pool.parallel_for(n, 4096, [&](size_t from, size_t to) {
+                AABB span_bbox = AABB::empty;
+                AABB span_centroids = AABB::empty;
+                gather_bounds(begin + from, begin + to, span_bbox, span_centroids);
+                std::lock_guard<std::mutex> lock(merge);
+                bbox = AABB(bbox, span_bbox);
+                centroid_bounds = AABB(centroid_bounds, span_centroids);
+            });
+        } else {
+            gather_bounds(begin, end, bbox, centroid_bounds);
+        }
+
+        Node& node = nodes[node_index];
+        node.bbox = bbox;
+        if (n == 1 || (depth >= sah_depth_limit && n <= max_leaf_size)) {
+            make_leaf(node, begin, n);
+            return;
+        }
+        if (depth >= sah_depth_limit) {
+            // The SAH may peel a few objects at a time off badly distributed ones (exponentially
+            // spaced, say), each split a level deeper, so from here on the span is halved.
+            int axis = centroid_bounds.longest_axis();
+            size_t mid = begin + (n / 2);
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                             [&](std::uint32_t a, std::uint32_t b) {
+                                 return input.centroids[a][axis] < input.centroids[b][axis];
+                             });
+            build_sah_children(input, order, begin, mid, end, node, axis, depth, next_node, pool, group);
+            return;
+        }
+
+        // Bin the centroids along all three axes.
+        Bins bins;
+        auto bin_span = [&](size_t from, size_t to, Bins& span_bins) {
+            for (size_t i = from; i < to; i++) {
+                std::uint32_t object = order[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    Bin& bin = span_bins[axis][bin_index(input.centroids[object], centroid_bounds, axis)];
+                    bin.bounds = AABB(bin.bounds, input.bounds[object]);
+                    bin.count++;
+                }
+            }
+        };
+        if (parallel) {
+            std::mutex merge;
+            pool.parallel_for(n, 4096, [&](size_t from, size_t to) {
+                Bins span_bins;
+                bin_span(begin + from, begin + to, span_bins);
+                std::lock_guard<std::mutex> lock(merge);
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < bin_count; b++) {
+                        bins[axis][b].bounds = AABB(bins[axis][b].bounds, span_bins[axis][b].bounds);
+                        bins[axis][b].count += span_bins[axis][b].count;
+                    }
+                }
+            });
+        } else {
+            bin_span(begin, end, bins);
+        }
+
+        // Find the cheapest split between bins: a sweep from the right gathers the cost of
+        // everything right of each boundary, then a sweep from the left completes it.
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_split = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroid_bounds.axis_interval(axis).size() <= 0) {
+                continue;
+            }
+            double right_costs[bin_count];
+            AABB right_bounds = AABB::empty;
+            std::uint32_t right_count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                right_bounds = AABB(right_bounds, bins[axis][b].bounds);
+                right_count += bins[axis][b].count;
+                right_costs[b] = right_count == 0 ? 0 : surface_area(right_bounds) * right_count;
+            }
+            AABB left_bounds = AABB::empty;
+            std::uint32_t left_count = 0;
+            for (int b = 1; b < bin_count; b++) {
+                left_bounds = AABB(left_bounds, bins[axis][b - 1].bounds);
+                left_count += bins[axis][b - 1].count;
+                double left_cost = left_count == 0 ? 0 : surface_area(left_bounds) * left_count;
+                double cost = left_cost + right_costs[b];
+                if (left_count > 0 && left_count < n && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        // A leaf costs a test per object; a split costs a node visit plus its children's tests,
+        // weighted by the chance of a ray reaching each.
+        double area = surface_area(bbox);
+        double split_cost = 1 + (area > 0 ? best_cost / area : 0);
+        if (n <= max_leaf_size && (best_axis < 0 || double(n) <= split_cost)) {
+            make_leaf(node, begin, n);
+            return;
+        }
+
+        size_t mid;
+        if (best_axis < 0) {
+            // Every centroid is in the same place, so no split separates them; halve the span.
+            best_axis = bbox.longest_axis();
+            mid = begin + (n / 2);
+        } else {
+            auto middle = std::partition(order.begin() + begin, order.begin() + end, [&](std::uint32_t object) {
+                return bin_index(input.centroids[object], centroid_bounds, best_axis) < best_split;
+            });
+            mid = size_t(middle - order.begin());
+        }
+        build_sah_children(input, order, begin, mid, end, node, best_axis, depth, next_node, pool, group);
+    }
+
+    void build_sah_children(const BuildInput& input, std::vector<std::uint32_t>& order, size_t begin, size_t mid,
+                            size_t end, Node& node, int axis, int depth, std::atomic<std::uint32_t>& next_node,
+                            ThreadPool& pool, ThreadPool::TaskGroup& group) {
+        // Makes node an interior node split along axis, and builds its children over
+        // order[begin, mid) and order[mid, end).
+        std::uint32_t left = next_node.fetch_add(2);
+        node.left = left;
+        node.right = left + 1;
+        node.axis = axis;
+
+        // Hand the bigger child to another thread if it's worth a task, and carry on with the other.
+        size_t left_size = mid - begin;
+        size_t right_size = end - mid;
+        if (std::max(left_size, right_size) >= subtree_task_size) {
+            bool left_bigger = left_size >= right_size;
+            size_t task_begin = left_bigger ? begin : mid;
+            size_t task_end = left_bigger ? mid : end;
+            std::uint32_t task_node = left_bigger ? left : left + 1;
+            pool.submit(group, [=, &input, &order, &next_node, &pool, &group] {
+                build_sah_node(input, order, task_begin, task_end, task_node, depth + 1, next_node, pool, group);
+            });
+            if (left_bigger) {
+                build_sah_node(input, order, mid, end, left + 1, depth + 1, next_node, pool, group);
+            } else {
+                build_sah_node(input, order, begin, mid, left, depth + 1, next_node, pool, group);
+            }
+        } else {
+            build_sah_node(input, order, begin, mid, left, depth + 1, next_node, pool, group);
+            build_sah_node(input, order, mid, end, left + 1, depth + 1, next_node, pool, group);
+        }
+    }
+
+    int measure_depth() const {
+        // The number of edges from the root to the deepest leaf.
+        int deepest = 0;
+        std::vector<std::pair<std::uint32_t, int>> pending{{0, 0}};
+        while (!pending.empty()) {
+            auto [node_index, depth] = pending.back();
+            pending.pop_back();
+            const Node& node = nodes[node_index];
+            if (node.count > 0) {
+                deepest = std::max(deepest, depth);
+            } else {
+                pending.emplace_back(node.left, depth + 1);
+                pending.emplace_back(node.right, depth + 1);
+            }
+        }
+        return deepest;
+    }
+
+    static int bin_index(const Point3& c, const AABB& centroid_bounds, int axis) {
+        const Interval& range = centroid_bounds.axis_interval(axis);
+        double size = range.size();
+        if (size <= 0) {
+            return 0;
+        }
+        int b = int((c[axis] - range.min) / size * bin_count);
+        return std::clamp(b, 0, bin_count - 1);
+    }
+
+    static void make_leaf(Node& node, size_t begin, size_t n) {
+        node.first = std::uint32_t(begin);
+        node.count = std::uint32_t(n);
+    }
+
+    // Linear (LBVH) build
+
+    void build_linear(const BuildInput& input, std::vector<std::uint32_t>& order, ThreadPool& pool) {
+        size_t n = order.size();
+        if (n == 1) {
+            nodes.resize(1);
+            nodes[0].bbox = input.bounds[0];
+            make_leaf(nodes[0], 0, 1);
+            return;
+        }
+
+        // Morton codes of the centroids, 10 bits per axis while that leaves more cells than
+        // objects several times over, 21 bits per axis beyond.
+        AABB centroid_bounds = AABB::empty;
+        std::mutex merge;
+        pool.parallel_for(n, 4096, [&](size_t begin, size_t end) {
+            AABB span = AABB::empty;
+            for (size_t i = begin; i < end; i++) {
+                span = AABB(span, AABB(input.centroids[i], input.centroids[i]));
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            centroid_bounds = AABB(centroid_bounds, span);
+        });
+
+        int code_bits = n <= (size_t(1) << 20) ? 30 : 63;
+        std::vector<std::uint64_t> codes(n);
+        pool.parallel_for(n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                codes[i] = morton_code(input.centroids[i], centroid_bounds, code_bits);
+            }
+        });
+        radix_sort(codes, order, code_bits, pool);
+
+        // Interior nodes 0 to n - 2, with the root first, then leaf k, holding the k-th object
+        // along the curve, at n - 1 + k.
+        std::uint32_t leaves = std::uint32_t(n - 1);
+        nodes.resize((2 * n) - 1);
+        std::vector<std::uint32_t> parents(nodes.size(), 0);
+        pool.parallel_for(n - 1, 1024, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                build_linear_node(codes, code_bits, std::int64_t(i), leaves, parents);
+            }
+        });
+
+        // Fill in the bounds from the leaves up: the second child to finish a node's bounds
+        // goes on to its parent's.
+        std::vector<std::atomic<std::uint32_t>> arrivals(n - 1);
+        for (std::atomic<std::uint32_t>& arrival : arrivals) {
+            arrival.store(0, std::memory_order_relaxed);
+        }
+        pool.parallel_for(n, 4096, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                Node& leaf = nodes[leaves + k];
+                make_leaf(leaf, k, 1);
+                leaf.bbox = input.bounds[order[k]];
+
+                std::uint32_t node_index = leaves + std::uint32_t(k);
+                while (node_index != 0) {
+                    std::uint32_t parent = parents[node_index];
+                    if (arrivals[parent].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                        break;
+                    }
+                    Node& node = nodes[parent];
+                    node.bbox = AABB(nodes[node.left].bbox, nodes[node.right].bbox);
+                    node_index = parent;
+                }
+            }
+        });
+    }
+
+    void build_linear_node(const std::vector<std::uint64_t>& codes, int code_bits, std::int64_t i, std::uint32_t leaves,
+                           std::vector<std::uint32_t>& parents) {
+        // Finds the span of sorted codes interior node i covers and where it splits, from the
+        // lengths of the prefixes its neighbors' codes share with its own.
+        std::int64_t n = std::int64_t(codes.size());
+        auto delta = [&](std::int64_t j) {
+            // The common prefix length of codes i and j, with the index breaking ties; -1 if j is
+            // out of range.
+            if (j < 0 || j >= n) {
+                return -1;
+            }
+            std::uint64_t difference = codes[i] ^ codes[j];
+            if (difference == 0) {
+                return 64 + leading_zeros(std::uint64_t(i ^ j));
+            }
+            return leading_zeros(difference);
+        };
+
+        // The span extends away from whichever neighbor shares less.
+        std::int64_t d = delta(i + 1) > delta(i - 1) ? 1 : -1;
+        int delta_min = delta(i - d);
+        std::int64_t l_max = 2;
+        while (delta(i + (l_max * d)) > delta_min) {
+            l_max *= 2;
+        }
+        std::int64_t l = 0;
+        for (std::int64_t t = l_max / 2; t >= 1; t /= 2) {
+            if (delta(i + ((l + t) * d)) > delta_min) {
+                l += t;
+            }
+        }
+        std::int64_t j = i + (l * d);
+
+        // The split is where the span's common prefix ends.
+        int delta_node = delta(j);
+        std::int64_t s = 0;
+        std::int64_t t = l;
+        do {
+            t = (t + 1) / 2;
+            if (delta(i + ((s + t) * d)) > delta_node) {
+                s += t;
+            }
+        } while (t > 1);
+        std::int64_t gamma = i + (s * d) + std::min<std::int64_t>(d, 0);
+
+        Node& node = nodes[size_t(i)];
+        node.left = std::min(i, j) == gamma ? leaves + std::uint32_t(gamma) : std::uint32_t(gamma);
+        node.right = std::max(i, j) == gamma + 1 ? leaves + std::uint32_t(gamma + 1) : std::uint32_t(gamma + 1);
+        node.count = 0;
+        parents[node.left] = std::uint32_t(i);
+        parents[node.right] = std::uint32_t(i);
+
+        // The first bit that differs across the span says which axis it splits. The codes are
+        // right aligned, with x, y and z interleaved from the top of each triple.
+        int split_bit = 63 - delta_node;
+        node.axis = delta_node < 64 && split_bit < code_bits ? 2 - (split_bit % 3) : 0;
+    }
+
+    static std::uint64_t morton_code(const Point3& c, const AABB& bounds, int code_bits) {
+        int bits = code_bits / 3;
+        double cells = double(std::uint64_t(1) << bits);
+        std::uint64_t cell[3];
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& range = bounds.axis_interval(axis);
+            double offset = range.size() > 0 ? (c[axis] - range.min) / range.size() : 0;
+            cell[axis] = std::uint64_t(std::clamp(offset * cells, 0.0, cells - 1));
+        }
+        if (bits == 10) {
+            return morton_code_3d(std::uint32_t(cell[0]), std::uint32_t(cell[1]), std::uint32_t(cell[2]));
+        }
+        return morton_code_3d_63(cell[0], cell[1], cell[2]);
+    }
+
+    static void radix_sort(std::vector<std::uint64_t>& keys, std::vector<std::uint32_t>& values, int key_bits,
+                           ThreadPool& pool) {
+        // Least significant digit first, a byte at a time. Each chunk of the keys counts its own
+        // digits, so every chunk can scatter its keys to their places in parallel.
+        size_t n = keys.size();
+        const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(size_t(pool.size()) * 4, n / 4096));
+        std::vector<std::uint64_t> scratch_keys(n);
+        std::vector<std::uint32_t> scratch_values(n);
+        std::vector<std::array<size_t, 256>> offsets(chunk_count);
+        auto chunk_begin = [&](size_t c) { return (n * c) / chunk_count; };
+
+        for (int shift = 0; shift < key_bits; shift += 8) {
+            pool.parallel_for(chunk_count, 1, [&](size_t first_chunk, size_t last_chunk) {
+                for (size_t c = first_chunk; c < last_chunk; c++) {
+                    offsets[c].fill(0);
+                    for (size_t i = chunk_begin(c); i < chunk_begin(c + 1); i++) {
+                        offsets[c][(keys[i] >> shift) & 0xff]++;
+                    }
+                }
+            });
+
+            // Each digit's keys go after all smaller digits', chunk by chunk.
+            size_t total = 0;
+            bool one_digit = false;
+            for (int digit = 0; digit < 256; digit++) {
+                size_t digit_start = total;
+                for (size_t c = 0; c < chunk_count; c++) {
+                    size_t count = offsets[c][digit];
+                    offsets[c][digit] = total;
+                    total += count;
+                }
+                one_digit = one_digit || total - digit_start == n;
+            }
+            if (one_digit) {
+                continue;
+            }
+
+            pool.parallel_for(chunk_count, 1, [&](size_t first_chunk, size_t last_chunk) {
+                for (size_t c = first_chunk; c < last_chunk; c++) {
+                    for (size_t i = chunk_begin(c); i < chunk_begin(c + 1); i++) {
+                        size_t destination = offsets[c][(keys[i] >> shift) & 0xff]++;
+                        scratch_keys[destination] = keys[i];
+                        scratch_values[destination] = values[i];
+                    }
+                }
+            });
+            keys.swap(scratch_keys);
+            values.swap(scratch_values);
+        }
+    }
+
+    static int leading_zeros(std::uint64_t v) { return v == 0 ? 64 : __builtin_clzll(v); }
+
+    static Point3 centroid(const AABB& box) {
+        return Point3((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+    }
+
+    static double surface_area(const AABB& box) {
+        double dx = box.x.size();
+        double dy = box.y.size();
+        double dz = box.z.size();
+        return 2 * ((dx * dy) + (dx * dz) + (dy * dz));
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class PerfCounters {
+public:
+    // Counts hardware events (instructions, cache misses, ...) over this process's threads,
+    // including threads started while counting, between start() and stop(). Uses Linux's
+    // perf_event_open; events the kernel or machine won't count, as in many virtual machines and
+    // containers or with kernel.perf_event_paranoid set high, are left unavailable.
+    PerfCounters() {
+        add("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        add("cache_references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+        add("cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        add("l1d_read_misses", PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    }
+
+    ~PerfCounters() {
+        for (const Event& event : events) {
+            if (event.fd >= 0) {
+                ::close(event.fd);
+            }
+        }
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void start() {
+        for (Event& event : events) {
+            event.value = 0;
+            if (event.fd >= 0) {
+                ::ioctl(event.fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(event.fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() {
+        // Child threads' counts are folded into the parent's as they exit, so stop once the
+        // threads being measured have been joined.
+        for (Event& event : events) {
+            if (event.fd >= 0) {
+                ::ioctl(event.fd, PERF_EVENT_IOC_DISABLE, 0);
+                std::uint64_t value = 0;
+                if (::read(event.fd, &value, sizeof(value)) == ssize_t(sizeof(value))) {
+                    event.value = value;
+                }
+            }
+        }
+    }
+
+    bool available(const std::string& name) const {
+        const Event* event = find(name);
+        return event != nullptr && event->fd >= 0;
+    }
+
+    bool any_available() const {
+        for (const Event& event : events) {
+            if (event.fd >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double value(const std::string& name) const {
+        // The count between the last start() and stop(), or zero if unavailable.
+        const Event* event = find(name);
+        return event == nullptr ? 0 : double(event->value);
+    }
+
+private:
+    struct Event {
+        std::string name;
+        int fd;
+        std::uint64_t value;
+    };
+
+    std::vector<Event> events;
+
+    void add(const char* name, std::uint32_t type, std::uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = int(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        events.push_back(Event{name, fd, 0});
+    }
+
+    const Event* find(const std::string& name) const {
+        for (const Event& event : events) {
+            if (event.name == name) {
+                return &event;
+            }
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+inline bool host_is_little_endian() {
+    const std::uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    return first_byte == 1;
+}
+
+inline bool write_pfm(const std::string& filename, int width, int height, int components, const float* data) {
+    // Writes a Portable Float Map. `data` holds `components` (1 or 3) floats per pixel, stored top
+    // scanline first; PFM stores scanlines bottom to top, so rows are flipped on the way out. The
+    // scale line is negative for little-endian data and positive for big-endian data.
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        spdlog::error("Could not open '{}' for writing", filename);
+        return false;
+    }
+
+    file << (components == 1 ? "Pf" : "PF") << "\n" << width << " " << height << "\n"
+         << (host_is_little_endian() ? "-1.0" : "1.0") << "\n";
+
+    size_t row_floats = size_t(width) * components;
+    for (int j = height - 1; j >= 0; j--) {
+        file.write(reinterpret_cast<const char*>(data + (j * row_floats)), row_floats * sizeof(float));
+    }
+
+    return bool(file);
+}
+
+class PfmRowWriter {
+public:
+    // Writes a Portable Float Map a scanline at a time, each straight to its place in the file,
+    // so the image never has to be held in memory. Rows may be written in any order and from
+    // any thread. The header goes in last, once every row is there, so an unfinished image
+    // doesn't pass for a finished one.
+    PfmRowWriter(const std::string& filename, int width, int height, int components)
+    : filename(filename), width(width), height(height), components(components) {
+        header = std::string(components == 1 ? "Pf" : "PF") + "\n" + std::to_string(width) + " "
+               + std::to_string(height) + "\n" + (host_is_little_endian() ? "-1.0" : "1.0") + "\n";
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            spdlog::error("Could not open '{}' for writing: {}", filename, std::strerror(errno));
+        }
+    }
+
+    ~PfmRowWriter() { finish(); }
+
+    PfmRowWriter(const PfmRowWriter&) = delete;
+    PfmRowWriter& operator=(const PfmRowWriter&) = delete;
+
+    void write_row(int j, const float* row) {
+        // Writes scanline j's `components` floats per pixel.
+        size_t row_bytes = size_t(width) * components * sizeof(float);
+        off_t offset = off_t(header.size() + (size_t(height - 1 - j) * row_bytes));
+        if (fd >= 0 && write_all(reinterpret_cast<const char*>(row), row_bytes, offset)) {
+            rows_written++;
+        }
+    }
+
+    bool finish() {
+        // Writes the header and closes the file. Returns whether the whole image was written.
+        if (fd < 0) {
+            return false;
+        }
+        bool complete = rows_written == height && write_all(header.data(), header.size(), 0);
+        complete = ::close(fd) == 0 && complete;
+        fd = -1;
+        if (!complete) {
+            spdlog::error("Could not write '{}' ({} of {} scanlines written)", filename, rows_written.load(), height);
+        }
+        return complete;
+    }
+
+private:
+    std::string filename;
+    int width;
+    int height;
+    int components;
+    std::string header;
+    int fd = -1;
+    std::atomic<int> rows_written{0};
+
+    bool write_all(const char* data, size_t size, off_t offset) {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                spdlog::error("Could not write to '{}': {}", filename, std::strerror(errno));
+                return false;
+            }
+            data += written;
+            size -= size_t(written);
+            offset += written;
+        }
+        return true;
+    }
+};
+
+inline bool read_pfm(const std::string& filename, int& width, int& height, int& components, std::vector<float>& data) {
+    // Reads a Portable Float Map written in either byte order, returning the floats top scanline
+    // first like write_pfm() takes them.
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::string type;
+    double scale;
+    file >> type >> width >> height >> scale;
+    file.get(); // The single whitespace character ending the header
+    if (!file || (type != "PF" && type != "Pf") || width <= 0 || height <= 0) {
+        spdlog::error("'{}' is not a PFM image", filename);
+        return false;
+    }
+    components = (type == "PF") ? 3 : 1;
+
+    size_t row_floats = size_t(width) * components;
+    data.resize(row_floats * height);
+    for (int j = height - 1; j >= 0; j--) {
+        file.read(reinterpret_cast<char*>(data.data() + (j * row_floats)), row_floats * sizeof(float));
+    }
+    if (!file) {
+        spdlog::error("'{}' is truncated", filename);
+        return false;
+    }
+
+    if ((scale < 0) != host_is_little_endian()) {
+        for (float& value : data) {
+            unsigned char bytes[sizeof(float)];
+            std::memcpy(bytes, &value, sizeof(float));
+            std::reverse(bytes, bytes + sizeof(float));
+            std::memcpy(&value, bytes, sizeof(float));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+// Live previews of a render in progress. Render threads hand each scanline to the publisher as
+// they finish it; a background thread gathers the latest scanlines every preview interval and
+// publishes them either as a binary PPM (P6) image on a stream (stdout, for piping into a viewer)
+// or into a memory mapped framebuffer file that other processes can map and read at any time.
+//
+// The framebuffer file is a PreviewHeader followed by two 8-bit RGB images, top scanline first.
+// The publisher fills the image that isn't current, then makes it current and bumps the sequence
+// number. A reader copies the current image, then checks that the sequence number hasn't changed
+// (or retries), so it never sees a half written frame.
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "color.h"
+#include "framebuffer.h"
+
+const char preview_magic[8] = {'R', 'T', 'W', 'P', 'R', 'E', 'V', '1'};
+
+struct PreviewHeader {
+    char magic[8];
+    std::uint32_t width;
+    std::uint32_t height;
+    std::atomic<std::uint32_t> current; // Which of the two images (0 or 1) is the latest
+    std::atomic<std::uint32_t> done; // Set once the final image has been published
+    std::atomic<std::uint64_t> sequence; // Incremented every time an image is published
+    std::uint64_t image_offset; // Offset of image 0 in the file; image 1 follows it
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::uint64_t>::is_always_lock_free,
+              "The preview header is shared between processes, so its atomics must be lock free");
+
+class PreviewPublisher {
+public:
+    // Publishes previews to target, which is "-" for a stream of PPM images on stdout or else the
+    // path of the framebuffer file to create, at most once every interval seconds.
+    PreviewPublisher(const std::string& target, int width, int height, double interval, int first_row = 0,
+                     int first_column = 0)
+    : target(target), width(width), height(height), row_offset(first_row), column_offset(first_column), interval(interval),
+      staging(size_t(width) * height * 3, 0), image(staging.size(), 0), row_dirty(height, false) {
+        if (target == "-") {
+            stream = stdout;
+            ::signal(SIGPIPE, SIG_IGN); // A viewer that quits shows up as a failed write instead
+        } else if (!map_file()) {
+            return;
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    ~PreviewPublisher() { finish(); }
+
+    PreviewPublisher(const PreviewPublisher&) = delete;
+    PreviewPublisher& operator=(const PreviewPublisher&) = delete;
+
+    void update_row(int j, const Framebuffer& framebuffer) {
+        // Takes scanline j's current average colors. The row is converted outside the lock, so a
+        // render thread only ever waits for another row to be copied.
+        thread_local std::vector<unsigned char> row;
+        row.resize(size_t(width) * 3);
+        for (int i = 0; i < width; i++) {
+            gamma_bytes(framebuffer.pixel_color(framebuffer.index(column_offset + i, j)), &row[size_t(i) * 3]);
+        }
+        j -= row_offset;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(&staging[size_t(j) * width * 3], row.data(), row.size());
+        row_dirty[j] = true;
+        dirty = true;
+    }
+
+    void update(const Framebuffer& framebuffer) {
+        // Takes every scanline, e.g. to show a resumed render's samples straight away.
+        for (int j = 0; j < height; j++) {
+            update_row(row_offset + j, framebuffer);
+        }
+    }
+
+    void finish() {
+        // Publishes whatever is left and stops the background thread.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        unmap_file();
+    }
+
+private:
+    std::string target;
+    int width;
+    int height;
+    int row_offset; // Of the window of the image being previewed
+    int column_offset;
+    double interval;
+
+    std::mutex mutex; // Guards staging, row_dirty, dirty and stopping
+    std::condition_variable wake;
+    std::vector<unsigned char> staging; // Latest bytes of every row, written by the render threads
+    std::vector<unsigned char> image; // What the background thread publishes from
+    std::vector<bool> row_dirty;
+    bool dirty = false;
+    bool stopping = false;
+    std::thread worker;
+
+    std::FILE* stream = nullptr;
+    PreviewHeader* header = nullptr;
+    size_t mapping_size = 0;
+
+    void run() {
+        int published = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait_for(lock, std::chrono::duration<double>(interval), [this] { return stopping; });
+            bool last = stopping;
+            if (dirty) {
+                // Copy only the rows that changed, taking the lock row by row so render threads
+                // are never held up by more than one row's copy.
+                dirty = false;
+                for (int j = 0; j < height; j++) {
+                    if (row_dirty[j]) {
+                        row_dirty[j] = false;
+                        size_t offset = size_t(j) * width * 3;
+                        std::memcpy(&image[offset], &staging[offset], size_t(width) * 3);
+                    }
+                    lock.unlock();
+                    lock.lock();
+                }
+
+                lock.unlock();
+                publish(last);
+                published++;
+                lock.lock();
+            } else if (last && header != nullptr) {
+                header->done.store(1, std::memory_order_release);
+            }
+            if (last) {
+                break;
+            }
+        }
+        spdlog::debug("Published {} previews to {}", published, target == "-" ? "stdout" : target);
+    }
+
+    void publish(bool last) {
+        if (stream != nullptr) {
+            std::fprintf(stream, "P6\n%d %d\n255\n", width, height);
+            if (std::fwrite(image.data(), 1, image.size(), stream) != image.size() || std::fflush(stream) != 0) {
+                spdlog::warn("Could not write preview to stdout; no more previews will be written");
+                stream = nullptr;
+            }
+            return;
+        }
+        if (header == nullptr) {
+            return;
+        }
+
+        std::uint32_t back = 1 - header->current.load(std::memory_order_relaxed);
+        unsigned char* pixels = reinterpret_cast<unsigned char*>(header) + header->image_offset + (back * image.size());
+        std::memcpy(pixels, image.data(), image.size());
+        header->current.store(back, std::memory_order_release);
+        header->sequence.fetch_add(1, std::memory_order_release);
+        if (last) {
+            header->done.store(1, std::memory_order_release);
+        }
+    }
+
+    bool map_file() {
+        // Creates the framebuffer file at its full size and maps it shared. An existing file is
+        // reused rather than truncated, so a viewer watching it across several renders (the frames
+        // of an animation, say) keeps a valid mapping and sees the sequence number carry on.
+        std::uint64_t image_offset = (sizeof(PreviewHeader) + 63) / 64 * 64;
+        mapping_size = image_offset + (2 * staging.size());
+
+        int fd = ::open(target.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0 || ::ftruncate(fd, off_t(mapping_size)) != 0) {
+            spdlog::error("Could not create preview framebuffer '{}': {}", target, std::strerror(errno));
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        void* mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            spdlog::error("Could not map preview framebuffer '{}': {}", target, std::strerror(errno));
+            return false;
+        }
+
+        // A new file starts out zeroed. The magic goes in last, so a reader never mistakes a half
+        // initialized file for a preview.
+        header = static_cast<PreviewHeader*>(mapping);
+        header->done.store(0, std::memory_order_relaxed);
+        header->width = std::uint32_t(width);
+        header->height = std::uint32_t(height);
+        header->image_offset = image_offset;
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, preview_magic, sizeof(preview_magic));
+        spdlog::info("Publishing previews to {}", target);
+        return true;
+    }
+
+    void unmap_file() {
+        if (header != nullptr) {
+            ::munmap(header, mapping_size);
+            header = nullptr;
+        }
+    }
+};
@@ -2,8 +2,10 @@
 
 #include "aabb.h"
 #include "hittable.h"
+#include "instrumentation.h"
 #include "hitrecord.h"
 #include "interval.h"
+#include "material.h"
 #include "ray.h"
 #include "rtweekend.h"
 #include "vec3.h"
@@ -16,6 +18,7 @@ public:
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot(n, n);
+        area = n.length();
 
         set_bounding_box();
     }
@@ -30,6 +33,7 @@ public:
     AABB bounding_box() const override { return bbox; }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        count_primitive();
         double denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -57,17 +61,74 @@ public:
         rec.t = t;
         rec.p = intersection;
         rec.mat = mat;
+        rec.primitive_id = id;
         rec.set_face_normal(r, normal);
 
         return true;
     }
-                                                                                            
-    virtual bool is_interior(double a, double b, HitRecord& rec) const {
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        // The same tests as hit(), without the hit record.
+        count_primitive();
+        double denom = dot(normal, r.direction());
+        if (std::fabs(denom) < less_zeroish) {
+            return false;
+        }
+
+        double t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t)) {
+            return false;
+        }
+
+        Vec3 planar_hitpt_vector = r.at(t) - Q;
+        double alpha = dot(w, cross(planar_hitpt_vector, v));
+        double beta = dot(w, cross(u, planar_hitpt_vector));
+        return contains(alpha, beta);
+    }
+
+    double pdf_value(const Point3& origin, const Vec3& direction, double time) const override {
+        HitRecord rec;
+        if (!hit(Ray(origin, direction, time), Interval(0.001, infinity), rec)) {
+            return 0;
+        }
+
+        // Convert the area density 1 / area to a solid angle density at origin.
+        double distance_squared = rec.t * rec.t * direction.length_squared();
+        double cosine = std::fabs(dot(direction, normal) / direction.length());
+        if (cosine <= 0) {
+            return 0;
+        }
+        return distance_squared / (cosine * area);
+    }
+
+    Vec3 random(const Point3& origin, Point2 sample, double time) const override {
+        Point3 p = Q + (sample.x * u) + (sample.y * v);
+        return p - origin;
+    }
+
+    bool light_bounds(LightBounds& bounds) const override {
+        // Emission is assumed to be roughly uniform over the quad. Diffuse lights emit from both
+        // faces, into the hemisphere around each.
+        Color emission = mat->emitted(0.5, 0.5, Q + (0.5 * u) + (0.5 * v));
+        double phi = luminance(emission) * area * pi * 2;
+        if (phi <= 0) {
+            return false;
+        }
+        bounds = LightBounds(bbox, normal, phi, 1, 0, true);
+        return true;
+    }
+
+    virtual bool contains(double a, double b) const {
+        // Given a point in planar coordinates, return whether it lies within the primitive.
         Interval unit_interval = Interval(0, 1);
+        return unit_interval.contains(a) && unit_interval.contains(b);
+    }
+
+    virtual bool is_interior(double a, double b, HitRecord& rec) const {
         // Given the hit point in planar coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
 
-        if (!unit_interval.contains(a) || !unit_interval.contains(b)) {
+        if (!contains(a, b)) {
             return false;
         }
 
@@ -85,6 +146,7 @@ private:
     AABB bbox;
     Vec3 normal;
     double D;
+    double area;
 };
 
 inline std::shared_ptr<HittableList> box(const Point3& a, const Point3& b, std::shared_ptr<Material> mat) {
@@ -0,0 +1,288 @@
+// Golden image regression and equal-time quality benchmark.
+//
+// quality_benchmark --references DIR --update [options]
+//     Renders every scene twice into DIR: scene<N>.reference.pfm, a high sample count reference
+//     to measure error against, and scene<N>.golden.pfm, the image the benchmark renders itself.
+//
+// quality_benchmark --references DIR [options]
+//     Renders every scene with the same fixed seed and checks it against its golden image, so
+//     that any change to what gets rendered is caught. Then renders each scene at 1, 2, 4, ...
+//     samples per pixel, timing each render and measuring its error against the reference, so
+//     that a change can be judged by how fast the error comes down rather than by how fast rays
+//     are traced. A change that takes fewer samples or approximates something renders faster
+//     but less accurately; only error at equal time tells whether that is a win.
+//
+// Options:
+//     --scenes LIST              Comma separated scene numbers (default: all)
+//     --width PIXELS             Image width (default 128, 0 for each scene's own)
+//     --spp SAMPLES              Samples per pixel of the golden image and the top of each curve
+//                                (default: each scene's own)
+//     --reference-multiplier N   Reference sample count over --spp (default 16)
+//     --tolerance RELMSE         Largest relative MSE against the golden image that passes
+//                                (default 1e-6, which lets through rounding differences only)
+//     --threads N                Render threads (default: one per hardware thread)
+//     --csv FILE                 Write every render's time and errors to FILE
+//     --baseline FILE            Compare against the --csv output of an earlier run
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "image_metrics.h"
+#include "light_sampler.h"
+#include "pfm.h"
+#include "scenes.h"
+
+struct Measurement {
+    int scene;
+    int spp;
+    double seconds;
+    ImageErrors errors;
+};
+
+static std::vector<Color> render(Camera cam, const Hittable& world, int spp, std::uint64_t seed, double& seconds) {
+    // Renders at spp samples per pixel with the given seed, quietly, timing just the render. The
+    // pixels are rounded to floats, as the PFM files store them, so that an unchanged render
+    // matches its golden image exactly.
+    cam.samples_per_pixel = spp;
+    cam.seed = seed;
+
+    spdlog::level::level_enum log_level = spdlog::get_level();
+    spdlog::set_level(spdlog::level::warn);
+    auto start = std::chrono::steady_clock::now();
+    Framebuffer framebuffer = *cam.render_to_framebuffer(world);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::set_level(log_level);
+
+    std::vector<Color> pixels = resolve_pixels(framebuffer);
+    for (Color& pixel : pixels) {
+        pixel = Color(float(pixel.x()), float(pixel.y()), float(pixel.z()));
+    }
+    return pixels;
+}
+
+static bool write_image(const std::string& filename, const std::vector<Color>& pixels, int width, int height) {
+    std::vector<float> data;
+    data.reserve(pixels.size() * 3);
+    for (const Color& pixel : pixels) {
+        data.push_back(float(pixel.x()));
+        data.push_back(float(pixel.y()));
+        data.push_back(float(pixel.z()));
+    }
+    return write_pfm(filename, width, height, 3, data.data());
+}
+
+static bool read_image(const std::string& filename, int width, int height, std::vector<Color>& pixels) {
+    int file_width;
+    int file_height;
+    int components;
+    std::vector<float> data;
+    if (!read_pfm(filename, file_width, file_height, components, data)) {
+        spdlog::error("Could not read '{}'; create it with --update", filename);
+        return false;
+    }
+    if (file_width != width || file_height != height || components != 3) {
+        spdlog::error("'{}' is {}x{}, not {}x{}; recreate it with --update", filename, file_width, file_height, width, height);
+        return false;
+    }
+
+    pixels.resize(size_t(width) * height);
+    for (size_t index = 0; index < pixels.size(); index++) {
+        pixels[index] = Color(data[(index * 3) + 0], data[(index * 3) + 1], data[(index * 3) + 2]);
+    }
+    return true;
+}
+
+static std::map<std::pair<int, int>, Measurement> read_csv(const std::string& filename) {
+    // Measurements by scene and samples per pixel.
+    std::map<std::pair<int, int>, Measurement> measurements;
+    std::ifstream file(filename);
+    std::string line;
+    std::getline(file, line); // Header
+    while (std::getline(file, line)) {
+        Measurement m;
+        if (std::sscanf(line.c_str(), "%d,%d,%lf,%lf,%lf,%lf", &m.scene, &m.spp, &m.seconds, &m.errors.mse,
+                        &m.errors.rel_mse, &m.errors.perceptual) == 6) {
+            measurements[{m.scene, m.spp}] = m;
+        }
+    }
+    return measurements;
+}
+
+int main(int argc, char* argv[]) {
+    std::string reference_dir;
+    bool update = false;
+    std::vector<int> scene_ids;
+    int image_width = 128;
+    int samples_per_pixel = 0;
+    int reference_multiplier = 16;
+    double tolerance = 1e-6;
+    int threads = 0;
+    std::string csv_filename;
+    std::string baseline_filename;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+
+        if (option == "--references" && has_value) {
+            reference_dir = argv[++arg];
+        } else if (option == "--update") {
+            update = true;
+        } else if (option == "--scenes" && has_value) {
+            std::stringstream list(argv[++arg]);
+            std::string id;
+            while (std::getline(list, id, ',')) {
+                scene_ids.push_back(std::atoi(id.c_str()));
+            }
+        } else if (option == "--width" && has_value) {
+            image_width = std::atoi(argv[++arg]);
+        } else if (option == "--spp" && has_value) {
+            samples_per_pixel = std::atoi(argv[++arg]);
+        } else if (option == "--reference-multiplier" && has_value) {
+            reference_multiplier = std::atoi(argv[++arg]);
+        } else if (option == "--tolerance" && has_value) {
+            tolerance = std::atof(argv[++arg]);
+        } else if (option == "--threads" && has_value) {
+            threads = std::atoi(argv[++arg]);
+        } else if (option == "--csv" && has_value) {
+            csv_filename = argv[++arg];
+        } else if (option == "--baseline" && has_value) {
+            baseline_filename = argv[++arg];
+        } else {
+            spdlog::error("Unknown or incomplete argument '{}'", option);
+            return 1;
+        }
+    }
+
+    if (reference_dir.empty()) {
+        spdlog::error("--references DIR is required");
+        return 1;
+    }
+    if (scene_ids.empty()) {
+        for (int id = 1; id <= scene_count; id++) {
+            scene_ids.push_back(id);
+        }
+    }
+
+    std::map<std::pair<int, int>, Measurement> baseline;
+    if (!baseline_filename.empty()) {
+        baseline = read_csv(baseline_filename);
+        if (baseline.empty()) {
+            spdlog::error("No measurements in '{}'", baseline_filename);
+            return 1;
+        }
+    }
+
+    std::vector<Measurement> measurements;
+    bool all_passed = true;
+
+    for (int scene_id : scene_ids) {
+        Scene scene;
+        if (!build_scene(scene_id, scene)) {
+            spdlog::error("Unknown scene {}", scene_id);
+            return 1;
+        }
+
+        Camera& cam = scene.cam;
+        if (image_width > 0) {
+            cam.image_width = image_width;
+        }
+        cam.threads = threads;
+        if (!scene.lights.objects.empty()) {
+            cam.lights = std::make_shared<LightSampler>(scene.lights, LightSampling::Bvh);
+        }
+        int spp = samples_per_pixel > 0 ? samples_per_pixel : cam.samples_per_pixel;
+        int width = cam.image_width;
+        int height = cam.height();
+
+        std::string stem = fmt::format("{}/scene{}", reference_dir, scene_id);
+        double seconds;
+
+        if (update) {
+            spdlog::info("Scene {}: rendering the reference at {} samples per pixel", scene_id, spp * reference_multiplier);
+            // A different seed keeps the reference's noise independent of the images measured
+            // against it.
+            std::vector<Color> reference = render(cam, scene.world, spp * reference_multiplier, 1, seconds);
+            std::vector<Color> golden = render(cam, scene.world, spp, 0, seconds);
+            if (!write_image(stem + ".reference.pfm", reference, width, height)
+                || !write_image(stem + ".golden.pfm", golden, width, height)) {
+                spdlog::error("Could not write the images for scene {} to '{}'", scene_id, reference_dir);
+                return 1;
+            }
+            continue;
+        }
+
+        std::vector<Color> reference;
+        std::vector<Color> golden;
+        if (!read_image(stem + ".reference.pfm", width, height, reference) || !read_image(stem + ".golden.pfm", width, height, golden)) {
+            return 1;
+        }
+
+        // The golden check: the fixed seed render must come out the same as before.
+        std::vector<Color> image = render(cam, scene.world, spp, 0, seconds);
+        ImageErrors golden_errors = compare_images(image, golden, width, height);
+        bool passed = golden_errors.rel_mse <= tolerance;
+        all_passed = all_passed && passed;
+        if (golden_errors.mse == 0) {
+            spdlog::info("Scene {}: identical to the golden image", scene_id);
+        } else if (passed) {
+            spdlog::info("Scene {}: matches the golden image (relMSE {:.3g})", scene_id, golden_errors.rel_mse);
+        } else {
+            spdlog::error("Scene {}: differs from the golden image (relMSE {:.3g}, MSE {:.3g}, perceptual {:.4f})",
+                          scene_id, golden_errors.rel_mse, golden_errors.mse, golden_errors.perceptual);
+        }
+
+        // Error against time, from 1 sample per pixel up to spp. The golden render is the last
+        // point, so its time is reused rather than rendering it again.
+        spdlog::info("{:>6} {:>10} {:>12} {:>12} {:>10} {:>14}", "spp", "seconds", "MSE", "relMSE", "perceptual", "relMSE*seconds");
+        for (int curve_spp = 1;; curve_spp = std::min(curve_spp * 2, spp)) {
+            double curve_seconds = seconds;
+            std::vector<Color> curve_image = curve_spp == spp ? image : render(cam, scene.world, curve_spp, 0, curve_seconds);
+            Measurement m{scene_id, curve_spp, curve_seconds, compare_images(curve_image, reference, width, height)};
+            measurements.push_back(m);
+            spdlog::info("{:>6} {:>10.3f} {:>12.6f} {:>12.6f} {:>10.4f} {:>14.6f}", m.spp, m.seconds, m.errors.mse,
+                         m.errors.rel_mse, m.errors.perceptual, m.errors.rel_mse * m.seconds);
+            if (curve_spp == spp) {
+                break;
+            }
+        }
+
+        // Monte Carlo error falls as one over the sample count, so error times render time stays
+        // roughly constant along a curve and compares renders of different speed at equal time.
+        const Measurement& last = measurements.back();
+        auto before = baseline.find({scene_id, last.spp});
+        if (before != baseline.end()) {
+            double efficiency = (before->second.errors.rel_mse * before->second.seconds) / (last.errors.rel_mse * last.seconds);
+            spdlog::info("Scene {}: {:.2f}x the baseline's efficiency at {} spp ({:.2f}x the speed, {:.2f}x the relMSE)",
+                         scene_id, efficiency, last.spp, before->second.seconds / last.seconds,
+                         last.errors.rel_mse / before->second.errors.rel_mse);
+        }
+    }
+
+    if (!csv_filename.empty() && !update) {
+        std::ofstream csv(csv_filename);
+        csv << "scene,spp,seconds,mse,rel_mse,perceptual\n";
+        for (const Measurement& m : measurements) {
+            csv << fmt::format("{},{},{:.6f},{:.9g},{:.9g},{:.9g}\n", m.scene, m.spp, m.seconds, m.errors.mse,
+                               m.errors.rel_mse, m.errors.perceptual);
+        }
+        spdlog::info("Wrote {} measurements to {}", measurements.size(), csv_filename);
+    }
+
+    return all_passed ? 0 : 1;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cmath>
+
 #include "vec3.h"
 
 #include <fmt/format.h>
@@ -7,13 +9,29 @@
 class Ray {
 public:
     Ray() {}
-    Ray(const Point3& origin, const Vec3& direction) : orig(origin), dir(direction), tm(0) {}
-    Ray(const Point3& origin, const Vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
+    Ray(const Point3& origin, const Vec3& direction) : Ray(origin, direction, 0) {}
+    Ray(const Point3& origin, const Vec3& direction, double time) : orig(origin), dir(direction), tm(time) {
+        // Precompute what the slab test needs, once per ray instead of once per box. Zero (and
+        // denormal) direction components get a huge but finite inverse rather than infinity, so a
+        // slab boundary passing through the origin gives 0 instead of the NaN from 0 * inf.
+        for (int axis = 0; axis < 3; axis++) {
+            double d = dir[axis];
+            inv_dir[axis] = std::fabs(d) < 1e-100 ? std::copysign(1e100, d) : 1.0 / d;
+            orig_inv_dir[axis] = orig[axis] * inv_dir[axis];
+            dir_is_negative[axis] = inv_dir[axis] < 0;
+        }
+    }
 
     const Point3& origin() const { return orig; }
     const Vec3& direction() const { return dir; }
     double time() const { return tm; }
 
+    // Traversal data: the componentwise inverse direction, the origin scaled by it, and whether
+    // each direction component is negative.
+    const Vec3& inverse_direction() const { return inv_dir; }
+    const Vec3& origin_times_inverse() const { return orig_inv_dir; }
+    bool is_negative(int axis) const { return dir_is_negative[axis]; }
+
     Point3 at(double t) const {
         return orig + (t * dir);
     }
@@ -25,5 +43,8 @@ public:
 private:
     Point3 orig;
     Vec3 dir;
-    double tm;
+    double tm = 0;
+    Vec3 inv_dir;
+    Vec3 orig_inv_dir;
+    bool dir_is_negative[3] = {false, false, false};
 };
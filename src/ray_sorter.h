@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "morton.h"
+#include "ray.h"
+#include "vec3.h"
+
+class RaySorter {
+public:
+    // Puts a batch of rays in an order where rays that start close together and head the same way
+    // follow each other, so that tracing them in that order keeps revisiting the same hierarchy
+    // nodes and primitives while they are still in cache. Each ray gets a 31 bit key: the Morton
+    // code of its origin on a 128^3 grid over the scene's bounds, then the cell of its direction
+    // on a 32x32 octahedral map of the sphere. The keys are radix sorted.
+    RaySorter() {}
+
+    RaySorter(const AABB& bounds) : bounds(bounds) {}
+
+    void clear() {
+        keys.clear();
+        values.clear();
+    }
+
+    void add(const Ray& r, std::uint32_t value) {
+        // Adds a ray to the batch, with a value (such as the index of its path) to hand back.
+        keys.push_back(key(r));
+        values.push_back(value);
+    }
+
+    size_t size() const { return values.size(); }
+
+    const std::vector<std::uint32_t>& sorted() {
+        // The values of the rays added since clear(), in key order. Rays with equal keys keep the
+        // order they were added in.
+        radix_sort();
+        return values;
+    }
+
+    std::uint32_t key(const Ray& r) const {
+        const Point3& o = r.origin();
+        std::uint32_t cell_x = quantize(o.x(), bounds.x, origin_cells);
+        std::uint32_t cell_y = quantize(o.y(), bounds.y, origin_cells);
+        std::uint32_t cell_z = quantize(o.z(), bounds.z, origin_cells);
+
+        // Fold the direction onto the octahedron |x| + |y| + |z| = 1, then unfold its lower half
+        // over the upper half's corners, to get a square whose cells cover similar solid angles.
+        const Vec3& d = r.direction();
+        double l1 = std::fabs(d.x()) + std::fabs(d.y()) + std::fabs(d.z());
+        double u = l1 > 0 ? d.x() / l1 : 0;
+        double v = l1 > 0 ? d.y() / l1 : 0;
+        if (d.z() < 0) {
+            double folded_u = (1 - std::fabs(v)) * (u < 0 ? -1 : 1);
+            double folded_v = (1 - std::fabs(u)) * (v < 0 ? -1 : 1);
+            u = folded_u;
+            v = folded_v;
+        }
+        std::uint32_t cell_u = quantize(u, Interval(-1, 1), direction_cells);
+        std::uint32_t cell_v = quantize(v, Interval(-1, 1), direction_cells);
+
+        return (morton_code_3d(cell_x, cell_y, cell_z) << 10) | (cell_u << 5) | cell_v;
+    }
+
+private:
+    AABB bounds;
+    std::vector<std::uint32_t> keys;
+    std::vector<std::uint32_t> values;
+    std::vector<std::uint32_t> scratch_keys;
+    std::vector<std::uint32_t> scratch_values;
+
+    static const std::uint32_t origin_cells = 128;
+    static const std::uint32_t direction_cells = 32;
+
+    static std::uint32_t quantize(double x, const Interval& range, std::uint32_t cells) {
+        // The cell of [range.min, range.max] split into cells cells that x falls in, clamped.
+        double size = range.max - range.min;
+        if (!(size > 0)) {
+            return 0;
+        }
+        double cell = (x - range.min) / size * cells;
+        return std::uint32_t(std::clamp(cell, 0.0, double(cells - 1)));
+    }
+
+    void radix_sort() {
+        // Least significant digit first, a byte at a time, skipping bytes every key shares.
+        size_t count = keys.size();
+        scratch_keys.resize(count);
+        scratch_values.resize(count);
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            size_t histogram[257] = {};
+            for (std::uint32_t k : keys) {
+                histogram[((k >> shift) & 0xff) + 1]++;
+            }
+            if (std::any_of(histogram + 1, histogram + 257, [count](size_t n) { return n == count; })) {
+                continue;
+            }
+            for (int digit = 1; digit <= 256; digit++) {
+                histogram[digit] += histogram[digit - 1];
+            }
+            for (size_t index = 0; index < count; index++) {
+                size_t destination = histogram[(keys[index] >> shift) & 0xff]++;
+                scratch_keys[destination] = keys[index];
+                scratch_values[destination] = values[index];
+            }
+            keys.swap(scratch_keys);
+            values.swap(scratch_values);
+        }
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "image_metrics.h"
+#include "perf_counters.h"
+
+// Passes rays on to a world, counting them.
+class RayCountingHittable : public Hittable {
+public:
+    RayCountingHittable(const Hittable& world) : world(world) {}
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        rays.fetch_add(1, std::memory_order_relaxed);
+        return world.hit(r, ray_t, rec);
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        rays.fetch_add(1, std::memory_order_relaxed);
+        return world.occluded(r, ray_t);
+    }
+
+    AABB bounding_box() const override { return world.bounding_box(); }
+
+    mutable std::atomic<std::uint64_t> rays{0};
+
+private:
+    const Hittable& world;
+};
+
+inline void ray_sorting_report(Camera cam, const Hittable& world, int batch_size) {
+    // Renders the scene tracing each path on its own, then in batches of batch_size pixel samples
+    // without and with sorting each bounce's rays, and logs each render's time, ray throughput
+    // and, where the machine can count them, instructions and cache misses per ray. The batched
+    // images must come out identical to the first.
+    cam.aovs = AOV_NONE;
+    cam.checkpoint_filename.clear();
+    cam.resume = false;
+    cam.preview_target.clear();
+
+    // Every mode traces the same rays, so count them once, outside the timed renders.
+    RayCountingHittable counting_world(world);
+    spdlog::level::level_enum log_level = spdlog::get_level();
+    spdlog::set_level(spdlog::level::warn);
+    cam.render_to_framebuffer(counting_world);
+    spdlog::set_level(log_level);
+    double rays = double(counting_world.rays.load());
+    spdlog::info("{} rays per render, counting camera, scattered and shadow rays", std::uint64_t(rays));
+
+    PerfCounters counters;
+    if (!counters.any_available()) {
+        spdlog::warn("Hardware performance counters are unavailable here; reporting throughput only");
+    }
+
+    spdlog::info("{:>18} {:>9} {:>9} {:>13} {:>13} {:>13} {:>10}", "mode", "seconds", "Mrays/s", "instr/ray",
+                 "cache miss/ray", "L1D miss/ray", "identical");
+
+    std::vector<Color> per_path;
+    double per_path_seconds = 0;
+    const char* modes[] = {"per path", "batched", "batched + sorted"};
+    for (int mode = 0; mode < 3; mode++) {
+        cam.batch_size = mode == 0 ? 0 : batch_size;
+        cam.sort_rays = mode == 2;
+
+        spdlog::set_level(spdlog::level::warn);
+        counters.start();
+        auto start = std::chrono::steady_clock::now();
+        Framebuffer image = *cam.render_to_framebuffer(world);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        counters.stop();
+        spdlog::set_level(log_level);
+
+        std::vector<Color> pixels = resolve_pixels(image);
+        bool identical = true;
+        if (mode == 0) {
+            per_path = pixels;
+            per_path_seconds = seconds;
+        } else {
+            for (size_t index = 0; index < pixels.size() && identical; index++) {
+                const Color& a = pixels[index];
+                const Color& b = per_path[index];
+                identical = a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+            }
+        }
+
+        auto per_ray = [&](const char* name) {
+            return counters.available(name) ? fmt::format("{:.1f}", counters.value(name) / rays) : std::string("n/a");
+        };
+        spdlog::info("{:>18} {:>9.3f} {:>9.3f} {:>13} {:>13} {:>13} {:>10}", modes[mode], seconds, rays / seconds * 1e-6,
+                     per_ray("instructions"), per_ray("cache_misses"), per_ray("l1d_read_misses"), identical ? "yes" : "NO");
+        if (mode > 0) {
+            spdlog::info("{:>18} {:.2f}x the speed of tracing each path on its own", "", per_path_seconds / seconds);
+        }
+    }
+}
@@ -0,0 +1,162 @@
+// Render daemon client.
+//
+// render_client [--address ADDRESS] [--scene N] [--width PIXELS] [--spp SAMPLES]
+//               [--samples-per-pass N] [--seed N] [--light-sampling NAME]
+//               [--environment FILE] [--environment-scale SCALE] [--lookfrom X,Y,Z]
+//               [--lookat X,Y,Z] [--vfov DEGREES] [--defocus ANGLE,DISTANCE]
+//               [--output FILE] [--repeat N]
+// render_client [--address ADDRESS] --shutdown
+//
+// Asks a render_daemon for an image and writes it to --output (default image.ppm, or a .pfm),
+// logging when each pass arrives and how long the whole image took, and whether the daemon had
+// the scene or the image cached already. The scene options are those of raytracinginaweekend;
+// the camera options replace the scene's own camera settings. --repeat sends the same request
+// that many times, to time repeats. --shutdown stops the daemon.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "distributed.h"
+#include "image_writer.h"
+#include "light_sampler.h"
+#include "render_service.h"
+
+static bool parse_triple(const char* text, double values[3]) {
+    return std::sscanf(text, "%lf,%lf,%lf", &values[0], &values[1], &values[2]) == 3;
+}
+
+static bool request_render(int fd, const RenderRequest& request, const std::string& environment, const std::string& output) {
+    // Sends one request and waits for its image, writing it to output. Returns whether it came.
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto seconds = [&start] { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+    std::vector<char> payload(sizeof(request));
+    std::memcpy(payload.data(), &request, sizeof(request));
+    payload.insert(payload.end(), environment.begin(), environment.end());
+    if (!send_service_message(fd, ServiceHeader{SERVICE_RENDER, 0, {}}, payload.data(), payload.size())) {
+        spdlog::error("Could not send the request");
+        return false;
+    }
+
+    ServiceHeader header;
+    while (recv_service_message(fd, header, payload)) {
+        if (header.type == SERVICE_PASS) {
+            spdlog::info("  {} spp after {:.3f} s", header.params[2], seconds());
+            continue;
+        }
+        if (header.type == SERVICE_ERROR) {
+            spdlog::error("The daemon says: {}", std::string(payload.begin(), payload.end()));
+            return false;
+        }
+        if (header.type != SERVICE_IMAGE) {
+            break;
+        }
+
+        int width = header.params[0];
+        int height = header.params[1];
+        std::vector<Color> pixels;
+        if (!decompress_tile(payload, size_t(width) * height, pixels)) {
+            spdlog::error("The image is corrupt");
+            return false;
+        }
+        spdlog::info("{}x{} at {} spp in {:.3f} s (scene {}, image {})", width, height, header.params[2], seconds(),
+                     (header.params[3] & FROM_CACHED_SCENE) ? "cached" : "built",
+                     (header.params[3] & FROM_CACHED_IMAGE) ? "cached" : "rendered");
+
+        ImageWriter writer(output, width, height);
+        for (int j = 0; j < height; j++) {
+            writer.add_row(j, &pixels[size_t(j) * width]);
+        }
+        return writer.finish();
+    }
+
+    spdlog::error("Lost the connection to the daemon");
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    std::string address = default_daemon_address;
+    RenderRequest request;
+    std::string environment;
+    std::string output = "image.ppm";
+    int repeat = 1;
+    bool shutdown = false;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+
+        if (option == "--address" && has_value) {
+            address = argv[++arg];
+        } else if (option == "--scene" && has_value) {
+            request.scene = std::atoi(argv[++arg]);
+        } else if (option == "--width" && has_value) {
+            request.image_width = std::atoi(argv[++arg]);
+        } else if (option == "--spp" && has_value) {
+            request.samples_per_pixel = std::atoi(argv[++arg]);
+        } else if (option == "--samples-per-pass" && has_value) {
+            request.samples_per_pass = std::atoi(argv[++arg]);
+        } else if (option == "--seed" && has_value) {
+            request.seed = std::strtoull(argv[++arg], nullptr, 10);
+        } else if (option == "--light-sampling" && has_value) {
+            LightSampling light_sampling;
+            if (!parse_light_sampling(argv[++arg], light_sampling)) {
+                spdlog::error("Unknown light sampling '{}', expected none, uniform or bvh", argv[arg]);
+                return 1;
+            }
+            request.light_sampling = std::int32_t(light_sampling);
+        } else if (option == "--environment" && has_value) {
+            environment = argv[++arg];
+        } else if (option == "--environment-scale" && has_value) {
+            request.environment_scale = std::atof(argv[++arg]);
+        } else if (option == "--lookfrom" && has_value && parse_triple(argv[arg + 1], request.lookfrom)) {
+            request.overrides |= OVERRIDE_LOOKFROM;
+            arg++;
+        } else if (option == "--lookat" && has_value && parse_triple(argv[arg + 1], request.lookat)) {
+            request.overrides |= OVERRIDE_LOOKAT;
+            arg++;
+        } else if (option == "--vfov" && has_value) {
+            request.vfov = std::atof(argv[++arg]);
+            request.overrides |= OVERRIDE_VFOV;
+        } else if (option == "--defocus" && has_value
+                   && std::sscanf(argv[arg + 1], "%lf,%lf", &request.defocus_angle, &request.focus_distance) == 2) {
+            request.overrides |= OVERRIDE_DEFOCUS;
+            arg++;
+        } else if (option == "--output" && has_value) {
+            output = argv[++arg];
+        } else if (option == "--repeat" && has_value) {
+            repeat = std::atoi(argv[++arg]);
+        } else if (option == "--shutdown") {
+            shutdown = true;
+        } else {
+            spdlog::error("Unknown or incomplete argument '{}'", option);
+            return 1;
+        }
+    }
+
+    int fd = open_socket(address, false);
+    if (fd < 0) {
+        return 1;
+    }
+
+    bool ok = true;
+    if (shutdown) {
+        ok = send_service_message(fd, ServiceHeader{SERVICE_SHUTDOWN, 0, {}});
+    } else {
+        for (int i = 0; i < repeat && ok; i++) {
+            ok = request_render(fd, request, environment, output);
+        }
+    }
+
+    ::close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+// Render daemon.
+//
+// render_daemon [--listen ADDRESS] [--threads N] [--memory-mb MB]
+//
+// Stays running between renders, keeping the scenes, images and hierarchies it builds and the
+// images it renders in a cache, so that re-rendering a scene with a different camera doesn't
+// build it again and repeating a request costs nothing. render_client sends it requests. See
+// render_service.h for the protocol.
+//
+// Options:
+//     --listen ADDRESS    unix:PATH or tcp:HOST:PORT to listen on (default
+//                         unix:/tmp/raytracinginaweekend-daemon.sock)
+//     --threads N         Render threads (default: one per hardware thread)
+//     --memory-mb MB      Cap on the cache's size, past which the least recently used scenes,
+//                         images and renders are dropped (default 1024)
+
+#include <cstdlib>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "rtweekend.h"
+
+#include "render_service.h"
+
+int main(int argc, char* argv[]) {
+    std::string address = default_daemon_address;
+    int threads = 0;
+    double memory_mb = 1024;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+
+        if (option == "--listen" && has_value) {
+            address = argv[++arg];
+        } else if (option == "--threads" && has_value) {
+            threads = std::atoi(argv[++arg]);
+        } else if (option == "--memory-mb" && has_value) {
+            memory_mb = std::atof(argv[++arg]);
+        } else {
+            spdlog::error("Unknown or incomplete argument '{}'", option);
+            return 1;
+        }
+    }
+
+    RenderDaemon daemon(threads, size_t(memory_mb * (1 << 20)));
+    return daemon.run(address);
+}
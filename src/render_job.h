@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "image_writer.h"
+#include "thread_pool.h"
+
+// How far a render job has got, as handed to its progress callback.
+struct RenderProgress {
+    int tiles_done = 0;
+    int tiles_total = 0; // Over all passes
+    int samples_per_pixel = 0; // Reached by the whole image so far
+    double samples_per_second = 0; // Pixel samples, averaged since the job started
+    double seconds_elapsed = 0;
+    double seconds_remaining = 0; // Estimated from the rate so far
+};
+
+enum class RenderStatus {
+    Finished,
+    Cancelled,
+    Failed, // Never started, as the camera's crop window lies outside the frame
+};
+
+struct RenderResult {
+    RenderStatus status;
+    Framebuffer framebuffer; // Complete if the job finished, else as far as it got
+    double seconds; // From submission to the end
+};
+
+class RenderJob;
+
+class RenderSink {
+public:
+    // Where a render job's image goes. start() is called with the empty framebuffer, which may
+    // be a crop window of the image, when the job is submitted, add_row()
+    // with each scanline as the last pass finishes it, pass_done() as each pass but the last ends
+    // and finish() or cancelled() once at the end. Calls come from any of the pool's threads, but
+    // never two at once.
+    virtual ~RenderSink() = default;
+
+    virtual void start(const Framebuffer& framebuffer) {}
+
+    virtual void pass_done(const Framebuffer& framebuffer, int samples_per_pixel) {}
+
+    virtual void add_row(int j, const Framebuffer& framebuffer) {}
+
+    virtual void finish(const Framebuffer& framebuffer) {}
+
+    virtual void cancelled(const Framebuffer& framebuffer) {}
+
+protected:
+    // Cancels the job the sink belongs to, for a sink whose destination has gone away. Only to be
+    // called from the sink's own callbacks, which only run while the job does.
+    void cancel_job();
+
+private:
+    friend class RenderJob;
+    RenderJob* job = nullptr; // Set before the job queues any work
+};
+
+class ImageFileSink : public RenderSink {
+public:
+    // Writes the image to a file as Camera::render() does, with any AOVs next to it. A cancelled
+    // job's file gets the samples taken so far, which leaves the rows never reached black.
+    ImageFileSink(std::string filename) : filename(std::move(filename)) {}
+
+    void start(const Framebuffer& framebuffer) override {
+        writer = std::make_unique<ImageWriter>(filename, framebuffer.image_width(), framebuffer.image_height(),
+                                               framebuffer.first_row(), framebuffer.first_column());
+    }
+
+    void add_row(int j, const Framebuffer& framebuffer) override { writer->add_row(j, framebuffer); }
+
+    void finish(const Framebuffer& framebuffer) override {
+        writer->add_missing_rows(framebuffer);
+        writer->finish();
+        if (framebuffer.requested() != AOV_NONE) {
+            size_t dot = filename.find_last_of('.');
+            framebuffer.write_pfms(dot == std::string::npos ? filename : filename.substr(0, dot));
+        }
+    }
+
+    void cancelled(const Framebuffer& framebuffer) override {
+        writer->add_missing_rows(framebuffer);
+        writer->finish();
+    }
+
+private:
+    std::string filename;
+    std::unique_ptr<ImageWriter> writer;
+};
+
+struct RenderJobOptions {
+    int priority = 0; // Tiles of jobs with a higher priority run first on a shared pool
+    int tile_height = 4; // Scanlines per tile
+    int first_pass_samples = 0; // Samples per pixel of the first pass if not camera.samples_per_pass, e.g. 1 to show the whole image soon
+    std::shared_ptr<RenderSink> sink; // Where the image goes, besides the result, if anywhere
+    std::function<void(const RenderProgress&)> progress; // Called after every tile, one call at a time
+};
+
+class RenderJob {
+public:
+    // A render running on a thread pool that other jobs (or anything else) may share, for
+    // embedding the renderer in a program that queues up renders. Like Camera::render(), it
+    // renders in progressive passes of camera.samples_per_pass samples, and each pass is split
+    // into tiles of whole scanlines queued at the job's priority. The last tile of a pass to
+    // finish queues the next pass, so no thread ever blocks on a job. The image is identical to
+    // Camera::render()'s; checkpoints, previews and camera.threads are not used.
+    //
+    // Cancelling is cooperative: tiles that haven't started are skipped, so the job ends once the
+    // tiles already running finish. Destroying a job cancels it and waits for it to end.
+    //
+    // A job whose camera has no pixels to render fails at once, without calling its sink, and
+    // its result has an empty framebuffer.
+    RenderJob(ThreadPool& pool, std::shared_ptr<const Hittable> world, Camera camera, RenderJobOptions options = {})
+    : pool(pool), world(std::move(world)), camera(std::move(camera)), options(std::move(options)),
+      framebuffer(0, 0, AOV_NONE), future(promise.get_future().share()), start_time(std::chrono::steady_clock::now()) {
+        std::optional<Framebuffer> started = this->camera.start_render();
+        if (!started) {
+            promise.set_value(RenderResult{RenderStatus::Failed, std::move(framebuffer), seconds_since_start()});
+            return;
+        }
+        framebuffer = std::move(*started);
+
+        int height = framebuffer.image_height();
+        int pass_samples = std::max(this->camera.samples_per_pass, 1);
+        for (int target = 0; target < this->camera.samples_per_pixel;) {
+            bool first = target == 0 && this->options.first_pass_samples > 0;
+            target = std::min(target + (first ? this->options.first_pass_samples : pass_samples), this->camera.samples_per_pixel);
+            pass_targets.push_back(target);
+        }
+        this->options.tile_height = std::max(this->options.tile_height, 1);
+        tiles_per_pass = (height + this->options.tile_height - 1) / this->options.tile_height;
+
+        if (this->options.sink) {
+            this->options.sink->job = this;
+            this->options.sink->start(framebuffer);
+        }
+        if (pass_targets.empty()) {
+            complete(RenderStatus::Finished);
+        } else {
+            queue_pass(0);
+        }
+    }
+
+    ~RenderJob() {
+        cancel();
+        wait();
+    }
+
+    RenderJob(const RenderJob&) = delete;
+    RenderJob& operator=(const RenderJob&) = delete;
+
+    std::shared_future<RenderResult> result() const { return future; }
+
+    void cancel() { cancel_requested.store(true, std::memory_order_relaxed); }
+
+    void wait() {
+        // Returns once the job has ended, running queued tasks on this thread in the meantime,
+        // which is also what gets a job done on a pool of one thread (and so no workers).
+        pool.wait(tasks);
+    }
+
+private:
+    ThreadPool& pool;
+    std::shared_ptr<const Hittable> world;
+    Camera camera;
+    RenderJobOptions options;
+    Framebuffer framebuffer;
+    std::promise<RenderResult> promise;
+    std::shared_future<RenderResult> future;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::vector<int> pass_targets; // The samples per pixel reached by each pass
+    int tiles_per_pass = 0;
+    std::atomic<bool> cancel_requested{false};
+    std::atomic<bool> skipped_tiles{false};
+    std::atomic<int> tiles_left{0}; // In the pass running
+    ThreadPool::TaskGroup tasks; // Never empty between passes, as each pass is queued by a task of the one before
+
+    std::mutex progress_mutex; // Guards the rest, and serializes the progress and sink calls
+    int tiles_done = 0;
+    double samples_done = 0;
+
+    void queue_pass(int pass) {
+        tiles_left.store(tiles_per_pass, std::memory_order_relaxed);
+        int end_row = framebuffer.first_row() + framebuffer.image_height();
+        for (int y0 = framebuffer.first_row(); y0 < end_row; y0 += options.tile_height) {
+            int y1 = std::min(y0 + options.tile_height, end_row);
+            pool.submit(tasks, [this, pass, y0, y1] { run_tile(pass, y0, y1); }, options.priority);
+        }
+    }
+
+    void run_tile(int pass, int y0, int y1) {
+        bool last_pass = pass + 1 == int(pass_targets.size());
+        if (!cancel_requested.load(std::memory_order_relaxed)) {
+            camera.render_rows(*world, framebuffer, y0, y1, pass_targets[pass]);
+            tile_done(pass, y0, y1, last_pass);
+        } else {
+            skipped_tiles.store(true, std::memory_order_relaxed);
+        }
+
+        if (tiles_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // A job cancelled after its last tile started has finished all the same.
+            if (skipped_tiles.load(std::memory_order_relaxed)) {
+                complete(RenderStatus::Cancelled);
+            } else if (last_pass) {
+                complete(RenderStatus::Finished);
+            } else if (cancel_requested.load(std::memory_order_relaxed)) {
+                complete(RenderStatus::Cancelled);
+            } else {
+                if (options.sink) {
+                    // Every tile of the pass is done and the next isn't queued yet, so nothing is
+                    // writing to the framebuffer.
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    options.sink->pass_done(framebuffer, pass_targets[pass]);
+                }
+                queue_pass(pass + 1);
+            }
+        }
+    }
+
+    void tile_done(int pass, int y0, int y1, bool last_pass) {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        if (last_pass && options.sink) {
+            for (int j = y0; j < y1; j++) {
+                options.sink->add_row(j, framebuffer);
+            }
+        }
+
+        tiles_done++;
+        int pass_samples = pass_targets[pass] - (pass > 0 ? pass_targets[pass - 1] : 0);
+        samples_done += double(y1 - y0) * framebuffer.image_width() * pass_samples;
+        if (!options.progress) {
+            return;
+        }
+
+        double samples_total = double(framebuffer.image_width()) * framebuffer.image_height() * pass_targets.back();
+        RenderProgress progress;
+        progress.tiles_done = tiles_done;
+        progress.tiles_total = tiles_per_pass * int(pass_targets.size());
+        progress.samples_per_pixel = tiles_done / tiles_per_pass > 0 ? pass_targets[(tiles_done / tiles_per_pass) - 1] : 0;
+        progress.seconds_elapsed = seconds_since_start();
+        progress.samples_per_second = samples_done / std::max(progress.seconds_elapsed, 1e-9);
+        progress.seconds_remaining = (samples_total - samples_done) / std::max(progress.samples_per_second, 1e-9);
+        options.progress(progress);
+    }
+
+    void complete(RenderStatus status) {
+        // Ends the job. Runs on the thread that finished its last tile, once no other tile is
+        // running.
+        if (options.sink) {
+            if (status == RenderStatus::Finished) {
+                options.sink->finish(framebuffer);
+            } else {
+                options.sink->cancelled(framebuffer);
+            }
+        }
+        promise.set_value(RenderResult{status, std::move(framebuffer), seconds_since_start()});
+    }
+
+    double seconds_since_start() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+};
+
+inline void RenderSink::cancel_job() {
+    if (job != nullptr) {
+        job->cancel();
+    }
+}
+
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "render_job.h"
+#include "thread_pool.h"
+
+inline bool same_image(const Framebuffer& a, const Framebuffer& b) {
+    // Whether two framebuffers hold exactly the same pixels.
+    size_t pixels = size_t(a.image_width()) * a.image_height();
+    if (a.image_width() != b.image_width() || a.image_height() != b.image_height()) {
+        return false;
+    }
+    for (size_t index = 0; index < pixels; index++) {
+        Color pa = a.pixel_color(index);
+        Color pb = b.pixel_color(index);
+        if (pa.x() != pb.x() || pa.y() != pb.y() || pa.z() != pb.z()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void render_job_report(Camera cam, std::shared_ptr<const Hittable> world, int jobs) {
+    // Runs jobs renders of the scene (each with its own seed) as RenderJobs on one shared pool of
+    // cam.threads threads: first one after another, then all queued at once, then queued at a low
+    // priority behind a single high priority one, and finally one that is cancelled a quarter of
+    // the way through. Logs the time each takes and checks the first job's image against
+    // Camera::render()'s.
+    cam.aovs = AOV_NONE;
+    cam.checkpoint_filename.clear();
+    cam.resume = false;
+    cam.preview_target.clear();
+    ThreadPool pool(cam.threads);
+    spdlog::info("{} jobs of {} samples per pixel on {} threads", jobs, cam.samples_per_pixel, pool.size());
+
+    auto job_camera = [&](int job) {
+        Camera camera = cam;
+        camera.seed = cam.seed + std::uint64_t(job);
+        return camera;
+    };
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    spdlog::level::level_enum log_level = spdlog::get_level();
+    spdlog::set_level(spdlog::level::warn);
+    Framebuffer reference = *job_camera(0).render_to_framebuffer(*world);
+    spdlog::set_level(log_level);
+
+    // One after another, logging the first one's progress at every pass.
+    auto start = std::chrono::steady_clock::now();
+    for (int job = 0; job < jobs; job++) {
+        RenderJobOptions options;
+        int logged_samples = 0;
+        if (job == 0) {
+            options.progress = [&logged_samples](const RenderProgress& progress) {
+                if (progress.samples_per_pixel > logged_samples) {
+                    logged_samples = progress.samples_per_pixel;
+                    spdlog::info("  Job 0: {}/{} tiles, {} spp, {:.3g} samples/s, {:.2f} s elapsed, {:.2f} s left",
+                                 progress.tiles_done, progress.tiles_total, progress.samples_per_pixel,
+                                 progress.samples_per_second, progress.seconds_elapsed, progress.seconds_remaining);
+                }
+            };
+        }
+        RenderJob render_job(pool, world, job_camera(job), options);
+        render_job.wait();
+        if (job == 0) {
+            bool same = same_image(render_job.result().get().framebuffer, reference);
+            spdlog::info("Job 0's image is {} to Camera::render()'s", same ? "identical" : "NOT identical");
+        }
+    }
+    double sequential_seconds = seconds_since(start);
+    spdlog::info("One after another: {:.2f} s, {:.2f} jobs/s", sequential_seconds, jobs / sequential_seconds);
+
+    // All at once, so the pool has other jobs' tiles to run while each job's last pass ends.
+    start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::unique_ptr<RenderJob>> queued;
+        for (int job = 0; job < jobs; job++) {
+            queued.push_back(std::make_unique<RenderJob>(pool, world, job_camera(job)));
+        }
+        for (auto& render_job : queued) {
+            render_job->wait();
+        }
+    }
+    double concurrent_seconds = seconds_since(start);
+    spdlog::info("All at once:       {:.2f} s, {:.2f} jobs/s ({:.2f}x)", concurrent_seconds, jobs / concurrent_seconds,
+                 sequential_seconds / concurrent_seconds);
+
+    // A high priority job queued behind the others overtakes them.
+    {
+        std::vector<std::unique_ptr<RenderJob>> queued;
+        for (int job = 0; job < jobs; job++) {
+            queued.push_back(std::make_unique<RenderJob>(pool, world, job_camera(job)));
+        }
+        RenderJobOptions urgent;
+        urgent.priority = 1;
+        RenderJob urgent_job(pool, world, job_camera(jobs), urgent);
+        urgent_job.wait();
+        double slowest = 0;
+        for (auto& render_job : queued) {
+            render_job->wait();
+            slowest = std::max(slowest, render_job->result().get().seconds);
+        }
+        spdlog::info("Priority: the high priority job took {:.2f} s, the {} queued before it up to {:.2f} s",
+                     urgent_job.result().get().seconds, jobs, slowest);
+    }
+
+    // Cancelled from its own progress callback, which may run before the job is known here, and
+    // then cancels it a tile later.
+    std::atomic<RenderJob*> cancelled_job{nullptr};
+    RenderJobOptions options;
+    options.progress = [&cancelled_job](const RenderProgress& progress) {
+        RenderJob* job = cancelled_job.load();
+        if (progress.tiles_done * 4 >= progress.tiles_total && job != nullptr) {
+            job->cancel();
+        }
+    };
+    RenderJob render_job(pool, world, job_camera(0), options);
+    cancelled_job.store(&render_job);
+    render_job.wait();
+    const RenderResult& result = render_job.result().get();
+    spdlog::info("Cancelled a quarter of the way: {} after {:.2f} s ({:.2f} s for the whole render above)",
+                 result.status == RenderStatus::Cancelled ? "cancelled" : "NOT cancelled", result.seconds,
+                 sequential_seconds / jobs);
+}
@@ -0,0 +1,419 @@
+#pragma once
+
+// A long running render daemon (render_daemon.cpp) and the protocol its clients, such as
+// render_client.cpp, speak. The daemon listens on a socket and renders what clients ask for on
+// one shared thread pool, keeping what it builds along the way in ResourceCache::shared() under a
+// memory cap: decoded images (keyed by their files' contents), built scenes with their
+// hierarchies and light samplers (keyed by the scene and the options it was built with, and
+// rebuilt if any file it loaded has changed) and finished images (keyed by the whole request). A
+// request that differs from an earlier one only in its camera or sample counts skips straight to
+// rendering, and a repeated one is answered from the cache.
+//
+// A request is a SERVICE_RENDER message. The daemon streams back the image after every pass
+// (the first of a single sample per pixel) as SERVICE_PASS messages, then the final image as
+// SERVICE_IMAGE, or a SERVICE_ERROR. Requests on one connection are handled in turn, as are
+// connections. Like the distributed renderer's, the protocol sends raw structs.
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "camera.h"
+#include "distributed.h"
+#include "environment_light.h"
+#include "framebuffer.h"
+#include "image_cache.h"
+#include "light_sampler.h"
+#include "render_job.h"
+#include "resource_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+enum ServiceMessageType : std::uint32_t {
+    SERVICE_RENDER = 1, // Client -> daemon: a RenderRequest followed by the environment filename, if any
+    SERVICE_PASS, // Daemon -> client: the image so far, params are its width, height and samples per pixel
+    SERVICE_IMAGE, // Daemon -> client: the final image, params as SERVICE_PASS plus RenderedFrom flags
+    SERVICE_ERROR, // Daemon -> client: `payload` bytes of message
+    SERVICE_SHUTDOWN, // Client -> daemon: stop once this connection closes
+};
+
+struct ServiceHeader {
+    std::uint32_t type;
+    std::uint32_t payload;
+    std::int32_t params[4];
+};
+
+const char* const default_daemon_address = "unix:/tmp/raytracinginaweekend-daemon.sock";
+
+// Which settings of a RenderRequest replace the scene's camera's.
+enum CameraOverrides : std::uint32_t {
+    OVERRIDE_LOOKFROM = 1 << 0,
+    OVERRIDE_LOOKAT = 1 << 1,
+    OVERRIDE_VFOV = 1 << 2,
+    OVERRIDE_DEFOCUS = 1 << 3, // defocus_angle and focus_distance
+};
+
+// Where a SERVICE_IMAGE came from, as bits of its last param.
+enum RenderedFrom : std::int32_t {
+    FROM_CACHED_SCENE = 1 << 0,
+    FROM_CACHED_IMAGE = 1 << 1,
+};
+
+struct RenderRequest {
+    std::int32_t scene = 7;
+    std::int32_t image_width = 0; // Zero keeps the scene's own setting, as do the next two
+    std::int32_t samples_per_pixel = 0;
+    std::int32_t samples_per_pass = 0;
+    std::uint64_t seed = 0;
+    std::int32_t light_sampling = std::int32_t(LightSampling::Bvh);
+    std::uint32_t overrides = 0; // CameraOverrides for which of the following to use
+    double lookfrom[3] = {0, 0, 0};
+    double lookat[3] = {0, 0, -1};
+    double vfov = 90;
+    double defocus_angle = 0;
+    double focus_distance = 10;
+    double environment_scale = 1;
+};
+
+// Requests are hashed as raw bytes, so they mustn't have any padding.
+static_assert(sizeof(RenderRequest) == (6 * 4) + 8 + (10 * 8), "RenderRequest has padding");
+
+inline bool send_service_message(int fd, ServiceHeader header, const void* payload = nullptr, size_t size = 0) {
+    header.payload = std::uint32_t(size);
+    return send_all(fd, &header, sizeof(header)) && send_all(fd, payload, size);
+}
+
+// The longest environment filename a request may carry.
+const size_t max_environment_filename = 4096;
+
+// The largest image and sample count the daemon renders, so that one request can't take the
+// daemon (and with it every other client) down by asking for more memory than there is.
+const size_t max_request_pixels = size_t(1) << 24;
+const std::int32_t max_request_samples_per_pixel = 1 << 16;
+
+inline std::string request_error(const RenderRequest& request) {
+    // Why the daemon won't render the request, or nothing if it will. The image size is checked
+    // against the scene's aspect ratio once the scene is built.
+    if (request.light_sampling < std::int32_t(LightSampling::None)
+        || request.light_sampling > std::int32_t(LightSampling::Bvh)) {
+        return fmt::format("Unknown light sampling {}", request.light_sampling);
+    }
+    if (request.image_width < 0) {
+        return fmt::format("Image width {} is negative", request.image_width);
+    }
+    if (request.samples_per_pixel < 0 || request.samples_per_pixel > max_request_samples_per_pixel) {
+        return fmt::format("{} samples per pixel is not between 0 and {}", request.samples_per_pixel,
+                           max_request_samples_per_pixel);
+    }
+    if (request.samples_per_pass < 0) {
+        return fmt::format("{} samples per pass is negative", request.samples_per_pass);
+    }
+    return {};
+}
+
+inline size_t max_service_payload(const ServiceHeader& header) {
+    // The most a message of its type can carry, so that a size that couldn't be right is refused
+    // before anything that big is allocated.
+    switch (header.type) {
+        case SERVICE_RENDER: return sizeof(RenderRequest) + max_environment_filename;
+        case SERVICE_PASS:
+        case SERVICE_IMAGE:
+            if (header.params[0] <= 0 || header.params[1] <= 0) {
+                return 0;
+            }
+            return max_compressed_tile_size(size_t(header.params[0]) * size_t(header.params[1]));
+        case SERVICE_ERROR: return 1 << 16;
+        default: return 0;
+    }
+}
+
+inline bool recv_service_message(int fd, ServiceHeader& header, std::vector<char>& payload) {
+    if (!recv_all(fd, &header, sizeof(header))) {
+        return false;
+    }
+    if (header.payload > max_service_payload(header)) {
+        spdlog::warn("Refusing a message of type {} with {} bytes", header.type, header.payload);
+        return false;
+    }
+    payload.resize(header.payload);
+    return recv_all(fd, payload.data(), payload.size());
+}
+
+inline std::vector<char> compress_framebuffer(const Framebuffer& framebuffer) {
+    // The average of each pixel's samples, top scanline first, compressed like a tile.
+    std::vector<Color> pixels(size_t(framebuffer.image_width()) * framebuffer.image_height());
+    for (size_t index = 0; index < pixels.size(); index++) {
+        pixels[index] = framebuffer.pixel_color(index);
+    }
+    return compress_tile(pixels);
+}
+
+// Daemon
+
+// A scene built for the daemon, ready to render with its camera.
+struct CachedScene {
+    Scene scene;
+    std::vector<FileDependency> files; // The image files it was built from
+};
+
+// A finished image, as sent to clients.
+struct CachedImage {
+    int width;
+    int height;
+    int samples_per_pixel;
+    std::vector<char> pixels; // Compressed
+};
+
+inline size_t allocated_bytes() {
+    // The bytes the heap has handed out, to measure what building a scene takes, or zero where
+    // that can't be found out.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+class StreamingSink : public RenderSink {
+public:
+    // Sends each pass of a render to a client, cancelling the render if the client goes away.
+    StreamingSink(int fd) : fd(fd) {}
+
+    void pass_done(const Framebuffer& framebuffer, int samples_per_pixel) override {
+        std::vector<char> pixels = compress_framebuffer(framebuffer);
+        ServiceHeader header{SERVICE_PASS, 0, {framebuffer.image_width(), framebuffer.image_height(), samples_per_pixel, 0}};
+        if (!disconnected && !send_service_message(fd, header, pixels.data(), pixels.size())) {
+            disconnected = true;
+            cancel_job();
+        }
+    }
+
+    std::atomic<bool> disconnected{false};
+
+private:
+    int fd;
+};
+
+class RenderDaemon {
+public:
+    RenderDaemon(int threads, size_t memory_cap) : pool(threads) { ResourceCache::shared().set_capacity(memory_cap); }
+
+    int run(const std::string& address) {
+        // Serves clients until one asks the daemon to shut down. Returns a process exit code.
+        ::signal(SIGPIPE, SIG_IGN); // A client that goes away shows up as a failed send instead
+        int listener = open_socket(address, true);
+        if (listener < 0) {
+            return 1;
+        }
+        spdlog::info("Listening on {} with {} threads and a {:.1f} MB cache", address, pool.size(),
+                     double(ResourceCache::shared().stats().capacity) / (1 << 20));
+
+        bool running = true;
+        while (running) {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            running = serve(fd);
+            ::close(fd);
+        }
+
+        ::close(listener);
+        if (address.rfind("unix:", 0) == 0) {
+            ::unlink(address.substr(5).c_str());
+        }
+        return 0;
+    }
+
+private:
+    ThreadPool pool;
+
+    bool serve(int fd) {
+        // Handles a client's requests until it disconnects. Returns false if it asked the daemon
+        // to shut down.
+        bool shutdown = false;
+        ServiceHeader header;
+        std::vector<char> payload;
+        while (recv_service_message(fd, header, payload)) {
+            if (header.type == SERVICE_SHUTDOWN) {
+                spdlog::info("Shutting down");
+                shutdown = true;
+            } else if (header.type == SERVICE_RENDER && payload.size() >= sizeof(RenderRequest)) {
+                RenderRequest request;
+                std::memcpy(&request, payload.data(), sizeof(request));
+                std::string environment(payload.begin() + sizeof(request), payload.end());
+                if (!render(fd, request, environment)) {
+                    break;
+                }
+            } else {
+                spdlog::warn("Ignoring a malformed message of type {}", header.type);
+                break;
+            }
+        }
+        return !shutdown;
+    }
+
+    bool render(int fd, const RenderRequest& request, const std::string& environment) {
+        // Answers a render request. Returns false if the client went away.
+        auto start = std::chrono::steady_clock::now();
+        std::string error = request_error(request);
+        if (!error.empty()) {
+            spdlog::warn("Refusing a request: {}", error);
+            return send_service_message(fd, ServiceHeader{SERVICE_ERROR, 0, {}}, error.data(), error.size());
+        }
+        std::uint64_t scene_key = ContentHash()
+                                      .add(std::string("scene"))
+                                      .add_value(request.scene)
+                                      .add_value(request.light_sampling)
+                                      .add(environment)
+                                      .add_value(request.environment_scale)
+                                      .value();
+
+        bool cached_scene = false;
+        std::shared_ptr<const CachedScene> scene = find_scene(scene_key, request, environment, cached_scene);
+        if (!scene) {
+            std::string message = fmt::format("Unknown scene {}", request.scene);
+            return send_service_message(fd, ServiceHeader{SERVICE_ERROR, 0, {}}, message.data(), message.size());
+        }
+        Camera frame = scene->scene.cam;
+        if (request.image_width > 0) {
+            frame.image_width = request.image_width;
+        }
+        if (size_t(frame.image_width) * size_t(frame.height()) > max_request_pixels) {
+            std::string message = fmt::format("A {}x{} image is larger than the {} pixels the daemon renders",
+                                              frame.image_width, frame.height(), max_request_pixels);
+            spdlog::warn("Refusing a request: {}", message);
+            return send_service_message(fd, ServiceHeader{SERVICE_ERROR, 0, {}}, message.data(), message.size());
+        }
+
+        // The image is keyed by the contents of the files the scene was built from as well, so
+        // one rendered before any of them changed isn't mistaken for a render of the new scene.
+        ContentHash image_hash;
+        image_hash.add(std::string("render")).add_value(scene_key).add_value(request);
+        for (const FileDependency& file : scene->files) {
+            image_hash.add(file.filename).add_value(file.hash);
+        }
+        std::uint64_t image_key = image_hash.value();
+        ResourceCache& cache = ResourceCache::shared();
+        int from = cached_scene ? FROM_CACHED_SCENE : 0;
+        std::shared_ptr<const CachedImage> image = cache.get<CachedImage>(image_key);
+        if (image) {
+            from |= FROM_CACHED_IMAGE;
+        } else {
+            image = render_image(fd, scene, request);
+            if (!image) {
+                spdlog::info("Client went away, render cancelled");
+                return false;
+            }
+            cache.put(image_key, image, sizeof(CachedImage) + image->pixels.size());
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ResourceCache::Stats stats = cache.stats();
+        spdlog::info("Scene {} ({}), {}x{} at {} spp ({}) in {:.3f} s; cache: {} entries, {:.1f}/{:.1f} MB, {} evicted",
+                     request.scene, cached_scene ? "cached" : "built", image->width, image->height,
+                     image->samples_per_pixel, (from & FROM_CACHED_IMAGE) ? "cached" : "rendered", seconds, stats.entries,
+                     double(stats.bytes) / (1 << 20), double(stats.capacity) / (1 << 20), stats.evictions);
+
+        ServiceHeader header{SERVICE_IMAGE, 0, {image->width, image->height, image->samples_per_pixel, from}};
+        return send_service_message(fd, header, image->pixels.data(), image->pixels.size());
+    }
+
+    std::shared_ptr<const CachedScene> find_scene(std::uint64_t key, const RenderRequest& request, const std::string& environment,
+                                                  bool& cached) {
+        // The scene from the cache if it's there and none of its files changed, else built anew
+        // and cached. Returns null for an unknown scene.
+        ResourceCache& cache = ResourceCache::shared();
+        std::shared_ptr<const CachedScene> found = cache.get<CachedScene>(key);
+        cached = found && files_unchanged(found->files);
+        if (cached) {
+            return found;
+        }
+
+        // Nothing else runs on this thread while the scene is built, and the pool is idle, so the
+        // heap's growth is what the scene takes, bar the images that are cached on their own.
+        auto start = std::chrono::steady_clock::now();
+        size_t allocated = allocated_bytes();
+        auto built = std::make_shared<CachedScene>();
+        FileDependencyRecorder recorder;
+        if (!build_scene(request.scene, built->scene)) {
+            return nullptr;
+        }
+
+        Scene& scene = built->scene;
+        LightSampling light_sampling = LightSampling(request.light_sampling);
+        if (light_sampling != LightSampling::None && !scene.lights.objects.empty()) {
+            scene.cam.lights = std::make_shared<LightSampler>(scene.lights, light_sampling);
+        }
+        if (!environment.empty()) {
+            scene.cam.environment = std::make_shared<EnvironmentLight>(environment.c_str(), request.environment_scale);
+        }
+        scene.cam.sample_environment = light_sampling != LightSampling::None;
+        built->files = std::move(recorder.files);
+
+        size_t grown = allocated_bytes() - std::min(allocated, allocated_bytes());
+        size_t bytes = sizeof(CachedScene) + (grown > recorder.loaded_bytes ? grown - recorder.loaded_bytes : 0);
+        cache.put(key, built, bytes);
+        spdlog::info("Built scene {} in {:.3f} s ({:.1f} MB)", request.scene,
+                     std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), double(bytes) / (1 << 20));
+        return built;
+    }
+
+    std::shared_ptr<const CachedImage> render_image(int fd, const std::shared_ptr<const CachedScene>& scene,
+                                                    const RenderRequest& request) {
+        // Renders the request on the pool, streaming each pass to the client. Returns null if the
+        // client went away.
+        Camera cam = scene->scene.cam;
+        if (request.image_width > 0) {
+            cam.image_width = request.image_width;
+        }
+        if (request.samples_per_pixel > 0) {
+            cam.samples_per_pixel = request.samples_per_pixel;
+        }
+        if (request.samples_per_pass > 0) {
+            cam.samples_per_pass = request.samples_per_pass;
+        }
+        cam.seed = request.seed;
+        if (request.overrides & OVERRIDE_LOOKFROM) {
+            cam.lookfrom = Point3(request.lookfrom[0], request.lookfrom[1], request.lookfrom[2]);
+        }
+        if (request.overrides & OVERRIDE_LOOKAT) {
+            cam.lookat = Point3(request.lookat[0], request.lookat[1], request.lookat[2]);
+        }
+        if (request.overrides & OVERRIDE_VFOV) {
+            cam.vfov = request.vfov;
+        }
+        if (request.overrides & OVERRIDE_DEFOCUS) {
+            cam.defocus_angle = request.defocus_angle;
+            cam.focus_distance = request.focus_distance;
+        }
+
+        auto sink = std::make_shared<StreamingSink>(fd);
+        RenderJobOptions options;
+        options.sink = sink;
+        options.first_pass_samples = 1;
+        // The world keeps the whole cache entry alive, in case it is evicted meanwhile.
+        RenderJob job(pool, std::shared_ptr<const Hittable>(scene, &scene->scene.world), cam, options);
+        job.wait();
+
+        const RenderResult& result = job.result().get();
+        if (result.status != RenderStatus::Finished || sink->disconnected) {
+            return nullptr;
+        }
+        auto image = std::make_shared<CachedImage>();
+        image->width = result.framebuffer.image_width();
+        image->height = result.framebuffer.image_height();
+        image->samples_per_pixel = cam.samples_per_pixel;
+        image->pixels = compress_framebuffer(result.framebuffer);
+        return image;
+    }
+};
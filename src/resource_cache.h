@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ContentHash {
+public:
+    // A 64-bit FNV-1a hash of whatever is added to it, to key cached things by what they were
+    // made from.
+    ContentHash& add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+        return *this;
+    }
+
+    ContentHash& add(const std::string& text) {
+        // The length goes first, so that consecutive strings can't run into each other.
+        add_value(std::uint64_t(text.size()));
+        return add(text.data(), text.size());
+    }
+
+    template <typename T>
+    ContentHash& add_value(const T& value) {
+        return add(&value, sizeof(value));
+    }
+
+    bool add_file(const std::string& filename) {
+        // Adds the contents of a file. Returns false if it couldn't be read, having added what
+        // it could.
+        std::FILE* file = std::fopen(filename.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        char buffer[1 << 16];
+        size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            add(buffer, count);
+        }
+        bool failed = std::ferror(file) != 0;
+        std::fclose(file);
+        return !failed;
+    }
+
+    std::uint64_t value() const { return hash; }
+
+private:
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+};
+
+class ResourceCache {
+public:
+    // Things that are expensive to make (decoded images, built scenes, finished renders) kept
+    // under a hash of what they were made from, so that asking for the same thing again costs
+    // nothing. Each entry counts its size in bytes against the capacity; past it, the least
+    // recently used entries are dropped. Dropped entries that are still in use elsewhere live on
+    // through their shared_ptrs, but are no longer counted. Safe to use from any thread.
+    //
+    // Keys should hash what kind of thing they are too, as get() trusts the caller about the
+    // type stored under a key.
+    static ResourceCache& shared() {
+        // The process's cache, which ImageTexture and EnvironmentLight load images through. Its
+        // capacity is unlimited unless set.
+        static ResourceCache cache;
+        return cache;
+    }
+
+    void set_capacity(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = bytes;
+        evict();
+    }
+
+    template <typename T>
+    std::shared_ptr<const T> get(std::uint64_t key) {
+        // The entry under key, now the most recently used, or null.
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return std::static_pointer_cast<const T>(found->second->value);
+    }
+
+    void put(std::uint64_t key, std::shared_ptr<const void> value, size_t bytes) {
+        // Stores value under key, replacing any entry there, as the most recently used.
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found != index.end()) {
+            used -= found->second->bytes;
+            entries.erase(found->second);
+        }
+        entries.push_front(Entry{key, std::move(value), bytes});
+        index[key] = entries.begin();
+        used += bytes;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        used = 0;
+    }
+
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t capacity;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+    };
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Stats{entries.size(), used, capacity, hits, misses, evictions};
+    }
+
+private:
+    struct Entry {
+        std::uint64_t key;
+        std::shared_ptr<const void> value;
+        size_t bytes;
+    };
+
+    mutable std::mutex mutex; // Guards everything below
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index;
+    size_t capacity = std::numeric_limits<size_t>::max();
+    size_t used = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+    void evict() {
+        // The newest entry stays even if it alone is over capacity, so it can still be handed out.
+        while (used > capacity && entries.size() > 1) {
+            used -= entries.back().bytes;
+            index.erase(entries.back().key);
+            entries.pop_back();
+            evictions++;
+        }
+    }
+};
@@ -43,19 +43,7 @@ public:
 
     bool hit (const Ray& r, Interval ray_t, HitRecord& rec) const override {
         // Transform the ray from world space to object space.
-        Point3 origin = Point3(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-        );
-
-        Vec3 direction = Vec3(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-        );
-
-        Ray rotated_r(origin, direction, r.time());
+        Ray rotated_r = to_object_space(r);
 
         // Determin whether an intersection exists in object space (and if so, where).
         if (!object->hit(rotated_r, ray_t, rec)) {
@@ -78,6 +66,10 @@ public:
         return true;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
     AABB bounding_box() const override {
         return bbox;
     }
@@ -87,4 +79,20 @@ private:
     double sin_theta;
     double cos_theta;
     AABB bbox;
+
+    Ray to_object_space(const Ray& r) const {
+        Point3 origin = Point3(
+            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
+            r.origin().y(),
+            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
+        );
+
+        Vec3 direction = Vec3(
+            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
+            r.direction().y(),
+            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
+        );
+
+        return Ray(origin, direction, r.time());
+    }
 };
@@ -70,6 +70,19 @@ public:
         return bdata + (y * bytes_per_scanline) + (x * bytes_per_pixel);
     }
 
+    const float* pixel_floats(int x, int y) const {
+        // Return the address of the three linear RGB floats of the pixel at x,y, unclamped, so
+        // that high dynamic range images keep their full range. If there is no image data,
+        // returns magenta.
+        static float magenta[] = { 1, 0, 1 };
+        if (fdata == nullptr) return magenta;
+
+        x = clamp(x, 0, image_width);
+        y = clamp(y, 0, image_height);
+
+        return fdata + (y * bytes_per_scanline) + (x * bytes_per_pixel);
+    }
+
 private:
     const int bytes_per_pixel = 3;
     float *fdata = nullptr; // Linear floating point pixel data
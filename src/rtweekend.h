@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <limits>
 //#include <cstdlib>
 #include <random>
@@ -24,11 +25,60 @@ inline double random_double() {
 }
 */
 
+class Pcg32 {
+public:
+    // A small, fast generator (PCG-XSH-RR, see pcg-random.org) that is cheap enough to reseed for
+    // every sample, which a Mersenne Twister is not.
+    using result_type = std::uint32_t;
+
+    constexpr Pcg32() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+
+    void seed(std::uint64_t initial_state) {
+        state = 0;
+        inc = 0xda3e39cb94b95bdbULL;
+        (*this)();
+        state += initial_state;
+        (*this)();
+    }
+
+    result_type operator()() {
+        std::uint64_t old_state = state;
+        state = (old_state * 6364136223846793005ULL) + inc;
+        std::uint32_t xorshifted = std::uint32_t(((old_state >> 18) ^ old_state) >> 27);
+        std::uint32_t rot = std::uint32_t(old_state >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+private:
+    std::uint64_t state;
+    std::uint64_t inc;
+};
+
+inline std::uint64_t mix_bits(std::uint64_t v) {
+    // Scrambles the bits of v (the SplitMix64 finalizer), so nearby inputs give unrelated outputs.
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+    return v ^ (v >> 31);
+}
+
+inline Pcg32& random_generator() {
+    // Each thread has its own generator, so render threads never contend for it.
+    static thread_local Pcg32 generator;
+    return generator;
+}
+
+inline void seed_random(std::uint64_t seed) {
+    // Restart this thread's random sequence from the given seed, e.g. so a sample comes out the same
+    // no matter when, where or by which thread it is taken.
+    random_generator().seed(seed);
+}
+
 inline double random_double() {
     // Return a random real in [0, 1)
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return random_generator()() * 0x1p-32;
 }
 
 inline double random_double(double min, double max) {
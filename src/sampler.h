@@ -0,0 +1,379 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "vec3.h"
+
+// A 2D sample in [0, 1)^2.
+struct Point2 {
+    double x;
+    double y;
+};
+
+class Sampler {
+public:
+    // Hands out the sample values for one camera path. Each call to get_1d() or get_2d() uses up
+    // the next dimension(s): the camera takes the pixel offset, then the lens position, then the
+    // time, and every bounce takes what its material needs after that. A given pixel, sample index
+    // and dimension always produce the same value.
+    virtual ~Sampler() = default;
+
+    virtual void start_pixel_sample(int i, int j, int sample_index) = 0;
+    virtual double get_1d() = 0;
+    virtual Point2 get_2d() = 0;
+
+    // How many dimensions of the current pixel sample are used up, so that a path can be set
+    // aside and picked up later with start_pixel_sample() and set_dimension().
+    virtual int current_dimension() const = 0;
+    virtual void set_dimension(int d) = 0;
+};
+
+enum class SamplerType {
+    Independent,
+    Stratified,
+    Halton,
+    Sobol,
+};
+
+inline bool parse_sampler_type(const std::string& name, SamplerType& type) {
+    if (name == "independent") {
+        type = SamplerType::Independent;
+    } else if (name == "stratified") {
+        type = SamplerType::Stratified;
+    } else if (name == "halton") {
+        type = SamplerType::Halton;
+    } else if (name == "sobol") {
+        type = SamplerType::Sobol;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* sampler_type_name(SamplerType type) {
+    switch (type) {
+        case SamplerType::Stratified: return "stratified";
+        case SamplerType::Halton: return "halton";
+        case SamplerType::Sobol: return "sobol";
+        default: return "independent";
+    }
+}
+
+inline bool sampler_depends_on_spp(SamplerType type) {
+    // Whether the sampler lays its pattern out for the requested sample count, so that a render
+    // can't be extended to more samples per pixel with the same pattern.
+    return type == SamplerType::Stratified || type == SamplerType::Sobol;
+}
+
+// Mappings from uniform samples to the shapes the renderer needs.
+
+inline Vec3 sample_unit_vector(Point2 u) {
+    // Maps a 2D sample to a point uniformly distributed on the unit sphere.
+    double z = 1 - (2 * u.x);
+    double r = std::sqrt(std::fmax(0.0, 1 - (z * z)));
+    double phi = 2 * pi * u.y;
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline Vec3 sample_unit_disk(Point2 u) {
+    // Maps a 2D sample to a point uniformly distributed in the unit disk (z = 0), using Shirley's
+    // concentric mapping so that nearby samples stay nearby.
+    double ox = (2 * u.x) - 1;
+    double oy = (2 * u.y) - 1;
+    if (ox == 0 && oy == 0) {
+        return Vec3(0, 0, 0);
+    }
+
+    double r;
+    double theta;
+    if (std::fabs(ox) > std::fabs(oy)) {
+        r = ox;
+        theta = (pi / 4) * (oy / ox);
+    } else {
+        r = oy;
+        theta = (pi / 2) - ((pi / 4) * (ox / oy));
+    }
+    return Vec3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
+inline Vec3 sample_uniform_cone(Point2 u, double cos_theta_max) {
+    // Maps a 2D sample to a direction uniformly distributed in the cone of directions within
+    // acos(cos_theta_max) of the z axis.
+    double cos_theta = (1 - u.x) + (u.x * cos_theta_max);
+    double sin_theta = std::sqrt(std::fmax(0.0, 1 - (cos_theta * cos_theta)));
+    double phi = 2 * pi * u.y;
+    return Vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+// Bit twiddling shared by the low-discrepancy samplers.
+
+const double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+inline std::uint32_t reverse_bits(std::uint32_t v) {
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+inline std::uint32_t permutation_element(std::uint32_t i, std::uint32_t length, std::uint32_t seed) {
+    // Returns the i-th element of a random permutation of [0, length) selected by seed, without
+    // building the permutation (Kensler, "Correlated Multi-Jittered Sampling").
+    std::uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893d;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3f;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+inline std::uint32_t owen_scramble(std::uint32_t v, std::uint32_t seed) {
+    // A hash-based approximation of Owen scrambling for base 2: each bit is flipped depending on
+    // a hash of the bits above it, which randomizes the sequence while keeping its stratification.
+    v = reverse_bits(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverse_bits(v);
+}
+
+inline double to_unit_double(std::uint32_t v) {
+    return std::fmin(v * 0x1p-32, one_minus_epsilon);
+}
+
+class IndependentSampler : public Sampler {
+public:
+    // Plain Monte Carlo: every dimension is an independent random number. The camera has already
+    // seeded the random sequence for this pixel sample, so these are deterministic too.
+    void start_pixel_sample(int i, int j, int sample_index) override {}
+
+    double get_1d() override { return random_double(); }
+
+    Point2 get_2d() override { return Point2{random_double(), random_double()}; }
+
+    // Only the random sequence carries state.
+    int current_dimension() const override { return 0; }
+    void set_dimension(int d) override {}
+};
+
+class StratifiedSampler : public Sampler {
+public:
+    // Jittered stratification: every dimension splits [0, 1) (or [0, 1)^2 on a square grid) into as
+    // many strata as there are samples per pixel, and each sample index lands in its own stratum.
+    // The strata are shuffled differently for every pixel and dimension so the dimensions don't
+    // line up with each other.
+    StratifiedSampler(int samples_per_pixel, std::uint64_t seed)
+      : samples_per_pixel(samples_per_pixel), seed(seed) {
+        grid_size = std::max(1, int(std::ceil(std::sqrt(double(samples_per_pixel)))));
+    }
+
+    void start_pixel_sample(int i, int j, int sample_index) override {
+        pixel_hash = mix_bits(seed ^ mix_bits((std::uint64_t(j) << 32) | std::uint32_t(i)));
+        index = sample_index;
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        std::uint32_t hash = std::uint32_t(mix_bits(pixel_hash + dimension++));
+        std::uint32_t stratum = permutation_element(index % samples_per_pixel, samples_per_pixel, hash);
+        return (stratum + random_double()) / samples_per_pixel;
+    }
+
+    Point2 get_2d() override {
+        std::uint32_t hash = std::uint32_t(mix_bits(pixel_hash + dimension));
+        dimension += 2;
+        int strata = grid_size * grid_size;
+        std::uint32_t stratum = permutation_element(index % strata, strata, hash);
+        int x = stratum % grid_size;
+        int y = stratum / grid_size;
+        return Point2{(x + random_double()) / grid_size, (y + random_double()) / grid_size};
+    }
+
+    int current_dimension() const override { return dimension; }
+    void set_dimension(int d) override { dimension = d; }
+
+private:
+    int samples_per_pixel;
+    int grid_size;
+    std::uint64_t seed;
+    std::uint64_t pixel_hash = 0;
+    int index = 0;
+    int dimension = 0;
+};
+
+class HaltonSampler : public Sampler {
+public:
+    // The Halton sequence, using the d-th prime as the base of dimension d, with the digits of
+    // every dimension scrambled by a per-pixel hash so neighboring pixels get decorrelated points.
+    // Dimensions beyond the table of primes fall back to independent random numbers.
+    HaltonSampler(std::uint64_t seed) : seed(seed) {
+        static const std::vector<int> table = generate_primes(max_dimensions);
+        primes = &table;
+    }
+
+    void start_pixel_sample(int i, int j, int sample_index) override {
+        pixel_hash = mix_bits(seed ^ mix_bits((std::uint64_t(j) << 32) | std::uint32_t(i)));
+        index = std::uint64_t(sample_index);
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        if (dimension >= max_dimensions) {
+            return random_double();
+        }
+        int d = dimension++;
+        return scrambled_radical_inverse((*primes)[d], index, std::uint32_t(mix_bits(pixel_hash + d)));
+    }
+
+    Point2 get_2d() override {
+        double x = get_1d();
+        double y = get_1d();
+        return Point2{x, y};
+    }
+
+    int current_dimension() const override { return dimension; }
+    void set_dimension(int d) override { dimension = d; }
+
+private:
+    static const int max_dimensions = 128;
+    const std::vector<int>* primes;
+    std::uint64_t seed;
+    std::uint64_t pixel_hash = 0;
+    std::uint64_t index = 0;
+    int dimension = 0;
+
+    static std::vector<int> generate_primes(int count) {
+        std::vector<int> found;
+        for (int candidate = 2; int(found.size()) < count; candidate++) {
+            bool is_prime = true;
+            for (int p : found) {
+                if (p * p > candidate) {
+                    break;
+                }
+                if (candidate % p == 0) {
+                    is_prime = false;
+                    break;
+                }
+            }
+            if (is_prime) {
+                found.push_back(candidate);
+            }
+        }
+        return found;
+    }
+
+    static double scrambled_radical_inverse(int base, std::uint64_t a, std::uint32_t hash) {
+        // Mirrors the base-b digits of a about the radix point, shifting each digit by an amount
+        // that depends on the digits before it (a nested random digit scramble).
+        double inv_base = 1.0 / base;
+        double inv_base_m = 1;
+        std::uint64_t reversed_digits = 0;
+        while (1 - ((base - 1) * inv_base_m) < 1) {
+            std::uint64_t next = a / base;
+            int digit = int(a - (next * base));
+            std::uint32_t digit_hash = std::uint32_t(mix_bits(hash ^ reversed_digits));
+            digit = int((digit + digit_hash) % std::uint32_t(base));
+            reversed_digits = (reversed_digits * base) + digit;
+            inv_base_m *= inv_base;
+            a = next;
+        }
+        return std::fmin(inv_base_m * reversed_digits, one_minus_epsilon);
+    }
+};
+
+class SobolSampler : public Sampler {
+public:
+    // A padded (0, 2)-sequence: every pair of dimensions gets the first two Sobol dimensions, which
+    // are well stratified in 2D, Owen scrambled with a per-pixel, per-dimension seed. The sample
+    // index is also shuffled per dimension pair, so the pairs are independent of each other.
+    SobolSampler(int samples_per_pixel, std::uint64_t seed) : samples_per_pixel(samples_per_pixel), seed(seed) {}
+
+    void start_pixel_sample(int i, int j, int sample_index) override {
+        pixel_hash = mix_bits(seed ^ mix_bits((std::uint64_t(j) << 32) | std::uint32_t(i)));
+        index = std::uint32_t(sample_index);
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        std::uint64_t hash = mix_bits(pixel_hash + dimension++);
+        std::uint32_t shuffled = shuffled_index(std::uint32_t(hash));
+        return to_unit_double(owen_scramble(reverse_bits(shuffled), std::uint32_t(hash >> 32)));
+    }
+
+    Point2 get_2d() override {
+        std::uint64_t hash = mix_bits(pixel_hash + dimension);
+        std::uint64_t hash_y = mix_bits(hash);
+        dimension += 2;
+        std::uint32_t shuffled = shuffled_index(std::uint32_t(hash));
+        return Point2{
+            to_unit_double(owen_scramble(reverse_bits(shuffled), std::uint32_t(hash >> 32))),
+            to_unit_double(owen_scramble(sobol_dimension_1(shuffled), std::uint32_t(hash_y)))
+        };
+    }
+
+    int current_dimension() const override { return dimension; }
+    void set_dimension(int d) override { dimension = d; }
+
+private:
+    int samples_per_pixel;
+    std::uint64_t seed;
+    std::uint64_t pixel_hash = 0;
+    std::uint32_t index = 0;
+    int dimension = 0;
+
+    std::uint32_t shuffled_index(std::uint32_t hash) const {
+        return index < std::uint32_t(samples_per_pixel) ? permutation_element(index, samples_per_pixel, hash) : index;
+    }
+
+    static std::uint32_t sobol_dimension_1(std::uint32_t a) {
+        // The second Sobol dimension; together with the van der Corput sequence (the bit reversal
+        // of the index) it forms a (0, 2)-sequence in base 2.
+        std::uint32_t result = 0;
+        for (std::uint32_t v = 1u << 31; a != 0; a >>= 1, v ^= v >> 1) {
+            if (a & 1) {
+                result ^= v;
+            }
+        }
+        return result;
+    }
+};
+
+inline std::unique_ptr<Sampler> make_sampler(SamplerType type, int samples_per_pixel, std::uint64_t seed) {
+    switch (type) {
+        case SamplerType::Stratified: return std::make_unique<StratifiedSampler>(samples_per_pixel, seed);
+        case SamplerType::Halton: return std::make_unique<HaltonSampler>(seed);
+        case SamplerType::Sobol: return std::make_unique<SobolSampler>(samples_per_pixel, seed);
+        default: return std::make_unique<IndependentSampler>();
+    }
+}
@@ -0,0 +1,616 @@
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "animation.h"
+#include "bvh.h"
+#include "camera.h"
+#include "checker_texture.h"
+#include "constant_medium.h"
+#include "dielectric.h"
+#include "diffuse_light.h"
+#include "dynamic_bvh.h"
+#include "environment_light.h"
+#include "grid_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "image_texture.h"
+#include "keyframed_transform.h"
+#include "lambertian.h"
+#include "material.h"
+#include "metal.h"
+#include "noise_texture.h"
+#include "perlin.h"
+#include "quad.h"
+#include "rotate_y.h"
+#include "sphere.h"
+#include "texture.h"
+#include "time_segmented_bvh.h"
+#include "translate.h"
+#include "vec3.h"
+#include "volume.h"
+
+// A scene is the world to render together with the camera set up to look at it, and the emitters
+// in the world that can be sampled directly.
+struct Scene {
+    HittableList world;
+    Camera cam;
+    HittableList lights;
+    std::shared_ptr<Animation> animation; // Set by scenes that move from frame to frame
+};
+
+inline Scene bouncing_spheres() {
+    HittableList world;
+
+    // --- Three Sphere Render
+    //std::shared_ptr<Material> material_ground = std::make_shared<Lambertian>(Color(0.8, 0.8, 0.0));
+    //std::shared_ptr<Material> material_center = std::make_shared<Lambertian>(Color(0.1, 0.2, 0.5));
+    //std::shared_ptr<Material> material_left = std::make_shared<Dielectric>(1.5);
+    //std::shared_ptr<Material> material_bubble = std::make_shared<Dielectric>(1.0 / 1.5);
+    //std::shared_ptr<Material> material_right = std::make_shared<Metal>(Color(0.8, 0.6, 0.2), 0.01);
+    //
+    //world.add(std::make_shared<Sphere>(Point3(0.0, -100.5, -1), 100.0, material_ground));
+    //world.add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1.2), 0.5, material_center));
+    //world.add(std::make_shared<Sphere>(Point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    //world.add(std::make_shared<Sphere>(Point3(-1.0, 0.0, -1.0), 0.4, material_bubble));
+    //world.add(std::make_shared<Sphere>(Point3(1.0, 0.0, -1.0), 0.5, material_right));
+
+    // --- Simple Render
+    //double R = std::cos(pi/4);
+    //
+    //std::shared_ptr<Material> material_left = std::make_shared<Lambertian>(Color(0, 0, 1));
+    //std::shared_ptr<Material> material_right = std::make_shared<Lambertian>(Color(1, 0, 0));
+    //
+    //world.add(std::make_shared<Sphere>(Point3(-R, 0, -1), R, material_left));
+    //world.add(std::make_shared<Sphere>(Point3(R, 0, -1), R, material_right));
+
+    // --- Final Render
+    //std::shared_ptr<Material> ground_material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    //world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground_material));
+
+    // --- Checker Render
+    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            double choose_mat = random_double();
+            Point3 center(a + (0.9 * random_double()), 0.2, b + (0.9 * random_double()));
+
+            if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
+                std::shared_ptr<Material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    Color albedo = Color::random() * Color::random();
+                    Point3 center2 = center + Vec3(0, random_double(0, 0.5), 0);
+                    sphere_material = std::make_shared<Lambertian>(albedo);
+                    world.add(std::make_shared<Sphere>(center, center2, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    Color albedo = Color::random(0.5, 1);
+                    double fuzz = random_double(0, 0.5);
+                    sphere_material = std::make_shared<Metal>(albedo, fuzz);
+                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = std::make_shared<Dielectric>(1.5);
+                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    std::shared_ptr<Material> material1 = std::make_shared<Dielectric>(1.5);
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+    std::shared_ptr<Material> material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
+    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+    std::shared_ptr<Material> material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+    // The diffuse spheres bounce during the shutter interval, so give each stretch of time its own
+    // hierarchy instead of one built around the spheres' whole sweeps.
+    world = HittableList(std::make_shared<TimeSegmentedBvh>(world));
+
+    // Camera
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    //cam.image_width = 19200;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13, 2, 3);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_distance = 10.0;
+
+    return Scene{world, cam};
+}
+
+inline Scene checkered_spheres() {
+    HittableList world;
+
+    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+
+    world.add(std::make_shared<Sphere>(Point3(0, -10, 0), 10, std::make_shared<Lambertian>(checker)));
+    world.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13, 2, 3);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam};
+}
+
+inline Scene earth() {
+    std::shared_ptr<Texture> earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
+    std::shared_ptr<Material> earth_surface = std::make_shared<Lambertian>(earth_texture);
+    std::shared_ptr<Sphere> globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(0, 0, 12);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{HittableList(globe), cam};
+}
+
+inline Scene perlin_spheres() {
+    HittableList world;
+
+    std::shared_ptr<Texture> pertext = std::make_shared<NoiseTexture>(4);
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
+    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13, 2, 3);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam};
+}
+
+inline Scene quads() {
+    HittableList world;
+
+    // Materials
+    std::shared_ptr<Material> left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
+    std::shared_ptr<Material> back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
+    std::shared_ptr<Material> right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
+    std::shared_ptr<Material> upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
+    std::shared_ptr<Material> lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(std::make_shared<Quad>(Point3(-3,-2, 5), Vec3(0, 0,-4), Vec3(0, 4, 0), left_red));
+    world.add(std::make_shared<Quad>(Point3(-2,-2, 0), Vec3(4, 0, 0), Vec3(0, 4, 0), back_green));
+    world.add(std::make_shared<Quad>(Point3( 3,-2, 1), Vec3(0, 0, 4), Vec3(0, 4, 0), right_blue));
+    world.add(std::make_shared<Quad>(Point3(-2, 3, 1), Vec3(4, 0, 0), Vec3(0, 0, 4), upper_orange));
+    world.add(std::make_shared<Quad>(Point3(-2,-3, 5), Vec3(4, 0, 0), Vec3(0, 0,-4), lower_teal));
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 80;
+    cam.lookfrom = Point3(0,0,9);
+    cam.lookat = Point3(0,0,0);
+    cam.vup = Vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam};
+}
+
+inline Scene simple_light() {
+    HittableList world;
+
+    std::shared_ptr<NoiseTexture> pertext = std::make_shared<NoiseTexture>(4);
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
+    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+    std::shared_ptr<DiffuseLight> difflight = std::make_shared<DiffuseLight>(Color(4, 4, 4));
+    HittableList lights;
+    lights.add(std::make_shared<Sphere>(Point3(0, 7, 0), 2, difflight));
+    lights.add(std::make_shared<Quad>(Point3(3, 1, -2), Vec3(2, 0, 0), Vec3(0, 2, 0), difflight));
+    for (const std::shared_ptr<Hittable>& light : lights.objects) {
+        world.add(light);
+    }
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(26, 3, 6);
+    cam.lookat = Point3(0, 2, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam, lights};
+}
+
+inline Scene cornell_box() {
+    HittableList world;
+
+    std::shared_ptr<Lambertian> red = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+    std::shared_ptr<Lambertian> white = std::make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
+    std::shared_ptr<Lambertian> green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+    std::shared_ptr<DiffuseLight> light = std::make_shared<DiffuseLight>(Color(15, 15, 15));
+
+    world.add(std::make_shared<Quad>(Point3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), green));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
+    std::shared_ptr<Quad> ceiling_light = std::make_shared<Quad>(Point3(343, 554, 332), Vec3(-130, 0, 0), Vec3(0, 0, -105), light);
+    world.add(ceiling_light);
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(555, 555, 555), Vec3(-555, 0, 0), Vec3(0, 0, -555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white));
+
+    //world.add(box(Point3(130, 0, 65), Point3(295, 165, 230), white));
+    //world.add(box(Point3(265, 9, 295), Point3(430, 330, 460), white));
+
+    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = std::make_shared<RotateY>(box1, 15);
+    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
+    world.add(box1);
+
+    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = std::make_shared<RotateY>(box2, -18);
+    box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
+    world.add(box2);
+
+    Camera cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = Point3(278, 278, -800);
+    cam.lookat = Point3(278, 278, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam, HittableList(ceiling_light)};
+}
+
+inline Scene many_lights() {
+    // A benchmark for light sampling: a field of 4096 small colored lights of varying brightness,
+    // half spheres and half quads facing every which way, over a floor scattered with diffuse
+    // spheres. Only a handful of lights matter to any one point.
+    HittableList world;
+    HittableList lights;
+
+    std::shared_ptr<Material> floor = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    world.add(std::make_shared<Quad>(Point3(-60, 0, -60), Vec3(120, 0, 0), Vec3(0, 0, 120), floor));
+
+    for (int i = 0; i < 64; i++) {
+        Point3 center(random_double(-30, 30), 1, random_double(-30, 30));
+        world.add(std::make_shared<Sphere>(center, 1, std::make_shared<Lambertian>(Color::random(0.2, 0.9))));
+    }
+
+    const int grid = 64;
+    for (int a = 0; a < grid; a++) {
+        for (int b = 0; b < grid; b++) {
+            Point3 center(-40 + ((a + random_double()) * 80.0 / grid), random_double(0.3, 3), -40 + ((b + random_double()) * 80.0 / grid));
+            Color emission = Color::random(0.2, 1) * (400 * random_double() * random_double() * random_double());
+            std::shared_ptr<Material> glow = std::make_shared<DiffuseLight>(emission);
+
+            std::shared_ptr<Hittable> light;
+            if ((a + b) % 2 == 0) {
+                light = std::make_shared<Sphere>(center, 0.04, glow);
+            } else {
+                Vec3 edge1 = 0.08 * random_unit_vector();
+                Vec3 edge2 = 0.08 * unit_vector(cross(edge1, random_unit_vector()));
+                light = std::make_shared<Quad>(center - (0.5 * (edge1 + edge2)), edge1, edge2, glow);
+            }
+            world.add(light);
+            lights.add(light);
+        }
+    }
+
+    world = HittableList(std::make_shared<BvhNode>(world));
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 8;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = Point3(0, 20, 40);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam, lights};
+}
+
+inline Scene animated_spheres() {
+    // A field of static spheres that a few keyframed objects move through: a glass sphere rolling
+    // across, a metal sphere bouncing, a spinning box and a ring of small orbiting spheres.
+    HittableList world;
+
+    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            Point3 center(a + (0.9 * random_double()), 0.2, b + (0.9 * random_double()));
+            if ((center - Point3(4, 0.2, 0)).length() <= 0.9 || std::fabs(center.z()) < 1.2) {
+                continue;
+            }
+            double choose_mat = random_double();
+            std::shared_ptr<Material> sphere_material;
+            if (choose_mat < 0.8) {
+                sphere_material = std::make_shared<Lambertian>(Color::random() * Color::random());
+            } else if (choose_mat < 0.95) {
+                sphere_material = std::make_shared<Metal>(Color::random(0.5, 1), random_double(0, 0.5));
+            } else {
+                sphere_material = std::make_shared<Dielectric>(1.5);
+            }
+            world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+        }
+    }
+
+    const int frames = 48;
+    std::vector<std::shared_ptr<KeyframedTransform>> animated;
+
+    std::shared_ptr<Hittable> glass = std::make_shared<Sphere>(Point3(0, 0, 0), 1, std::make_shared<Dielectric>(1.5));
+    animated.push_back(std::make_shared<KeyframedTransform>(glass, std::vector<Keyframe>{
+        {0, Vec3(-8, 1, 0)}, {frames - 1, Vec3(8, 1, 0)}}));
+
+    std::shared_ptr<Hittable> metal = std::make_shared<Sphere>(Point3(0, 0, 0), 1, std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0));
+    std::vector<Keyframe> bounces;
+    for (int frame = 0; frame <= frames; frame += 8) {
+        bounces.push_back({double(frame), Vec3(4, 1, 0)});
+        bounces.push_back({frame + 4.0, Vec3(4, 3, 0)});
+    }
+    animated.push_back(std::make_shared<KeyframedTransform>(metal, bounces));
+
+    std::shared_ptr<Hittable> cube = box(Point3(-0.75, 0, -0.75), Point3(0.75, 1.5, 0.75), std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1)));
+    animated.push_back(std::make_shared<KeyframedTransform>(cube, std::vector<Keyframe>{
+        {0, Vec3(-4, 0, 0), 0}, {frames - 1, Vec3(-4, 0, 0), 360}}));
+
+    std::shared_ptr<Material> orbit_material = std::make_shared<Lambertian>(Color(0.8, 0.1, 0.1));
+    for (int k = 0; k < 8; k++) {
+        std::vector<Keyframe> orbit;
+        for (int frame = 0; frame <= frames; frame += 4) {
+            double angle = (2 * pi * k / 8) + (2 * pi * frame / frames);
+            orbit.push_back({double(frame), Vec3(2.5 * std::cos(angle), 0.3, 2.5 * std::sin(angle))});
+        }
+        std::shared_ptr<Hittable> small = std::make_shared<Sphere>(Point3(0, 0, 0), 0.3, orbit_material);
+        animated.push_back(std::make_shared<KeyframedTransform>(small, orbit));
+    }
+
+    for (const std::shared_ptr<KeyframedTransform>& object : animated) {
+        world.add(object);
+    }
+
+    std::shared_ptr<DynamicBvh> bvh = std::make_shared<DynamicBvh>(world);
+    std::shared_ptr<Animation> animation = std::make_shared<Animation>(bvh);
+    for (const std::shared_ptr<KeyframedTransform>& object : animated) {
+        animation->add(object);
+    }
+    animation->last_frame = frames - 1;
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 32;
+    cam.max_depth = 50;
+    cam.background = Color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13, 2, 3);
+    cam.lookat = Point3(0, 0, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{HittableList(bvh), cam, HittableList(), animation};
+}
+
+inline Scene cornell_smoke() {
+    // The Cornell box with its tall box filled with thin fog and a patchy cloud of smoke in place of
+    // the short box.
+    HittableList world;
+
+    std::shared_ptr<Lambertian> red = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+    std::shared_ptr<Lambertian> white = std::make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
+    std::shared_ptr<Lambertian> green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+    std::shared_ptr<DiffuseLight> light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+
+    world.add(std::make_shared<Quad>(Point3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), green));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
+    std::shared_ptr<Quad> ceiling_light = std::make_shared<Quad>(Point3(113, 554, 127), Vec3(330, 0, 0), Vec3(0, 0, 305), light);
+    world.add(ceiling_light);
+    world.add(std::make_shared<Quad>(Point3(0, 555, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white));
+
+    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = std::make_shared<RotateY>(box1, 15);
+    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
+    world.add(std::make_shared<Volume>(box1, std::make_shared<ConstantMedium>(0.01), Color(1, 1, 1)));
+
+    // Turbulent noise, biased towards the center of the sphere bounding it and thresholded so most
+    // of the grid is empty.
+    const Point3 cloud_center(190, 130, 170);
+    const double cloud_radius = 130;
+    const int resolution = 64;
+    AABB cloud_bounds(cloud_center - Vec3(cloud_radius, cloud_radius, cloud_radius),
+                      cloud_center + Vec3(cloud_radius, cloud_radius, cloud_radius));
+    Perlin noise;
+    std::vector<double> densities(size_t(resolution) * resolution * resolution);
+    for (int z = 0; z < resolution; z++) {
+        for (int y = 0; y < resolution; y++) {
+            for (int x = 0; x < resolution; x++) {
+                Vec3 offset = (Vec3(x + 0.5, y + 0.5, z + 0.5) / resolution * 2) - Vec3(1, 1, 1);
+                double falloff = std::fmax(0, 1 - offset.length());
+                double turbulence = noise.turb(Point3(0, 0, 0) + (3 * offset), 5);
+                double density = std::fmax(0, turbulence + falloff - 0.5) * 0.2;
+                densities[(((size_t(z) * resolution) + y) * resolution) + x] = density;
+            }
+        }
+    }
+    std::shared_ptr<Medium> smoke = std::make_shared<GridMedium>(cloud_bounds, resolution, resolution, resolution, densities);
+    std::shared_ptr<Hittable> cloud_boundary = std::make_shared<Sphere>(cloud_center, cloud_radius, white);
+    world.add(std::make_shared<Volume>(cloud_boundary, smoke, Color(0.8, 0.8, 0.8)));
+
+    Camera cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 256;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = Point3(278, 278, -800);
+    cam.lookat = Point3(278, 278, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{world, cam, HittableList(ceiling_light)};
+}
+
+inline std::shared_ptr<EnvironmentLight> procedural_sky(const Vec3& sun_direction) {
+    // A clear sky over dim ground, with a sun a few pixels across that gives off most of the
+    // light: the kind of environment that uniform direction sampling handles worst.
+    const int width = 512;
+    const int height = 256;
+    const double sun_radius = degrees_to_radians(1.5);
+    const Color sun = 2000 * Color(1.0, 0.92, 0.8);
+    Vec3 to_sun = unit_vector(sun_direction);
+
+    std::vector<Color> pixels;
+    pixels.reserve(size_t(width) * height);
+    for (int y = 0; y < height; y++) {
+        double theta = pi * (y + 0.5) / height;
+        for (int x = 0; x < width; x++) {
+            double phi = (2 * pi * (x + 0.5) / width) - pi;
+            Vec3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi));
+            if (std::acos(std::fmin(1.0, dot(direction, to_sun))) < sun_radius) {
+                pixels.push_back(sun);
+            } else if (direction.y() < 0) {
+                pixels.push_back(Color(0.25, 0.22, 0.20));
+            } else {
+                double elevation = std::sqrt(direction.y());
+                pixels.push_back(((1 - elevation) * Color(0.9, 0.95, 1.0)) + (elevation * Color(0.3, 0.5, 1.0)));
+            }
+        }
+    }
+    return std::make_shared<EnvironmentLight>(width, height, std::move(pixels));
+}
+
+inline Scene sky_lit_spheres() {
+    // Spheres lit by nothing but the environment, a procedural sky with a bright sun.
+    HittableList world;
+
+    std::shared_ptr<Texture> checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1, std::make_shared<Dielectric>(1.5)));
+    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1, std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1, std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.2)));
+
+    Camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 50;
+    cam.environment = procedural_sky(Vec3(-1, 0.6, 0.8));
+
+    cam.vfov = 25;
+    cam.lookfrom = Point3(13, 2, 3);
+    cam.lookat = Point3(0, 0.5, 0);
+    cam.vup = Vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return Scene{HittableList(std::make_shared<BvhNode>(world)), cam};
+}
+
+inline bool build_scene(int scene_id, Scene& scene) {
+    // Builds the scene numbered scene_id (as picked by --scene). The random sequence is restarted
+    // first, so a scene comes out the same however many scenes were built before it.
+    random_generator() = Pcg32();
+    switch (scene_id) {
+        case 1: scene = bouncing_spheres(); break;
+        case 2: scene = checkered_spheres(); break;
+        case 3: scene = earth(); break;
+        case 4: scene = perlin_spheres(); break;
+        case 5: scene = quads(); break;
+        case 6: scene = simple_light(); break;
+        case 7: scene = cornell_box(); break;
+        case 8: scene = many_lights(); break;
+        case 9: scene = animated_spheres(); break;
+        case 10: scene = cornell_smoke(); break;
+        case 11: scene = sky_lit_spheres(); break;
+        default: return false;
+    }
+    scene.cam.scene_id = scene_id;
+    return true;
+}
+
+const int scene_count = 11;
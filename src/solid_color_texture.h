@@ -13,6 +13,8 @@ public:
         return albedo;
     }
 
+    const Color& color() const { return albedo; }
+
 private:
     Color albedo;
 };
@@ -5,8 +5,10 @@
 #include <spdlog/spdlog.h>
 
 #include "aabb.h"
+#include "fast_math.h"
 #include "hitrecord.h"
 #include "hittable.h"
+#include "instrumentation.h"
 #include "interval.h"
 #include "material.h"
 #include "vec3.h"
@@ -30,6 +32,7 @@ public:
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        count_primitive();
         Point3 current_center = center.at(r.time());
         Vec3 oc = current_center - r.origin();
         double a = r.direction().length_squared();
@@ -67,6 +70,7 @@ public:
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
+        rec.primitive_id = id;
         
         spdlog::trace("Hit Detected");
         spdlog::trace(" - sqrtd: {}", sqrtd);
@@ -80,8 +84,74 @@ public:
         return true;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        // The same root finding as hit(), without the hit record.
+        count_primitive();
+        Vec3 oc = center.at(r.time()) - r.origin();
+        double a = r.direction().length_squared();
+        double h = dot(r.direction(), oc);
+        double c = oc.length_squared() - (radius * radius);
+        double discriminant = (h * h) - (a * c);
+        if (discriminant < 0) {
+            return false;
+        }
+
+        double sqrtd = std::sqrt(discriminant);
+        return ray_t.surrounds((h - sqrtd) / a) || ray_t.surrounds((h + sqrtd) / a);
+    }
+
+    double pdf_value(const Point3& origin, const Vec3& direction, double time) const override {
+        if (!occluded(Ray(origin, direction, time), Interval(0.001, infinity))) {
+            return 0;
+        }
+
+        // Directions are sampled uniformly in the cone the sphere subtends at origin, or over
+        // all directions from inside it.
+        double distance_squared = (center.at(time) - origin).length_squared();
+        if (distance_squared <= radius * radius) {
+            return 1 / (4 * pi);
+        }
+        double cos_theta_max = std::sqrt(1 - ((radius * radius) / distance_squared));
+        return 1 / (2 * pi * (1 - cos_theta_max));
+    }
+
+    Vec3 random(const Point3& origin, Point2 sample, double time) const override {
+        Vec3 direction = center.at(time) - origin;
+        double distance_squared = direction.length_squared();
+        if (distance_squared <= radius * radius) {
+            return sample_unit_vector(sample);
+        }
+        double cos_theta_max = std::sqrt(1 - ((radius * radius) / distance_squared));
+        Vec3 s;
+        Vec3 t;
+        Vec3 axis = unit_vector(direction);
+        coordinate_system(axis, s, t);
+        Vec3 local = sample_uniform_cone(sample, cos_theta_max);
+        return (local.x() * s) + (local.y() * t) + (local.z() * axis);
+    }
+
+    bool light_bounds(LightBounds& bounds) const override {
+        // Normals point every way, and the sweep covers a moving sphere.
+        Color emission = mat->emitted(0.5, 0.5, center.at(0));
+        double phi = luminance(emission) * 4 * pi * radius * radius * pi;
+        if (phi <= 0) {
+            return false;
+        }
+        bounds = LightBounds(bbox, Vec3(0, 0, 1), phi, -1, 0, false);
+        return true;
+    }
+
     AABB bounding_box() const override { return bbox; }
 
+    AABB bounding_box(const Interval& time) const override {
+        // The center moves in a straight line, so the sweep over any time interval is bounded by
+        // the spheres at its two ends.
+        Vec3 rvec = Vec3(radius, radius, radius);
+        Point3 start = center.at(time.min);
+        Point3 end = center.at(time.max);
+        return AABB(AABB(start - rvec, start + rvec), AABB(end - rvec, end + rvec));
+    }
+
 private:
     Ray center;
     double radius;
@@ -96,8 +166,8 @@ private:
         //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
         //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-        double theta = std::acos(-p.y());
-        double phi = std::atan2(-p.z(), p.x()) + pi;
+        double theta = shading_acos(-p.y());
+        double phi = shading_atan2(-p.z(), p.x()) + pi;
 
         u = phi / (2 * pi);
         v = theta / pi;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "checker_texture.h"
+#include "color.h"
+#include "image_texture.h"
+#include "noise_texture.h"
+#include "solid_color_texture.h"
+#include "texture.h"
+#include "vec3.h"
+
+class TextureProgram {
+public:
+    // A texture graph compiled into a short array of tagged nodes, evaluated by a loop over a
+    // switch instead of a chain of virtual calls through shared_ptrs. Solid colors are folded into
+    // the nodes that use them, so a checker of two colors is a single node that picks one of them.
+    // Image and noise textures are called directly, and any other kind of texture through its
+    // vtable as before. The program points into the texture graph, which must outlive it.
+    TextureProgram() { nodes[0] = Node{Kind::Constant}; }
+
+    TextureProgram(const std::shared_ptr<Texture>& texture) { compile(texture.get()); }
+
+    Color value(double u, double v, const Point3& p) const {
+        int index = 0;
+        while (true) {
+            const Node& node = nodes[index];
+            switch (node.kind) {
+            case Kind::Constant:
+                return node.color;
+            case Kind::Checker:
+                // Picked without a branch, which would be mispredicted half the time.
+                index = node.children[CheckerTexture::is_even(node.scale, p) ? 0 : 1];
+                break;
+            case Kind::Image:
+                return static_cast<const ImageTexture*>(node.texture)->ImageTexture::value(u, v, p);
+            case Kind::Noise:
+                return static_cast<const NoiseTexture*>(node.texture)->NoiseTexture::value(u, v, p);
+            case Kind::Virtual:
+                return node.texture->value(u, v, p);
+            }
+        }
+    }
+
+    int size() const { return node_count; }
+
+private:
+    enum class Kind : std::uint8_t { Constant, Checker, Image, Noise, Virtual };
+
+    struct Node {
+        Kind kind;
+        std::array<std::uint8_t, 2> children{}; // A checker's even and odd children
+        double scale = 0; // A checker's inverse scale
+        Color color; // A constant's color
+        const Texture* texture = nullptr; // The texture to call for the other kinds
+    };
+
+    static const int max_nodes = 8;
+    std::array<Node, max_nodes> nodes;
+    int node_count = 1;
+
+    void compile(const Texture* texture) {
+        node_count = 0;
+        emit(texture, 0);
+    }
+
+    int emit(const Texture* texture, int reserved) {
+        // Appends the nodes of texture's graph, its root first, leaving room for reserved more,
+        // and returns the root's index. Graphs too big for the program keep their deepest parts
+        // as virtual calls.
+        int index = node_count++;
+        Node node{Kind::Virtual};
+        node.texture = texture;
+
+        if (auto solid = dynamic_cast<const SolidColorTexture*>(texture)) {
+            node.kind = Kind::Constant;
+            node.color = solid->color();
+        } else if (auto checker = dynamic_cast<const CheckerTexture*>(texture)) {
+            if (node_count + 2 + reserved <= max_nodes) {
+                node.kind = Kind::Checker;
+                node.scale = checker->inverse_scale();
+                nodes[index] = node;
+                int even = emit(checker->even_texture().get(), reserved + 1);
+                int odd = emit(checker->odd_texture().get(), reserved);
+                nodes[index].children = {std::uint8_t(even), std::uint8_t(odd)};
+                return index;
+            }
+        } else if (dynamic_cast<const ImageTexture*>(texture) != nullptr) {
+            node.kind = Kind::Image;
+        } else if (dynamic_cast<const NoiseTexture*>(texture) != nullptr) {
+            node.kind = Kind::Noise;
+        }
+        nodes[index] = node;
+        return index;
+    }
+};
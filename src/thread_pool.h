@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // A fixed set of worker threads running submitted tasks. Tasks may submit more tasks and wait
+    // for them: a thread that waits runs queued tasks in the meantime instead of blocking, so
+    // recursive work (a task per subtree, say) can't deadlock the pool however deep it goes.
+    // Queued tasks of a higher priority run before any of a lower one, so a pool shared by several
+    // jobs can put the urgent ones first.
+    ThreadPool(int threads = 0) {
+        // Runs on threads threads in all, counting whichever thread waits; 0 means one per
+        // hardware thread.
+        int count = threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+        for (int t = 1; t < count; t++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return int(workers.size()) + 1; }
+
+    // Counts a group of tasks down to zero as they finish, so their submitter can wait for them.
+    class TaskGroup {
+    public:
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> pending{0};
+    };
+
+    void submit(TaskGroup& group, std::function<void()> task, int priority = 0) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queues[priority].push_back(Task{std::move(task), &group});
+        }
+        wake.notify_one();
+    }
+
+    void wait(TaskGroup& group) {
+        // Runs queued tasks, from this group or any other, until every task in the group is done.
+        while (!group.done()) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (queues.empty()) {
+                    // The group's last tasks are running elsewhere; wait for one of them to end.
+                    finished.wait(lock, [&] { return group.done() || !queues.empty(); });
+                    continue;
+                }
+                task = take(false);
+            }
+            run(task);
+        }
+    }
+
+    void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+        // Calls body(begin, end) over [0, count) in chunks of at least grain, spread over the
+        // pool, and returns once every chunk is done.
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(size_t(size()) * 4, count / std::max<size_t>(grain, 1)));
+        TaskGroup group;
+        for (size_t c = 1; c < chunks; c++) {
+            submit(group, [=, &body] { body((count * c) / chunks, (count * (c + 1)) / chunks); });
+        }
+        body(0, count / chunks);
+        wait(group);
+    }
+
+private:
+    struct Task {
+        std::function<void()> function;
+        TaskGroup* group = nullptr;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex; // Guards queues and stopping
+    std::condition_variable wake; // Signalled when a task is queued or the pool stops
+    std::condition_variable finished; // Signalled when a task finishes
+    std::map<int, std::deque<Task>> queues; // Queued tasks by priority, without empty queues
+    bool stopping = false;
+
+    Task take(bool oldest) {
+        // Removes a task of the highest priority queued, the oldest or the newest one, with the
+        // lock held.
+        auto highest = std::prev(queues.end());
+        std::deque<Task>& queue = highest->second;
+        Task task;
+        if (oldest) {
+            task = std::move(queue.front());
+            queue.pop_front();
+        } else {
+            task = std::move(queue.back());
+            queue.pop_back();
+        }
+        if (queue.empty()) {
+            queues.erase(highest);
+        }
+        return task;
+    }
+
+    void run(Task& task) {
+        task.function();
+        // Notify under the lock, so a waiter can't miss it between checking and sleeping.
+        std::lock_guard<std::mutex> lock(mutex);
+        task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+        finished.notify_all();
+    }
+
+    void work() {
+        // Workers take the oldest task, which for recursive work is the biggest, while waiters
+        // take the newest, which is likeliest to be one they are waiting for.
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queues.empty(); });
+                if (queues.empty()) {
+                    return;
+                }
+                task = take(true);
+            }
+            run(task);
+        }
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instrumentation.h"
+
+class TimeSegmentedBvh : public Hittable {
+public:
+    // A bounding volume hierarchy for scenes with moving objects. The tree is split the same way
+    // as BvhNode, using each object's bounds over its whole motion, but every node then keeps one
+    // box per segment of the shutter interval [0, 1], refit to the objects' bounds over that
+    // segment only. A ray is traced against the boxes of the segment holding its time, so a
+    // moving object costs roughly what it covers during that segment instead of its whole sweep.
+    TimeSegmentedBvh(const HittableList& list, int segment_count = 8)
+    : segment_count(std::max(segment_count, 1)) {
+        std::vector<std::shared_ptr<Hittable>> objects = list.objects;
+        if (!objects.empty()) {
+            build(objects, 0, objects.size());
+        }
+        refit();
+        bbox = list.bounding_box();
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const AABB* segment_bounds = &bounds[segment_index(r.time()) * nodes.size()];
+        bool hit_anything = false;
+
+        // Nodes are laid out depth first, so a node's left child directly follows it and only the
+        // right child needs to be remembered.
+        size_t stack[64];
+        size_t stack_size = 0;
+        size_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (segment_bounds[node_index].hit(r, ray_t)) {
+                if (node.object) {
+                    if (node.object->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                } else {
+                    stack[stack_size++] = node.right;
+                    node_index++;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                break;
+            }
+            node_index = stack[--stack_size];
+        }
+        return hit_anything;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        // The same traversal as hit(), but it stops at the first leaf that blocks the ray.
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const AABB* segment_bounds = &bounds[segment_index(r.time()) * nodes.size()];
+        size_t stack[64];
+        size_t stack_size = 0;
+        size_t node_index = 0;
+        while (true) {
+            const Node& node = nodes[node_index];
+            count_bvh_node();
+            if (segment_bounds[node_index].hit(r, ray_t)) {
+                if (node.object) {
+                    if (node.object->occluded(r, ray_t)) {
+                        return true;
+                    }
+                } else {
+                    stack[stack_size++] = node.right;
+                    node_index++;
+                    continue;
+                }
+            }
+            if (stack_size == 0) {
+                return false;
+            }
+            node_index = stack[--stack_size];
+        }
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    AABB bounding_box(const Interval& time) const override {
+        if (nodes.empty()) {
+            return AABB::empty;
+        }
+        AABB time_bbox = AABB::empty;
+        for (size_t segment = segment_index(time.min); segment <= segment_index(time.max); segment++) {
+            time_bbox = AABB(time_bbox, bounds[segment * nodes.size()]);
+        }
+        return time_bbox;
+    }
+
+    bool describe_hierarchy(HierarchyDescription& description) const override {
+        // Describes each node by its bounds over the whole shutter interval, which is what it
+        // would take without segments; a ray only ever meets one segment's share of that.
+        description.type = "TimeSegmentedBvh";
+        description.bytes = (nodes.capacity() * sizeof(Node)) + (bounds.capacity() * sizeof(AABB));
+        description.nodes.resize(nodes.size());
+        for (size_t node_index = nodes.size(); node_index-- > 0;) {
+            const Node& node = nodes[node_index];
+            HierarchyDescription::Node& described = description.nodes[node_index];
+            if (node.object) {
+                described.objects.push_back(node.object);
+                described.bbox = node.object->bounding_box();
+            } else {
+                described.left = int(node_index + 1);
+                described.right = int(node.right);
+                described.bbox = AABB(description.nodes[node_index + 1].bbox, description.nodes[node.right].bbox);
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Node {
+        std::shared_ptr<Hittable> object; // Set for leaves only
+        size_t right = 0; // Index of the right child of an interior node
+    };
+
+    int segment_count;
+    std::vector<Node> nodes;
+    std::vector<AABB> bounds; // segment_count boxes per node, stored segment by segment
+    AABB bbox;
+
+    void build(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) {
+        // Same median split as BvhNode, except that every object gets a leaf of its own.
+        size_t node_index = nodes.size();
+        nodes.emplace_back();
+
+        size_t object_span = end - start;
+        if (object_span == 1) {
+            nodes[node_index].object = objects[start];
+            return;
+        }
+
+        AABB span_bbox = AABB::empty;
+        for (size_t object_index = start; object_index < end; object_index++) {
+            span_bbox = AABB(span_bbox, objects[object_index]->bounding_box());
+        }
+        int axis = span_bbox.longest_axis();
+
+        std::sort(std::begin(objects) + start, std::begin(objects) + end,
+                  [axis](const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
+                      return a->bounding_box().axis_interval(axis).min < b->bounding_box().axis_interval(axis).min;
+                  });
+
+        size_t mid = start + (object_span / 2);
+        build(objects, start, mid);
+        nodes[node_index].right = nodes.size();
+        build(objects, mid, end);
+    }
+
+    void refit() {
+        // Children always come after their parent, so walking the nodes backwards sees both
+        // children of a node before the node itself.
+        bounds.assign(size_t(segment_count) * nodes.size(), AABB::empty);
+        for (int segment = 0; segment < segment_count; segment++) {
+            Interval time(double(segment) / segment_count, double(segment + 1) / segment_count);
+            AABB* segment_bounds = &bounds[segment * nodes.size()];
+            for (size_t node_index = nodes.size(); node_index-- > 0;) {
+                const Node& node = nodes[node_index];
+                if (node.object) {
+                    segment_bounds[node_index] = node.object->bounding_box(time);
+                } else {
+                    segment_bounds[node_index] = AABB(segment_bounds[node_index + 1], segment_bounds[node.right]);
+                }
+            }
+        }
+    }
+
+    size_t segment_index(double time) const {
+        // Times outside the shutter interval use the nearest segment.
+        double scaled = time * segment_count;
+        if (!(scaled > 0)) {
+            return 0;
+        }
+        return std::min(size_t(scaled), size_t(segment_count) - 1);
+    }
+};
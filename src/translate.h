@@ -28,10 +28,19 @@ public:
         return true;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        Ray offset_r(r.origin() - offset, r.direction(), r.time());
+        return object->occluded(offset_r, ray_t);
+    }
+
     AABB bounding_box() const override {
         return bbox;
     }
 
+    AABB bounding_box(const Interval& time) const override {
+        return object->bounding_box(time) + offset;
+    }
+
 private:
     std::shared_ptr<Hittable> object;
     Vec3 offset;
@@ -116,6 +116,16 @@ inline Vec3 unit_vector(const Vec3& v) {
     return v / v.length();
 }
 
+inline void coordinate_system(const Vec3& n, Vec3& s, Vec3& t) {
+    // Completes the unit vector n to an orthonormal basis s, t, n (Duff et al., "Building an
+    // Orthonormal Basis, Revisited").
+    double sign = std::copysign(1.0, n.z());
+    double a = -1 / (sign + n.z());
+    double b = n.x() * n.y() * a;
+    s = Vec3(1 + (sign * n.x() * n.x() * a), sign * b, -sign * n.x());
+    t = Vec3(b, sign + (n.y() * n.y() * a), -n.y());
+}
+
 inline Vec3 random_unit_vector() {
     while (true) {
         Vec3 p = Vec3::random(-1, 1);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "color.h"
+#include "hitrecord.h"
+#include "hittable.h"
+#include "instrumentation.h"
+#include "interval.h"
+#include "isotropic.h"
+#include "material.h"
+#include "medium.h"
+#include "ray.h"
+#include "texture.h"
+#include "vec3.h"
+
+class Volume : public Hittable {
+public:
+    // Fills the inside of a closed boundary (a Sphere, a box(), ...) with a medium. A ray "hits"
+    // the volume where it first interacts with the medium, and scatters off it there according to
+    // the phase function. The boundary is assumed to be convex; a ray that leaves it never
+    // re-enters.
+    Volume(std::shared_ptr<Hittable> boundary, std::shared_ptr<Medium> medium, std::shared_ptr<Texture> tex)
+    : boundary(boundary), medium(medium), phase_function(std::make_shared<Isotropic>(tex)) {}
+
+    Volume(std::shared_ptr<Hittable> boundary, std::shared_ptr<Medium> medium, const Color& albedo)
+    : boundary(boundary), medium(medium), phase_function(std::make_shared<Isotropic>(albedo)) {}
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        // Counted as a primitive of its own, on top of the tests against its boundary.
+        count_primitive();
+        double ray_length;
+        double distance;
+        if (!sample_collision(r, ray_t, ray_length, distance)) {
+            return false;
+        }
+
+        rec.t = distance / ray_length;
+        rec.p = r.at(rec.t);
+        rec.normal = Vec3(0, 0, 0); // A point in a medium has no surface normal
+        rec.front_face = true;
+        rec.u = 0;
+        rec.v = 0;
+        rec.mat = phase_function;
+        rec.primitive_id = id;
+        return true;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        // Light gets through with probability equal to the transmittance, so a shadow ray that
+        // delta tracking finds a collision for counts as blocked.
+        count_primitive();
+        double ray_length;
+        double distance;
+        return sample_collision(r, ray_t, ray_length, distance);
+    }
+
+    AABB bounding_box() const override { return boundary->bounding_box(); }
+
+private:
+    std::shared_ptr<Hittable> boundary;
+    std::shared_ptr<Medium> medium;
+    std::shared_ptr<Material> phase_function;
+
+    bool sample_collision(const Ray& r, Interval ray_t, double& ray_length, double& distance) const {
+        // Find where the ray enters and leaves the boundary, then hand the part of that span within
+        // ray_t to the medium in units of distance.
+        HitRecord enter;
+        HitRecord leave;
+        if (!boundary->hit(r, Interval::universe, enter)) {
+            return false;
+        }
+        if (!boundary->hit(r, Interval(enter.t + 0.0001, infinity), leave)) {
+            return false;
+        }
+
+        Interval segment(std::fmax(enter.t, ray_t.min), std::fmin(leave.t, ray_t.max));
+        if (segment.min >= segment.max) {
+            return false;
+        }
+        if (segment.min < 0) {
+            segment.min = 0;
+        }
+
+        ray_length = r.direction().length();
+        Vec3 direction = r.direction() / ray_length;
+        Interval distances(segment.min * ray_length, segment.max * ray_length);
+        return medium->sample_collision(r.origin(), direction, distances, distance);
+    }
+};